@@ -0,0 +1,614 @@
+/*
+ * curve25519.c - X25519 with 32-bit limbs
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * This replaces crypto_scalarmult of TweetNaCl, which uses 16 limbs of 16 bits
+ * in 64-bit integers, and therefore needs 256 64-bit multiplications per field
+ * multiplication. Here, field elements have ten limbs of alternately 26 and 25
+ * bits (radix 2^25.5), as in the "ref10" implementation of SUPERCOP [1]. The
+ * products of limbs fit in 64 bits, and a field multiplication takes 100 32x32
+ * bit multiplications, a squaring 55.
+ *
+ * The ladder is that of RFC 7748 [2]. Like TweetNaCl's, it runs in constant
+ * time: there are no branches or memory accesses that depend on secret data.
+ *
+ * crypto_scalarmult_base uses a table of multiples of the base point instead of
+ * the ladder. See "Fixed-base scalar multiplication" below.
+ *
+ * Make with CURVE25519=tweetnacl to use TweetNaCl's implementation instead.
+ *
+ * [1] https://bench.cr.yp.to/supercop.html, crypto_scalarmult/curve25519/ref10
+ * [2] https://www.rfc-editor.org/rfc/rfc7748
+ */
+
+#ifdef CURVE25519_REF10
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tweetnacl.h"
+
+
+typedef int32_t fe[10];
+
+
+/* --- Limbs --------------------------------------------------------------- */
+
+
+/*
+ * Limb i holds bits ceil(25.5 * i) and up, i.e., even limbs have 26 bits and
+ * odd limbs 25. Between operations, limbs can exceed their width by a few bits,
+ * and can be negative.
+ */
+
+static inline unsigned limb_bits(unsigned i)
+{
+	return i & 1 ? 25 : 26;
+}
+
+
+/*
+ * carry moves the bits of h[i] beyond its width to h[i + 1], rounding such that
+ * h[i] ends up between -2^(bits - 1) and 2^(bits - 1). What comes out of the
+ * top limb wraps around to h[0], times 19, since 2^255 = 19 (mod 2^255 - 19).
+ */
+
+static inline void carry(int64_t *h, unsigned i)
+{
+	unsigned bits = limb_bits(i);
+	int64_t c = (h[i] + ((int64_t) 1 << (bits - 1))) >> bits;
+
+	if (i == 9)
+		h[0] += c * 19;
+	else
+		h[i + 1] += c;
+	h[i] -= c * ((int64_t) 1 << bits);
+}
+
+
+/*
+ * reduce carries in two interleaved chains, so that the limbs of "h" fit in
+ * their widths plus one bit, and stores them in "out".
+ */
+
+static void reduce(fe out, int64_t *h)
+{
+	static const uint8_t order[] = { 0, 4, 1, 5, 2, 6, 3, 7, 4, 8, 9, 0 };
+	unsigned i;
+
+	for (i = 0; i != sizeof(order); i++)
+		carry(h, order[i]);
+	for (i = 0; i != 10; i++)
+		out[i] = h[i];
+}
+
+
+/* --- Field arithmetic ---------------------------------------------------- */
+
+
+static void fe_0(fe h)
+{
+	memset(h, 0, sizeof(fe));
+}
+
+
+static void fe_1(fe h)
+{
+	fe_0(h);
+	h[0] = 1;
+}
+
+
+static void fe_copy(fe h, const fe f)
+{
+	memcpy(h, f, sizeof(fe));
+}
+
+
+/*
+ * fe_add and fe_sub don't carry. Their results are used as factors, possibly
+ * after one more addition or subtraction (in the point operations below).
+ */
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+	unsigned i;
+
+	for (i = 0; i != 10; i++)
+		h[i] = f[i] + g[i];
+}
+
+
+static void fe_sub(fe h, const fe f, const fe g)
+{
+	unsigned i;
+
+	for (i = 0; i != 10; i++)
+		h[i] = f[i] - g[i];
+}
+
+
+/* fe_cswap swaps "f" and "g" if "b" is 1, and leaves them alone if it is 0 */
+
+static void fe_cswap(fe f, fe g, uint32_t b)
+{
+	int32_t mask = -(int32_t) b;
+	unsigned i;
+
+	for (i = 0; i != 10; i++) {
+		int32_t x = (f[i] ^ g[i]) & mask;
+
+		f[i] ^= x;
+		g[i] ^= x;
+	}
+}
+
+
+/* fe_cmov sets "f" to "g" if "b" is 1, and leaves it alone if it is 0 */
+
+static void fe_cmov(fe f, const fe g, uint32_t b)
+{
+	int32_t mask = -(int32_t) b;
+	unsigned i;
+
+	for (i = 0; i != 10; i++)
+		f[i] ^= (f[i] ^ g[i]) & mask;
+}
+
+
+/*
+ * Limb i of "f" times limb j of "g" has the weight 2^(ceil(25.5 * i) +
+ * ceil(25.5 * j)). This is the weight of limb i + j, except if both i and j
+ * are odd, where it is twice that. Products that go beyond limb 9 wrap around,
+ * times 19. Multiplying the 32-bit factors first keeps all multiplications at
+ * 32x32 bits.
+ */
+
+static void fe_mul(fe h, const fe f, const fe g)
+{
+	int32_t g19[10];
+	int64_t t[10] = { 0, };
+	unsigned i, j;
+
+	for (j = 0; j != 10; j++)
+		g19[j] = 19 * g[j];
+	for (i = 0; i != 10; i++) {
+		int32_t fi = f[i];
+		int32_t fi2 = 2 * f[i];
+
+		for (j = 0; j != 10; j++) {
+			int32_t a = i & j & 1 ? fi2 : fi;
+
+			if (i + j < 10)
+				t[i + j] += (int64_t) a * g[j];
+			else
+				t[i + j - 10] += (int64_t) a * g19[j];
+		}
+	}
+	reduce(h, t);
+}
+
+
+/*
+ * fe_sq is fe_mul(h, f, f), adding each product f[i] * f[j] only once. fe_sq2
+ * computes 2 * f^2, doubling before the carries.
+ */
+
+static void square(int64_t t[10], const fe f)
+{
+	unsigned i, j;
+
+	memset(t, 0, 10 * sizeof(int64_t));
+	for (i = 0; i != 10; i++)
+		for (j = i; j != 10; j++) {
+			int32_t a =
+			    f[i] * (i == j ? 1 : 2) * (i & j & 1 ? 2 : 1);
+			int32_t b = i + j < 10 ? f[j] : 19 * f[j];
+
+			t[(i + j) % 10] += (int64_t) a * b;
+		}
+}
+
+
+static void fe_sq(fe h, const fe f)
+{
+	int64_t t[10];
+
+	square(t, f);
+	reduce(h, t);
+}
+
+
+static void fe_sq2(fe h, const fe f)
+{
+	int64_t t[10];
+	unsigned i;
+
+	square(t, f);
+	for (i = 0; i != 10; i++)
+		t[i] *= 2;
+	reduce(h, t);
+}
+
+
+/* 121666 = (486662 + 2) / 4, from the curve equation */
+
+static void fe_mul121666(fe h, const fe f)
+{
+	static const uint8_t order[] = { 9, 1, 3, 5, 7, 0, 2, 4, 6, 8 };
+	int64_t t[10];
+	unsigned i;
+
+	for (i = 0; i != 10; i++)
+		t[i] = (int64_t) f[i] * 121666;
+	for (i = 0; i != sizeof(order); i++)
+		carry(t, order[i]);
+	for (i = 0; i != 10; i++)
+		h[i] = t[i];
+}
+
+
+/* fe_invert raises "z" to the power of p - 2 = 2^255 - 21 */
+
+static void fe_sq_n(fe h, const fe f, unsigned n)
+{
+	fe_sq(h, f);
+	while (--n)
+		fe_sq(h, h);
+}
+
+
+static void fe_invert(fe out, const fe z)
+{
+	fe t0, t1, t2, t3;
+
+	fe_sq(t0, z);			/* 2 */
+	fe_sq_n(t1, t0, 2);		/* 8 */
+	fe_mul(t1, z, t1);		/* 9 */
+	fe_mul(t0, t0, t1);		/* 11 */
+	fe_sq(t2, t0);			/* 22 */
+	fe_mul(t1, t1, t2);		/* 2^5 - 1 */
+	fe_sq_n(t2, t1, 5);
+	fe_mul(t1, t2, t1);		/* 2^10 - 1 */
+	fe_sq_n(t2, t1, 10);
+	fe_mul(t2, t2, t1);		/* 2^20 - 1 */
+	fe_sq_n(t3, t2, 20);
+	fe_mul(t2, t3, t2);		/* 2^40 - 1 */
+	fe_sq_n(t2, t2, 10);
+	fe_mul(t1, t2, t1);		/* 2^50 - 1 */
+	fe_sq_n(t2, t1, 50);
+	fe_mul(t2, t2, t1);		/* 2^100 - 1 */
+	fe_sq_n(t3, t2, 100);
+	fe_mul(t2, t3, t2);		/* 2^200 - 1 */
+	fe_sq_n(t2, t2, 50);
+	fe_mul(t1, t2, t1);		/* 2^250 - 1 */
+	fe_sq_n(t1, t1, 5);		/* 2^255 - 2^5 */
+	fe_mul(out, t1, t0);		/* 2^255 - 21 */
+}
+
+
+/* --- Conversion ---------------------------------------------------------- */
+
+
+/* fe_frombytes ignores the most significant bit, as RFC 7748 requires */
+
+static void fe_frombytes(fe h, const uint8_t *s)
+{
+	uint64_t acc = 0;
+	unsigned bits = 0;
+	unsigned i;
+
+	for (i = 0; i != 10; i++) {
+		unsigned n = limb_bits(i);
+
+		while (bits < n) {
+			acc |= (uint64_t) *s++ << bits;
+			bits += 8;
+		}
+		h[i] = acc & (((uint64_t) 1 << n) - 1);
+		acc >>= n;
+		bits -= n;
+	}
+}
+
+
+/*
+ * fe_tobytes stores "h" modulo p = 2^255 - 19. We first determine q such that
+ * h - q * p is in [0, p), i.e., whether the carried h is at least p. We then
+ * add 19 * q, carry, and drop the bit at 2^255.
+ */
+
+static void fe_tobytes(uint8_t *s, const fe h)
+{
+	int32_t t[10];
+	int32_t q;
+	uint64_t acc = 0;
+	unsigned bits = 0;
+	unsigned i;
+
+	q = (19 * h[9] + ((int32_t) 1 << 24)) >> 25;
+	for (i = 0; i != 10; i++)
+		q = (h[i] + q) >> limb_bits(i);
+
+	memcpy(t, h, sizeof(t));
+	t[0] += 19 * q;
+	for (i = 0; i != 10; i++) {
+		int32_t c = t[i] >> limb_bits(i);
+
+		if (i != 9)
+			t[i + 1] += c;
+		t[i] -= c * ((int32_t) 1 << limb_bits(i));
+	}
+
+	for (i = 0; i != 10; i++) {
+		acc |= (uint64_t) t[i] << bits;
+		bits += limb_bits(i);
+		while (bits >= 8) {
+			*s++ = acc;
+			acc >>= 8;
+			bits -= 8;
+		}
+	}
+	*s = acc;
+}
+
+
+/* --- Montgomery ladder --------------------------------------------------- */
+
+
+int crypto_scalarmult(uint8_t *q, const uint8_t *n, const uint8_t *p)
+{
+	uint8_t e[32];
+	fe x1, x2, z2, x3, z3, t0, t1;
+	uint32_t swap = 0;
+	int pos;
+
+	memcpy(e, n, 32);
+	e[0] &= 248;
+	e[31] &= 127;
+	e[31] |= 64;
+
+	fe_frombytes(x1, p);
+	fe_1(x2);
+	fe_0(z2);
+	fe_copy(x3, x1);
+	fe_1(z3);
+
+	for (pos = 254; pos >= 0; pos--) {
+		uint32_t b = (e[pos / 8] >> (pos & 7)) & 1;
+
+		swap ^= b;
+		fe_cswap(x2, x3, swap);
+		fe_cswap(z2, z3, swap);
+		swap = b;
+
+		fe_sub(t0, x3, z3);	/* D = x3 - z3 */
+		fe_sub(t1, x2, z2);	/* B = x2 - z2 */
+		fe_add(x2, x2, z2);	/* A = x2 + z2 */
+		fe_add(z2, x3, z3);	/* C = x3 + z3 */
+		fe_mul(z3, t0, x2);	/* DA */
+		fe_mul(z2, z2, t1);	/* CB */
+		fe_sq(t0, t1);		/* BB */
+		fe_sq(t1, x2);		/* AA */
+		fe_add(x3, z3, z2);	/* DA + CB */
+		fe_sub(z2, z3, z2);	/* DA - CB */
+		fe_mul(x2, t1, t0);	/* x2 = AA * BB */
+		fe_sub(t1, t1, t0);	/* E = AA - BB */
+		fe_sq(z2, z2);
+		fe_mul121666(z3, t1);
+		fe_sq(x3, x3);		/* x3 = (DA + CB)^2 */
+		fe_add(t0, t0, z3);	/* BB + 121666 * E */
+		fe_mul(z3, x1, z2);	/* z3 = x1 * (DA - CB)^2 */
+		fe_mul(z2, t1, t0);	/* z2 = E * (BB + 121666 * E) */
+	}
+	fe_cswap(x2, x3, swap);
+	fe_cswap(z2, z3, swap);
+
+	fe_invert(z2, z2);
+	fe_mul(x2, x2, z2);
+	fe_tobytes(q, x2);
+
+	memset(e, 0, sizeof(e));
+	return 0;
+}
+
+
+/* --- Fixed-base scalar multiplication ------------------------------------ */
+
+
+/*
+ * Curve25519 is birationally equivalent to the twisted Edwards curve
+ * -x^2 + y^2 = 1 + d x^2 y^2 of Ed25519, with u = (1 + y) / (1 - y), and the
+ * base point B of Ed25519 maps to u = 9. On the Edwards curve, points can be
+ * added without knowing their difference, so we can use precomputed multiples
+ * of B, as in ref10's ge_scalarmult_base:
+ *
+ * We write the scalar as 64 signed digits of four bits, e[0] + 16 e[1] + ...
+ * + 16^63 e[63], with -8 <= e[i] <= 8. The table "base" (made by mkbasetab.pl,
+ * in read-only memory) has the multiples 1 to 8 of 256^i * B, for i = 0 to 31.
+ * We first add e[2 * i + 1] * 256^i * B for all i, multiply the sum by 16, and
+ * then add e[2 * i] * 256^i * B. This takes 64 point additions and four
+ * doublings, instead of the 255 steps of the ladder.
+ *
+ * The table is 30 kB. Looking up an entry reads all eight multiples of its row,
+ * so the memory accesses do not depend on the scalar.
+ */
+
+/*
+ * A point in extended coordinates (P3) has x = X / Z, y = Y / Z, x y = T / Z.
+ * A point in projective coordinates (P2) has only X, Y, and Z. A "completed"
+ * point (P1P1) has x = X / Z, y = Y / T.
+ */
+
+struct ge {
+	fe X, Y, Z, T;
+};
+
+struct ge_precomp {
+	fe yplusx, yminusx, xy2d;
+};
+
+
+static const struct ge_precomp base[32][8] = {
+#include "curve25519-base.inc"
+};
+
+
+static void ge_p3_0(struct ge *h)
+{
+	fe_0(h->X);
+	fe_1(h->Y);
+	fe_1(h->Z);
+	fe_0(h->T);
+}
+
+
+static void ge_p1p1_to_p2(struct ge *r, const struct ge *p)
+{
+	fe_mul(r->X, p->X, p->T);
+	fe_mul(r->Y, p->Y, p->Z);
+	fe_mul(r->Z, p->Z, p->T);
+}
+
+
+static void ge_p1p1_to_p3(struct ge *r, const struct ge *p)
+{
+	fe_mul(r->X, p->X, p->T);
+	fe_mul(r->Y, p->Y, p->Z);
+	fe_mul(r->Z, p->Z, p->T);
+	fe_mul(r->T, p->X, p->Y);
+}
+
+
+/* ge_p2_dbl doubles a P2 point, yielding a P1P1 point */
+
+static void ge_p2_dbl(struct ge *r, const struct ge *p)
+{
+	fe t0;
+
+	fe_sq(r->X, p->X);
+	fe_sq(r->Z, p->Y);
+	fe_sq2(r->T, p->Z);
+	fe_add(r->Y, p->X, p->Y);
+	fe_sq(t0, r->Y);
+	fe_add(r->Y, r->Z, r->X);
+	fe_sub(r->Z, r->Z, r->X);
+	fe_sub(r->X, t0, r->Y);
+	fe_sub(r->T, r->T, r->Z);
+}
+
+
+/* ge_madd adds a P3 point and a precomputed point, yielding a P1P1 point */
+
+static void ge_madd(struct ge *r, const struct ge *p,
+    const struct ge_precomp *q)
+{
+	fe t0;
+
+	fe_add(r->X, p->Y, p->X);
+	fe_sub(r->Y, p->Y, p->X);
+	fe_mul(r->Z, r->X, q->yplusx);
+	fe_mul(r->Y, r->Y, q->yminusx);
+	fe_mul(r->T, q->xy2d, p->T);
+	fe_add(t0, p->Z, p->Z);
+	fe_sub(r->X, r->Z, r->Y);
+	fe_add(r->Y, r->Z, r->Y);
+	fe_add(r->Z, t0, r->T);
+	fe_sub(r->T, t0, r->T);
+}
+
+
+/*
+ * lookup sets "t" to b * 256^pos * B. Negating a point negates x, which swaps
+ * y + x and y - x, and negates 2 d x y.
+ */
+
+static void lookup(struct ge_precomp *t, unsigned pos, int8_t b)
+{
+	uint32_t neg = (uint32_t) (int32_t) b >> 31;
+	uint32_t babs = b - ((-neg & b) << 1);
+	struct ge_precomp minus;
+	unsigned i;
+
+	fe_1(t->yplusx);
+	fe_1(t->yminusx);
+	fe_0(t->xy2d);
+	for (i = 0; i != 8; i++) {
+		uint32_t eq = ((babs ^ (i + 1)) - 1) >> 31;
+
+		fe_cmov(t->yplusx, base[pos][i].yplusx, eq);
+		fe_cmov(t->yminusx, base[pos][i].yminusx, eq);
+		fe_cmov(t->xy2d, base[pos][i].xy2d, eq);
+	}
+	fe_copy(minus.yplusx, t->yminusx);
+	fe_copy(minus.yminusx, t->yplusx);
+	fe_0(minus.xy2d);
+	fe_sub(minus.xy2d, minus.xy2d, t->xy2d);
+	fe_cmov(t->yplusx, minus.yplusx, neg);
+	fe_cmov(t->yminusx, minus.yminusx, neg);
+	fe_cmov(t->xy2d, minus.xy2d, neg);
+}
+
+
+int crypto_scalarmult_base(uint8_t *q, const uint8_t *n)
+{
+	int8_t e[64];
+	int8_t c = 0;
+	struct ge h, r;
+	struct ge_precomp t;
+	fe u, z;
+	unsigned i;
+
+	for (i = 0; i != 32; i++) {
+		uint8_t b = n[i];
+
+		if (i == 0)
+			b &= 248;
+		if (i == 31)
+			b = (b & 127) | 64;
+		e[2 * i] = b & 15;
+		e[2 * i + 1] = b >> 4;
+	}
+	for (i = 0; i != 63; i++) {
+		e[i] += c;
+		c = (e[i] + 8) >> 4;
+		e[i] -= c * 16;
+	}
+	e[63] += c;
+
+	ge_p3_0(&h);
+	for (i = 1; i < 64; i += 2) {
+		lookup(&t, i / 2, e[i]);
+		ge_madd(&r, &h, &t);
+		ge_p1p1_to_p3(&h, &r);
+	}
+	for (i = 0; i != 4; i++) {
+		ge_p2_dbl(&r, &h);
+		if (i == 3)
+			ge_p1p1_to_p3(&h, &r);
+		else
+			ge_p1p1_to_p2(&h, &r);
+	}
+	for (i = 0; i < 64; i += 2) {
+		lookup(&t, i / 2, e[i]);
+		ge_madd(&r, &h, &t);
+		ge_p1p1_to_p3(&h, &r);
+	}
+
+	/* u = (1 + y) / (1 - y) = (Z + Y) / (Z - Y) */
+	fe_add(u, h.Z, h.Y);
+	fe_sub(z, h.Z, h.Y);
+	fe_invert(z, z);
+	fe_mul(u, u, z);
+	fe_tobytes(q, u);
+
+	memset(e, 0, sizeof(e));
+	memset(&t, 0, sizeof(t));
+	return 0;
+}
+
+#endif /* CURVE25519_REF10 */
@@ -21,20 +21,25 @@
 #include "hmac.h"
 
 
-void hmac_sha1(uint8_t res[HMAC_SHA1_BYTES], const void *k, size_t k_size,
-    const void *c, size_t c_size)
+/*
+ * The key blocks K XOR ipad and K XOR opad each fill a block of SHA1, so we
+ * hash them once, and start the inner and outer hash of each message from the
+ * resulting contexts.
+ */
+
+void hmac_sha1_key(struct hmac_sha1_key *hk, const void *k, size_t k_size)
 {
+	struct sha1_ctx ctx;
 	uint8_t key[SHA1_BLOCK_BYTES];
 	uint8_t key_xor[SHA1_BLOCK_BYTES];
-	uint8_t h_text[SHA1_HASH_BYTES];
 	unsigned i;
 
 	// generate key from K
 
 	if (k_size > SHA1_BLOCK_BYTES) {
-		sha1_begin();
-		sha1_hash(k, k_size);
-		sha1_end(key);
+		sha1_init(&ctx);
+		sha1_update(&ctx, k, k_size);
+		sha1_final(&ctx, key);
 		k_size = SHA1_HASH_BYTES;
 	} else {
 		memcpy(key, k, k_size);
@@ -42,27 +47,62 @@ void hmac_sha1(uint8_t res[HMAC_SHA1_BYTES], const void *k, size_t k_size,
 	if (k_size < SHA1_BLOCK_BYTES)
 		memset(key+ k_size, 0, SHA1_BLOCK_BYTES - k_size);
 
-	// h_text = H(K XOR ipad, text)
+	// H(K XOR ipad, ...)
 
 	for (i = 0; i != SHA1_BLOCK_BYTES; i++)
 		key_xor[i] = key[i] ^ 0x36;	// ipad
 
-	sha1_begin();
-	sha1_hash(key_xor, SHA1_BLOCK_BYTES);
-	sha1_hash(c, c_size);
-	sha1_end(h_text);
+	sha1_init(&hk->inner);
+	sha1_update(&hk->inner, key_xor, SHA1_BLOCK_BYTES);
 
-	// H(K XOR opad, h_text)
+	// H(K XOR opad, ...)
 
 	for (i = 0; i != SHA1_BLOCK_BYTES; i++)
-		key_xor[i] = key[i] ^ 0x5c;	// ppad
+		key_xor[i] = key[i] ^ 0x5c;	// opad
 
-	sha1_begin();
-	sha1_hash(key_xor, SHA1_BLOCK_BYTES);
-	sha1_hash(h_text, SHA1_HASH_BYTES);
-	sha1_end(res);
+	sha1_init(&hk->outer);
+	sha1_update(&hk->outer, key_xor, SHA1_BLOCK_BYTES);
 
 	memset(key, 0, sizeof(key));
 	memset(key_xor, 0, sizeof(key_xor));
+}
+
+
+void hmac_sha1_batch(uint8_t (*res)[HMAC_SHA1_BYTES],
+    const struct hmac_sha1_key *hk, const void *const *c, size_t c_size,
+    unsigned n)
+{
+	uint8_t h_text[HMAC_BATCH][SHA1_HASH_BYTES];
+	const void *p[HMAC_BATCH];
+	unsigned i, m;
+
+	while (n) {
+		m = n < HMAC_BATCH ? n : HMAC_BATCH;
+
+		// h_text = H(K XOR ipad, text)
+
+		sha1_batch(h_text, &hk->inner, c, c_size, m);
+
+		// H(K XOR opad, h_text)
+
+		for (i = 0; i != m; i++)
+			p[i] = h_text[i];
+		sha1_batch(res, &hk->outer, p, SHA1_HASH_BYTES, m);
+
+		res += m;
+		c += m;
+		n -= m;
+	}
 	memset(h_text, 0, sizeof(h_text));
 }
+
+
+void hmac_sha1(uint8_t res[HMAC_SHA1_BYTES], const void *k, size_t k_size,
+    const void *c, size_t c_size)
+{
+	struct hmac_sha1_key hk;
+
+	hmac_sha1_key(&hk, k, k_size);
+	hmac_sha1_batch((uint8_t (*)[HMAC_SHA1_BYTES]) res, &hk, &c, c_size, 1);
+	memset(&hk, 0, sizeof(hk));
+}
@@ -16,8 +16,27 @@
 
 #define	HMAC_SHA1_BYTES	SHA1_HASH_BYTES
 
+#define	HMAC_BATCH	8	/* messages hmac_sha1_batch hashes at once */
+
+
+/*
+ * hmac_sha1_key prepares the key "k" for hmac_sha1_batch, which calculates the
+ * HMAC of "n" messages of "c_size" bytes each, c[0] to c[n - 1], under the same
+ * key.
+ */
+
+struct hmac_sha1_key {
+	struct sha1_ctx inner;	/* after hashing K XOR ipad */
+	struct sha1_ctx outer;	/* after hashing K XOR opad */
+};
+
 
 void hmac_sha1(uint8_t res[HMAC_SHA1_BYTES], const void *k, size_t k_size,
     const void *c, size_t c_size);
 
+void hmac_sha1_key(struct hmac_sha1_key *hk, const void *k, size_t k_size);
+void hmac_sha1_batch(uint8_t (*res)[HMAC_SHA1_BYTES],
+    const struct hmac_sha1_key *hk, const void *const *c, size_t c_size,
+    unsigned n);
+
 #endif /* !HMAC_H */
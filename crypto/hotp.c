@@ -25,13 +25,27 @@
 #endif
 
 
+/*
+ * dyn_trunc is the dynamic truncation of RFC 4226, section 5.3: it extracts 31
+ * bits from the HMAC, at the offset its last byte specifies.
+ */
+
+static uint32_t dyn_trunc(const uint8_t hash[HMAC_SHA1_BYTES])
+{
+	unsigned i = hash[HMAC_SHA1_BYTES - 1] & 15;
+
+	return (hash[i] & 0x7f) << 24 | hash[i + 1] << 16 | hash[i + 2] << 8 |
+	    hash[i + 3];
+}
+
+
 uint32_t hotp(const void *k, size_t k_size, const void *c, size_t c_size)
 {
 	uint8_t hash[HMAC_SHA1_BYTES];
-	unsigned i;
 	uint32_t res;
-
 #ifdef DEBUG
+	unsigned i;
+
 	debug("K");
 	for (i = 0; i != k_size; i++)
 		debug(" %02x", ((const uint8_t *) k)[i]);
@@ -48,22 +62,27 @@ uint32_t hotp(const void *k, size_t k_size, const void *c, size_t c_size)
 		debug(" %02x", hash[i]);
 	debug("\n");
 #endif
-	i = hash[HMAC_SHA1_BYTES - 1] & 15;
-	res = (hash[i] & 0x7f) << 24 | hash[i + 1] << 16 | hash[i + 2] << 8 |
-	    hash[i + 3];
+	res = dyn_trunc(hash);
 	memset(hash, 0, sizeof(hash));
 	return res;
 }
 
 
-static uint32_t hotp_n(const void *k, size_t k_size, uint64_t count,
-    unsigned bytes)
+static void counter_bytes(uint8_t *c_bytes, uint64_t count, unsigned bytes)
 {
-	uint8_t c_bytes[8];
 	unsigned i;
 
 	for (i = 0; i != bytes; i++)
 		c_bytes[i] = count >> 8 * (bytes - i - 1);
+}
+
+
+static uint32_t hotp_n(const void *k, size_t k_size, uint64_t count,
+    unsigned bytes)
+{
+	uint8_t c_bytes[8];
+
+	counter_bytes(c_bytes, count, bytes);
 	return hotp(k, k_size, c_bytes, bytes);
 }
 
@@ -72,3 +91,36 @@ uint32_t hotp64(const void *k, size_t k_size, uint64_t count)
 {
 	return hotp_n(k, k_size, count, 8);
 }
+
+
+/*
+ * hotp64_batch calculates the codes for "n" consecutive counter values, e.g.,
+ * to look ahead when resynchronizing, hashing HMAC_BATCH counters at a time.
+ */
+
+void hotp64_batch(uint32_t *res, const void *k, size_t k_size, uint64_t count,
+    unsigned n)
+{
+	struct hmac_sha1_key hk;
+	uint8_t c_bytes[HMAC_BATCH][8];
+	uint8_t hash[HMAC_BATCH][HMAC_SHA1_BYTES];
+	const void *c[HMAC_BATCH];
+	unsigned i, m;
+
+	hmac_sha1_key(&hk, k, k_size);
+	while (n) {
+		m = n < HMAC_BATCH ? n : HMAC_BATCH;
+		for (i = 0; i != m; i++) {
+			counter_bytes(c_bytes[i], count + i, 8);
+			c[i] = c_bytes[i];
+		}
+		hmac_sha1_batch(hash, &hk, c, 8, m);
+		for (i = 0; i != m; i++)
+			res[i] = dyn_trunc(hash[i]);
+		res += m;
+		count += m;
+		n -= m;
+	}
+	memset(&hk, 0, sizeof(hk));
+	memset(hash, 0, sizeof(hash));
+}
@@ -14,5 +14,7 @@
 
 uint32_t hotp(const void *k, size_t k_size, const void *c, size_t c_size);
 uint32_t hotp64(const void *k, size_t k_size, uint64_t c);
+void hotp64_batch(uint32_t *res, const void *k, size_t k_size, uint64_t c,
+    unsigned n);
 
 #endif	/* !HOTP_H */
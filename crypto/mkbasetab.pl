@@ -0,0 +1,83 @@
+#!/usr/bin/perl
+#
+# mkbasetab.pl - Make the table of multiples of the Curve25519 base point
+#
+# This work is licensed under the terms of the MIT License.
+# A copy of the license can be found in the file LICENSE.MIT
+#
+
+#
+# Entry [i][j] is (j + 1) * 256^i * B, where B is the base point of the twisted
+# Edwards curve -x^2 + y^2 = 1 + d x^2 y^2 (Ed25519), which corresponds to the
+# base point u = 9 of Curve25519. Points are in affine coordinates, stored as
+# (y + x, y - x, 2 d x y). Field elements are ten limbs of alternately 26 and 25
+# bits, as in curve25519.c.
+#
+
+use Math::BigInt;
+
+
+sub md
+{
+	return $_[0]->copy->bmod($p);
+}
+
+
+sub inv
+{
+	return md($_[0])->bmodinv($p);
+}
+
+
+sub add
+{
+	my ($x1, $y1, $x2, $y2) = @_;
+	my $t = md($d * $x1 * $x2 * $y1 * $y2);
+
+	return (md(($x1 * $y2 + $y1 * $x2) * inv(1 + $t)),
+	    md(($y1 * $y2 + $x1 * $x2) * inv(1 - $t)));
+}
+
+
+sub fe
+{
+	my $v = md($_[0]);
+	my @l = ();
+
+	for (my $i = 0; $i != 10; $i++) {
+		my $bits = $i & 1 ? 25 : 26;
+		push(@l, $v->copy->band((1 << $bits) - 1));
+		$v->brsft($bits);
+	}
+	return "{ ".join(", ", @l)." }";
+}
+
+
+$p = Math::BigInt->new(2)->bpow(255) - 19;
+$d = md(-121665 * inv(Math::BigInt->new(121666)));
+
+# y = 4 / 5, and x is the even square root of (y^2 - 1) / (d y^2 + 1)
+
+$by = md(4 * inv(Math::BigInt->new(5)));
+$xx = md(($by * $by - 1) * inv($d * $by * $by + 1));
+$bx = $xx->copy->bmodpow(($p + 3) / 8, $p);
+$bx = md($bx * Math::BigInt->new(2)->bmodpow(($p - 1) / 4, $p))
+    unless md($bx * $bx - $xx)->is_zero;
+$bx = $p - $bx if $bx->is_odd;
+
+for ($i = 0; $i != 32; $i++) {
+	print "\t{\t/* 256^$i * B */\n";
+	($x, $y) = ($bx, $by);
+	for ($j = 0; $j != 8; $j++) {
+		print "\t\t{\n";
+		print "\t\t\t", &fe($y + $x), ",\n";
+		print "\t\t\t", &fe($y - $x), ",\n";
+		print "\t\t\t", &fe(2 * $d * $x * $y), "\n";
+		print "\t\t},\n";
+		($x, $y) = &add($x, $y, $bx, $by);
+	}
+	print "\t},\n";
+	for ($j = 0; $j != 8; $j++) {
+		($bx, $by) = &add($bx, $by, $bx, $by);
+	}
+}
@@ -0,0 +1,198 @@
+/*
+ * poly1305.c - Poly1305 with five 26-bit limbs
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * This replaces crypto_onetimeauth of TweetNaCl, which uses 17 limbs of 8 bits,
+ * and therefore needs 289 multiplications per 16-byte block. Here, the
+ * accumulator and the key have five limbs of 26 bits (radix 2^26), as in
+ * poly1305-donna [1]. The products fit in 64 bits, and a block takes 25 32x32
+ * bit multiplications.
+ *
+ * Make with SECRETBOX=tweetnacl to use TweetNaCl's implementation instead.
+ *
+ * [1] https://github.com/floodyberry/poly1305-donna
+ * [2] https://www.rfc-editor.org/rfc/rfc8439#section-2.5
+ */
+
+#ifdef SECRETBOX_WORDS
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tweetnacl.h"
+
+
+#define	MASK26	0x3ffffff
+
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+
+static inline void store32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
+/* --- Blocks -------------------------------------------------------------- */
+
+
+/*
+ * block adds the 16 bytes at "m", plus "hibit" at 2^128, to "h", and multiplies
+ * the sum by "r", modulo p = 2^130 - 5. Limb products that go beyond 2^130 wrap
+ * around, times 5, which "s" (= 5 * r) already includes.
+ */
+
+static void block(uint32_t h[5], const uint32_t r[5], const uint32_t s[5],
+    const uint8_t *m, uint32_t hibit)
+{
+	uint64_t d0, d1, d2, d3, d4;
+	uint32_t c;
+
+	h[0] += load32(m) & MASK26;
+	h[1] += (load32(m + 3) >> 2) & MASK26;
+	h[2] += (load32(m + 6) >> 4) & MASK26;
+	h[3] += (load32(m + 9) >> 6) & MASK26;
+	h[4] += (load32(m + 12) >> 8) | hibit;
+
+	d0 = (uint64_t) h[0] * r[0] + (uint64_t) h[1] * s[4] +
+	    (uint64_t) h[2] * s[3] + (uint64_t) h[3] * s[2] +
+	    (uint64_t) h[4] * s[1];
+	d1 = (uint64_t) h[0] * r[1] + (uint64_t) h[1] * r[0] +
+	    (uint64_t) h[2] * s[4] + (uint64_t) h[3] * s[3] +
+	    (uint64_t) h[4] * s[2];
+	d2 = (uint64_t) h[0] * r[2] + (uint64_t) h[1] * r[1] +
+	    (uint64_t) h[2] * r[0] + (uint64_t) h[3] * s[4] +
+	    (uint64_t) h[4] * s[3];
+	d3 = (uint64_t) h[0] * r[3] + (uint64_t) h[1] * r[2] +
+	    (uint64_t) h[2] * r[1] + (uint64_t) h[3] * r[0] +
+	    (uint64_t) h[4] * s[4];
+	d4 = (uint64_t) h[0] * r[4] + (uint64_t) h[1] * r[3] +
+	    (uint64_t) h[2] * r[2] + (uint64_t) h[3] * r[1] +
+	    (uint64_t) h[4] * r[0];
+
+	c = d0 >> 26;
+	h[0] = d0 & MASK26;
+	d1 += c;
+	c = d1 >> 26;
+	h[1] = d1 & MASK26;
+	d2 += c;
+	c = d2 >> 26;
+	h[2] = d2 & MASK26;
+	d3 += c;
+	c = d3 >> 26;
+	h[3] = d3 & MASK26;
+	d4 += c;
+	c = d4 >> 26;
+	h[4] = d4 & MASK26;
+	h[0] += c * 5;
+	c = h[0] >> 26;
+	h[0] &= MASK26;
+	h[1] += c;
+}
+
+
+/* --- Final reduction ----------------------------------------------------- */
+
+
+/*
+ * finish carries "h" completely, reduces it modulo p, and adds the second half
+ * of the key, modulo 2^128. Whether h is at least p is decided without a
+ * branch: we compute g = h + 5 - 2^130, and select g if it is not negative.
+ */
+
+static void finish(uint8_t *out, uint32_t h[5], const uint8_t *k)
+{
+	uint32_t g[5];
+	uint32_t c, mask;
+	uint64_t f;
+	unsigned i;
+
+	for (i = 1; i != 5; i++) {
+		c = h[i] >> 26;
+		h[i] &= MASK26;
+		if (i == 4)
+			h[0] += c * 5;
+		else
+			h[i + 1] += c;
+	}
+	c = h[0] >> 26;
+	h[0] &= MASK26;
+	h[1] += c;
+
+	c = 5;
+	for (i = 0; i != 4; i++) {
+		g[i] = h[i] + c;
+		c = g[i] >> 26;
+		g[i] &= MASK26;
+	}
+	g[4] = h[4] + c - (1 << 26);
+
+	mask = (g[4] >> 31) - 1;
+	for (i = 0; i != 5; i++)
+		h[i] = (h[i] & ~mask) | (g[i] & mask);
+
+	h[0] = h[0] | h[1] << 26;
+	h[1] = h[1] >> 6 | h[2] << 20;
+	h[2] = h[2] >> 12 | h[3] << 14;
+	h[3] = h[3] >> 18 | h[4] << 8;
+
+	f = 0;
+	for (i = 0; i != 4; i++) {
+		f += (uint64_t) h[i] + load32(k + 16 + 4 * i);
+		store32(out + 4 * i, f);
+		f >>= 32;
+	}
+}
+
+
+/* --- API ----------------------------------------------------------------- */
+
+
+int crypto_onetimeauth(uint8_t *out, const uint8_t *m, unsigned long long n,
+    const uint8_t *k)
+{
+	uint32_t r[5], s[5], h[5] = { 0, };
+	unsigned i;
+
+	/* clamp r, as RFC 8439 [2] describes */
+	r[0] = load32(k) & 0x3ffffff;
+	r[1] = (load32(k + 3) >> 2) & 0x3ffff03;
+	r[2] = (load32(k + 6) >> 4) & 0x3ffc0ff;
+	r[3] = (load32(k + 9) >> 6) & 0x3f03fff;
+	r[4] = (load32(k + 12) >> 8) & 0x00fffff;
+	for (i = 0; i != 5; i++)
+		s[i] = r[i] * 5;
+
+	while (n >= 16) {
+		block(h, r, s, m, 1 << 24);
+		m += 16;
+		n -= 16;
+	}
+	if (n) {
+		uint8_t buf[16] = { 0, };
+
+		memcpy(buf, m, n);
+		buf[n] = 1;
+		block(h, r, s, buf, 0);
+		memset(buf, 0, sizeof(buf));
+	}
+	finish(out, h, k);
+
+	memset(r, 0, sizeof(r));
+	memset(s, 0, sizeof(s));
+	memset(h, 0, sizeof(h));
+	return 0;
+}
+
+#endif /* SECRETBOX_WORDS */
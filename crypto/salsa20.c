@@ -0,0 +1,272 @@
+/*
+ * salsa20.c - Salsa20, HSalsa20, and XSalsa20 on 32-bit words
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * This replaces the Salsa20 [1] core and stream of TweetNaCl, which shuffle
+ * each quarter-round through a temporary array, and increment the block counter
+ * one byte at a time. Here, the state stays in sixteen 32-bit words, a double
+ * round is written out, and the counter is a 64-bit number.
+ *
+ * On hosts with SSE2 (or AVX2), crypto_stream_salsa20_xor computes several
+ * consecutive blocks at once, with one block per vector lane. The vector code
+ * uses GCC's vector extensions, and shares the rounds with the scalar code.
+ *
+ * Make with SECRETBOX=tweetnacl to use TweetNaCl's implementation instead.
+ *
+ * [1] https://cr.yp.to/snuffle/spec.pdf
+ * [2] https://cr.yp.to/snuffle/xsalsa-20110204.pdf
+ */
+
+#ifdef SECRETBOX_WORDS
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tweetnacl.h"
+
+
+#if defined(__AVX2__)
+#define	LANES	8
+#elif defined(__SSE2__)
+#define	LANES	4
+#endif
+
+#ifdef LANES
+typedef uint32_t vec __attribute__((vector_size(4 * LANES)));
+#endif
+
+
+static const uint8_t sigma[16] = "expand 32-byte k";
+
+
+/* --- Words --------------------------------------------------------------- */
+
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+
+static inline void store32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
+/* --- Rounds -------------------------------------------------------------- */
+
+
+/*
+ * The macros work on words as well as on vectors of words, since GCC applies
+ * the operators lane by lane.
+ */
+
+#define	ROTL(v, n)	((v) << (n) | (v) >> (32 - (n)))
+
+#define	QUARTER(x, a, b, c, d) do {			\
+		x[b] ^= ROTL(x[a] + x[d], 7);		\
+		x[c] ^= ROTL(x[b] + x[a], 9);		\
+		x[d] ^= ROTL(x[c] + x[b], 13);		\
+		x[a] ^= ROTL(x[d] + x[c], 18);		\
+	} while (0)
+
+#define	DOUBLE_ROUND(x) do {				\
+		QUARTER(x, 0, 4, 8, 12);		\
+		QUARTER(x, 5, 9, 13, 1);		\
+		QUARTER(x, 10, 14, 2, 6);		\
+		QUARTER(x, 15, 3, 7, 11);		\
+		QUARTER(x, 0, 1, 2, 3);			\
+		QUARTER(x, 5, 6, 7, 4);			\
+		QUARTER(x, 10, 11, 8, 9);		\
+		QUARTER(x, 15, 12, 13, 14);		\
+	} while (0)
+
+
+static void rounds(uint32_t x[16])
+{
+	unsigned i;
+
+	for (i = 0; i != 10; i++)
+		DOUBLE_ROUND(x);
+}
+
+
+/*
+ * The input block consists of the constant "c" on the diagonal, the key in the
+ * rest of rows 0 and 3 (words 1-4 and 11-14), and "in" (nonce and counter) in
+ * words 6-9.
+ */
+
+static void setup(uint32_t s[16], const uint8_t *in, const uint8_t *k,
+    const uint8_t *c)
+{
+	unsigned i;
+
+	for (i = 0; i != 4; i++) {
+		s[5 * i] = load32(c + 4 * i);
+		s[1 + i] = load32(k + 4 * i);
+		s[6 + i] = load32(in + 4 * i);
+		s[11 + i] = load32(k + 16 + 4 * i);
+	}
+}
+
+
+/* --- Cores --------------------------------------------------------------- */
+
+
+int crypto_core_salsa20(uint8_t *out, const uint8_t *in, const uint8_t *k,
+    const uint8_t *c)
+{
+	uint32_t s[16], x[16];
+	unsigned i;
+
+	setup(s, in, k, c);
+	memcpy(x, s, sizeof(x));
+	rounds(x);
+	for (i = 0; i != 16; i++)
+		store32(out + 4 * i, x[i] + s[i]);
+	return 0;
+}
+
+
+/*
+ * HSalsa20 [2] skips the final addition, and outputs the words in the positions
+ * of the constant and of "in".
+ */
+
+int crypto_core_hsalsa20(uint8_t *out, const uint8_t *in, const uint8_t *k,
+    const uint8_t *c)
+{
+	uint32_t x[16];
+	unsigned i;
+
+	setup(x, in, k, c);
+	rounds(x);
+	for (i = 0; i != 4; i++) {
+		store32(out + 4 * i, x[5 * i]);
+		store32(out + 16 + 4 * i, x[6 + i]);
+	}
+	return 0;
+}
+
+
+/* --- Stream -------------------------------------------------------------- */
+
+
+/* xor_block xors "m" (or zeroes, if "m" is NULL) with the key stream "ks" */
+
+static void xor_block(uint8_t *c, const uint8_t *m, const uint32_t *ks,
+    unsigned bytes)
+{
+	uint8_t buf[64];
+	unsigned i;
+
+	for (i = 0; i != 16; i++)
+		store32(buf + 4 * i, ks[i]);
+	if (m)
+		for (i = 0; i != bytes; i++)
+			c[i] = m[i] ^ buf[i];
+	else
+		memcpy(c, buf, bytes);
+	memset(buf, 0, sizeof(buf));
+}
+
+
+#ifdef LANES
+
+/*
+ * stream_lanes computes the blocks with counters "ctr" to ctr + LANES - 1, and
+ * xors LANES * 64 bytes of "m" with them.
+ */
+
+static void stream_lanes(uint8_t *c, const uint8_t *m, const uint32_t s[16],
+    uint64_t ctr)
+{
+	vec x[16], y[16];
+	uint32_t ks[16];
+	unsigned i, j;
+
+	for (i = 0; i != 16; i++)
+		for (j = 0; j != LANES; j++)
+			y[i][j] = s[i];
+	for (j = 0; j != LANES; j++) {
+		y[8][j] = ctr + j;
+		y[9][j] = (ctr + j) >> 32;
+	}
+	memcpy(x, y, sizeof(x));
+	for (i = 0; i != 10; i++)
+		DOUBLE_ROUND(x);
+	for (i = 0; i != 16; i++)
+		x[i] += y[i];
+	for (j = 0; j != LANES; j++) {
+		for (i = 0; i != 16; i++)
+			ks[i] = x[i][j];
+		xor_block(c + 64 * j, m ? m + 64 * j : NULL, ks, 64);
+	}
+	memset(x, 0, sizeof(x));
+	memset(ks, 0, sizeof(ks));
+}
+
+#endif /* LANES */
+
+
+/* crypto_stream_salsa20_xor_ic starts with block number "ic" of the stream */
+
+int crypto_stream_salsa20_xor_ic(uint8_t *c, const uint8_t *m,
+    unsigned long long b, const uint8_t *n, unsigned long long ic,
+    const uint8_t *k)
+{
+	uint8_t in[16] = { 0, };
+	uint32_t s[16], x[16];
+	uint64_t ctr = ic;
+	unsigned i;
+
+	memcpy(in, n, 8);
+	setup(s, in, k, sigma);
+#ifdef LANES
+	while (b >= 64 * LANES) {
+		stream_lanes(c, m, s, ctr);
+		ctr += LANES;
+		b -= 64 * LANES;
+		c += 64 * LANES;
+		if (m)
+			m += 64 * LANES;
+	}
+#endif
+	while (b) {
+		unsigned bytes = b < 64 ? b : 64;
+
+		s[8] = ctr;
+		s[9] = ctr >> 32;
+		memcpy(x, s, sizeof(x));
+		rounds(x);
+		for (i = 0; i != 16; i++)
+			x[i] += s[i];
+		xor_block(c, m, x, bytes);
+		ctr++;
+		b -= bytes;
+		c += bytes;
+		if (m)
+			m += bytes;
+	}
+	memset(s, 0, sizeof(s));
+	memset(x, 0, sizeof(x));
+	return 0;
+}
+
+
+int crypto_stream_salsa20_xor(uint8_t *c, const uint8_t *m,
+    unsigned long long b, const uint8_t *n, const uint8_t *k)
+{
+	return crypto_stream_salsa20_xor_ic(c, m, b, n, 0, k);
+}
+
+#endif /* SECRETBOX_WORDS */
@@ -0,0 +1,82 @@
+/*
+ * secretbox.c - XSalsa20-Poly1305 with a detached authenticator
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * crypto_secretbox wants ZEROBYTES of zeroes in front of the message, and
+ * returns the box after BOXZEROBYTES of zeroes, so the caller has to copy
+ * message and box through padded buffers. Here, the authenticator is passed
+ * separately, and the message is encrypted where it is.
+ *
+ * The first 32 bytes of the XSalsa20 key stream are the Poly1305 key, and the
+ * message is XORed with the key stream from byte 32 on. We compute the first
+ * block of the stream (64 bytes) ourselves, and continue with block 1.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tweetnacl.h"
+#include "secretbox.h"
+
+
+static const uint8_t sigma[16] = "expand 32-byte k";
+
+
+/*
+ * setup derives the Salsa20 key from "key" and the first 16 bytes of the nonce
+ * (HSalsa20), and computes block 0 of the key stream.
+ */
+
+static void setup(uint8_t subkey[32], uint8_t block0[64], const uint8_t *nonce,
+    const uint8_t *key)
+{
+	crypto_core_hsalsa20(subkey, nonce, key, sigma);
+	crypto_stream_salsa20(block0, 64, nonce + 16, subkey);
+}
+
+
+static void xor_stream(uint8_t *out, const uint8_t *in, unsigned len,
+    const uint8_t *nonce, const uint8_t *subkey, const uint8_t *block0)
+{
+	unsigned i;
+
+	for (i = 0; i != len && i != 32; i++)
+		out[i] = in[i] ^ block0[32 + i];
+	if (len > 32)
+		crypto_stream_salsa20_xor_ic(out + 32, in + 32, len - 32,
+		    nonce + 16, 1, subkey);
+}
+
+
+void secretbox_seal(void *c, uint8_t *mac, const void *m, unsigned len,
+    const uint8_t *nonce, const uint8_t *key)
+{
+	uint8_t subkey[32], block0[64];
+
+	setup(subkey, block0, nonce, key);
+	xor_stream(c, m, len, nonce, subkey, block0);
+	crypto_onetimeauth(mac, c, len, block0);
+	memset(subkey, 0, sizeof(subkey));
+	memset(block0, 0, sizeof(block0));
+}
+
+
+bool secretbox_open(void *m, const uint8_t *mac, const void *c, unsigned len,
+    const uint8_t *nonce, const uint8_t *key)
+{
+	uint8_t subkey[32], block0[64];
+	bool ok;
+
+	setup(subkey, block0, nonce, key);
+	ok = !crypto_onetimeauth_verify(mac, c, len, block0);
+	if (ok && m)
+		xor_stream(m, c, len, nonce, subkey, block0);
+	memset(subkey, 0, sizeof(subkey));
+	memset(block0, 0, sizeof(block0));
+	return ok;
+}
@@ -0,0 +1,35 @@
+/*
+ * secretbox.h - XSalsa20-Poly1305 with a detached authenticator
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+#ifndef	SECRETBOX_H
+#define	SECRETBOX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define	SECRETBOX_MACBYTES	16
+
+
+/*
+ * secretbox_seal encrypts "len" bytes from "m" to "c", and stores the
+ * authenticator at "mac". secretbox_open checks the authenticator of "len"
+ * bytes at "c", and, if it is correct and "m" is not NULL, decrypts them to
+ * "m". It returns 1 on success, 0 if the authenticator is wrong, in which case
+ * "m" is left untouched.
+ *
+ * "c" and "m" may be the same buffer. The authenticator followed by the
+ * ciphertext is what crypto_secretbox produces after its BOXZEROBYTES leading
+ * zero bytes.
+ */
+
+void secretbox_seal(void *c, uint8_t *mac, const void *m, unsigned len,
+    const uint8_t *nonce, const uint8_t *key);
+bool secretbox_open(void *m, const uint8_t *mac, const void *c, unsigned len,
+    const uint8_t *nonce, const uint8_t *key);
+
+#endif	/* !SECRETBOX_H */
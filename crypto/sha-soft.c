@@ -0,0 +1,689 @@
+/*
+ * sha-soft.c - SHA1 and SHA256 in software, with contexts
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * This implements SHA1 and SHA256 as specified in FIPS 180-4 [1], without help
+ * from libraries or from the hardware accelerator of the device, and keeps all
+ * the state in a context.
+ *
+ * The compression functions expand the message schedule first, and then run
+ * five (SHA1) or eight (SHA256) rounds per loop iteration. Instead of moving
+ * the working variables after each round, the next round is called with the
+ * variables rotated by name.
+ *
+ * On x86 hosts, we use the SHA instructions [2] if the CPU has them. Since the
+ * simulator is not compiled for a specific CPU, we check this at run time.
+ *
+ * Otherwise, on hosts with SSE2 (or AVX2), sha*_batch puts one message in each
+ * vector lane, and compresses the blocks of several messages at once, with the
+ * same round macros as the scalar code.
+ *
+ * [1] https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.180-4.pdf
+ * [2] https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sha-extensions.html
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "sha.h"
+
+
+#ifndef SDK
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define	SHA_NI
+#endif
+
+#if defined(__AVX2__)
+#define	LANES	8
+#elif defined(__SSE2__)
+#define	LANES	4
+#endif
+
+#endif /* !SDK */
+
+#ifdef LANES
+typedef uint32_t vec __attribute__((vector_size(4 * LANES)));
+#endif
+
+
+typedef void blocks_fn(uint32_t *st, const uint8_t *p, size_t n);
+
+
+static const uint32_t sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+static const uint32_t sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+/* --- Words --------------------------------------------------------------- */
+
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+
+static inline void store_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+
+/* --- Rounds -------------------------------------------------------------- */
+
+
+/*
+ * As in salsa20.c, the macros work on words as well as on vectors of words.
+ */
+
+#define	ROTL(v, n)	((v) << (n) | (v) >> (32 - (n)))
+#define	ROTR(v, n)	((v) >> (n) | (v) << (32 - (n)))
+
+#define	CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	PARITY(x, y, z)	((x) ^ (y) ^ (z))
+#define	MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+
+#define	BSIG0(x)	(ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define	BSIG1(x)	(ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define	SSIG0(x)	(ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define	SSIG1(x)	(ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+#define	SHA1_SCHEDULE(w, t)						\
+	(w[t] = ROTL(w[(t) - 3] ^ w[(t) - 8] ^ w[(t) - 14] ^ w[(t) - 16], 1))
+
+#define	SHA256_SCHEDULE(w, t)						\
+	(w[t] = SSIG1(w[(t) - 2]) + w[(t) - 7] + SSIG0(w[(t) - 15]) +	\
+	    w[(t) - 16])
+
+/*
+ * After a SHA1 round, "e" holds the new "a", and the old "a" to "d" become "b"
+ * to "e".
+ */
+
+#define	SHA1_ROUND(a, b, c, d, e, f, k, w) do {				\
+		e += ROTL(a, 5) + f(b, c, d) + (k) + (w);		\
+		b = ROTL(b, 30);					\
+	} while (0)
+
+#define	SHA1_FIVE(f, k, t) do {						\
+		SHA1_ROUND(a, b, c, d, e, f, k, w[t]);			\
+		SHA1_ROUND(e, a, b, c, d, f, k, w[(t) + 1]);		\
+		SHA1_ROUND(d, e, a, b, c, f, k, w[(t) + 2]);		\
+		SHA1_ROUND(c, d, e, a, b, f, k, w[(t) + 3]);		\
+		SHA1_ROUND(b, c, d, e, a, f, k, w[(t) + 4]);		\
+	} while (0)
+
+/*
+ * After a SHA256 round, "h" holds the new "a", "d" the new "e", and the others
+ * move down by one.
+ */
+
+#define	SHA256_ROUND(a, b, c, d, e, f, g, h, k, w) do {			\
+		h += BSIG1(e) + CH(e, f, g) + (k) + (w);		\
+		d += h;							\
+		h += BSIG0(a) + MAJ(a, b, c);				\
+	} while (0)
+
+#define	SHA256_EIGHT(t) do {						\
+		SHA256_ROUND(a, b, c, d, e, f, g, h, K256[t], w[t]);	\
+		SHA256_ROUND(h, a, b, c, d, e, f, g,			\
+		    K256[(t) + 1], w[(t) + 1]);				\
+		SHA256_ROUND(g, h, a, b, c, d, e, f,			\
+		    K256[(t) + 2], w[(t) + 2]);				\
+		SHA256_ROUND(f, g, h, a, b, c, d, e,			\
+		    K256[(t) + 3], w[(t) + 3]);				\
+		SHA256_ROUND(e, f, g, h, a, b, c, d,			\
+		    K256[(t) + 4], w[(t) + 4]);				\
+		SHA256_ROUND(d, e, f, g, h, a, b, c,			\
+		    K256[(t) + 5], w[(t) + 5]);				\
+		SHA256_ROUND(c, d, e, f, g, h, a, b,			\
+		    K256[(t) + 6], w[(t) + 6]);				\
+		SHA256_ROUND(b, c, d, e, f, g, h, a,			\
+		    K256[(t) + 7], w[(t) + 7]);				\
+	} while (0)
+
+
+/* --- Compression --------------------------------------------------------- */
+
+
+/* The compression functions take the block in w[0] to w[15]. */
+
+static void sha1_compress(uint32_t st[5], uint32_t w[80])
+{
+	uint32_t a = st[0], b = st[1], c = st[2], d = st[3], e = st[4];
+	unsigned t;
+
+	for (t = 16; t != 80; t++)
+		SHA1_SCHEDULE(w, t);
+	for (t = 0; t != 20; t += 5)
+		SHA1_FIVE(CH, 0x5a827999, t);
+	for (; t != 40; t += 5)
+		SHA1_FIVE(PARITY, 0x6ed9eba1, t);
+	for (; t != 60; t += 5)
+		SHA1_FIVE(MAJ, 0x8f1bbcdc, t);
+	for (; t != 80; t += 5)
+		SHA1_FIVE(PARITY, 0xca62c1d6, t);
+	st[0] += a;
+	st[1] += b;
+	st[2] += c;
+	st[3] += d;
+	st[4] += e;
+}
+
+
+static void sha256_compress(uint32_t st[8], uint32_t w[64])
+{
+	uint32_t a = st[0], b = st[1], c = st[2], d = st[3];
+	uint32_t e = st[4], f = st[5], g = st[6], h = st[7];
+	unsigned t;
+
+	for (t = 16; t != 64; t++)
+		SHA256_SCHEDULE(w, t);
+	for (t = 0; t != 64; t += 8)
+		SHA256_EIGHT(t);
+	st[0] += a;
+	st[1] += b;
+	st[2] += c;
+	st[3] += d;
+	st[4] += e;
+	st[5] += f;
+	st[6] += g;
+	st[7] += h;
+}
+
+
+/* --- SHA instructions ---------------------------------------------------- */
+
+
+#ifndef SDK
+int sha_ni = -1;
+#endif
+
+
+#ifdef SHA_NI
+
+/*
+ * The message schedule runs four words at a time. m[j & 3] holds words 4 j to
+ * 4 j + 3. sha*msg1 and sha*msg2 compute the next four words from the previous
+ * sixteen.
+ */
+
+static __attribute__((target("sha,sse4.1"))) void sha1_blocks_ni(
+    uint32_t *st, const uint8_t *p, size_t n)
+{
+	const __m128i mask =
+	    _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, e0, abcd_save, e0_save, prev, e, m[4];
+	unsigned j;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) st), 0x1b);
+	e0 = _mm_set_epi32(st[4], 0, 0, 0);
+	while (n--) {
+		abcd_save = abcd;
+		e0_save = e0;
+		prev = abcd;
+		for (j = 0; j != 20; j++) {
+			if (j < 4)
+				m[j] = _mm_shuffle_epi8(_mm_loadu_si128(
+				    (const __m128i *) (p + 16 * j)), mask);
+			else
+				m[j & 3] = _mm_sha1msg2_epu32(_mm_xor_si128(
+				    _mm_sha1msg1_epu32(m[j & 3],
+				    m[(j + 1) & 3]), m[(j + 2) & 3]),
+				    m[(j + 3) & 3]);
+			if (j)
+				e = _mm_sha1nexte_epu32(prev, m[j & 3]);
+			else
+				e = _mm_add_epi32(e0, m[0]);
+			prev = abcd;
+			switch (j / 5) {
+			case 0:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+				break;
+			case 1:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 1);
+				break;
+			case 2:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 2);
+				break;
+			default:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 3);
+				break;
+			}
+		}
+		e0 = _mm_sha1nexte_epu32(prev, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		p += SHA1_BLOCK_BYTES;
+	}
+	_mm_storeu_si128((__m128i *) st, _mm_shuffle_epi32(abcd, 0x1b));
+	st[4] = _mm_extract_epi32(e0, 3);
+}
+
+
+/*
+ * The SHA256 instructions keep the state as (a, b, e, f) and (c, d, g, h).
+ */
+
+static __attribute__((target("sha,sse4.1"))) void sha256_blocks_ni(
+    uint32_t *st, const uint8_t *p, size_t n)
+{
+	const __m128i mask =
+	    _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i abef, cdgh, abef_save, cdgh_save, tmp, w, m[4];
+	unsigned j;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) st), 0xb1);
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (st + 4)),
+	    0x1b);
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+	while (n--) {
+		abef_save = abef;
+		cdgh_save = cdgh;
+		for (j = 0; j != 16; j++) {
+			if (j < 4)
+				m[j] = _mm_shuffle_epi8(_mm_loadu_si128(
+				    (const __m128i *) (p + 16 * j)), mask);
+			else
+				m[j & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(
+				    _mm_sha256msg1_epu32(m[j & 3],
+				    m[(j + 1) & 3]),
+				    _mm_alignr_epi8(m[(j + 3) & 3],
+				    m[(j + 2) & 3], 4)), m[(j + 3) & 3]);
+			w = _mm_add_epi32(m[j & 3],
+			    _mm_loadu_si128((const __m128i *) (K256 + 4 * j)));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, w);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh,
+			    _mm_shuffle_epi32(w, 0x0e));
+		}
+		abef = _mm_add_epi32(abef, abef_save);
+		cdgh = _mm_add_epi32(cdgh, cdgh_save);
+		p += SHA256_BLOCK_BYTES;
+	}
+	tmp = _mm_shuffle_epi32(abef, 0x1b);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+	_mm_storeu_si128((__m128i *) st, _mm_blend_epi16(tmp, cdgh, 0xf0));
+	_mm_storeu_si128((__m128i *) (st + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+
+static bool use_ni(void)
+{
+	if (sha_ni < 0)
+		sha_ni = __builtin_cpu_supports("sha") &&
+		    __builtin_cpu_supports("sse4.1");
+	return sha_ni;
+}
+
+#else /* SHA_NI */
+
+static inline bool use_ni(void)
+{
+	return 0;
+}
+
+#endif /* !SHA_NI */
+
+
+/* --- Blocks -------------------------------------------------------------- */
+
+
+static void sha1_blocks(uint32_t *st, const uint8_t *p, size_t n)
+{
+	uint32_t w[80];
+	unsigned i;
+
+#ifdef SHA_NI
+	if (use_ni()) {
+		sha1_blocks_ni(st, p, n);
+		return;
+	}
+#endif
+	while (n--) {
+		for (i = 0; i != 16; i++)
+			w[i] = load_be32(p + 4 * i);
+		sha1_compress(st, w);
+		p += SHA1_BLOCK_BYTES;
+	}
+	memset(w, 0, sizeof(w));
+}
+
+
+static void sha256_blocks(uint32_t *st, const uint8_t *p, size_t n)
+{
+	uint32_t w[64];
+	unsigned i;
+
+#ifdef SHA_NI
+	if (use_ni()) {
+		sha256_blocks_ni(st, p, n);
+		return;
+	}
+#endif
+	while (n--) {
+		for (i = 0; i != 16; i++)
+			w[i] = load_be32(p + 4 * i);
+		sha256_compress(st, w);
+		p += SHA256_BLOCK_BYTES;
+	}
+	memset(w, 0, sizeof(w));
+}
+
+
+/* --- Update and padding -------------------------------------------------- */
+
+
+/*
+ * SHA1 and SHA256 have the same block size and padding, so the functions below
+ * serve both. "st", "buf", and "bytes" are the fields of the context.
+ */
+
+static void update(uint32_t *st, uint8_t *buf, uint64_t *bytes,
+    const uint8_t *data, size_t size, blocks_fn *blocks)
+{
+	unsigned r = *bytes % 64;
+
+	*bytes += size;
+	if (r) {
+		unsigned room = 64 - r;
+
+		if (size < room) {
+			memcpy(buf + r, data, size);
+			return;
+		}
+		memcpy(buf + r, data, room);
+		blocks(st, buf, 1);
+		data += room;
+		size -= room;
+	}
+	if (size >= 64) {
+		blocks(st, data, size / 64);
+		data += size - size % 64;
+		size %= 64;
+	}
+	memcpy(buf, data, size);
+}
+
+
+static void final(uint32_t *st, uint8_t *buf, uint64_t bytes,
+    blocks_fn *blocks)
+{
+	unsigned r = bytes % 64;
+	unsigned i;
+
+	buf[r++] = 0x80;
+	if (r > 56) {
+		memset(buf + r, 0, 64 - r);
+		blocks(st, buf, 1);
+		r = 0;
+	}
+	memset(buf + r, 0, 56 - r);
+	for (i = 0; i != 8; i++)
+		buf[56 + i] = (bytes * 8) >> (56 - 8 * i);
+	blocks(st, buf, 1);
+}
+
+
+/* --- Multi-buffer -------------------------------------------------------- */
+
+
+#ifdef LANES
+
+typedef void lanes_fn(vec *st, vec *w);
+
+
+static void sha1_compress_lanes(vec *st, vec *w)
+{
+	vec a = st[0], b = st[1], c = st[2], d = st[3], e = st[4];
+	unsigned t;
+
+	for (t = 16; t != 80; t++)
+		SHA1_SCHEDULE(w, t);
+	for (t = 0; t != 20; t += 5)
+		SHA1_FIVE(CH, 0x5a827999, t);
+	for (; t != 40; t += 5)
+		SHA1_FIVE(PARITY, 0x6ed9eba1, t);
+	for (; t != 60; t += 5)
+		SHA1_FIVE(MAJ, 0x8f1bbcdc, t);
+	for (; t != 80; t += 5)
+		SHA1_FIVE(PARITY, 0xca62c1d6, t);
+	st[0] += a;
+	st[1] += b;
+	st[2] += c;
+	st[3] += d;
+	st[4] += e;
+}
+
+
+static void sha256_compress_lanes(vec *st, vec *w)
+{
+	vec a = st[0], b = st[1], c = st[2], d = st[3];
+	vec e = st[4], f = st[5], g = st[6], h = st[7];
+	unsigned t;
+
+	for (t = 16; t != 64; t++)
+		SHA256_SCHEDULE(w, t);
+	for (t = 0; t != 64; t += 8)
+		SHA256_EIGHT(t);
+	st[0] += a;
+	st[1] += b;
+	st[2] += c;
+	st[3] += d;
+	st[4] += e;
+	st[5] += f;
+	st[6] += g;
+	st[7] += h;
+}
+
+
+/*
+ * pad_block returns block "j" of the rest of a message: the "r" bytes at
+ * "head", followed by the "size" bytes at "m", and the padding for a message
+ * of "bytes" bytes in total. Blocks that only contain bytes from "m" are
+ * returned in place, the others are assembled in "buf".
+ */
+
+static const uint8_t *pad_block(uint8_t *buf, const uint8_t *head, unsigned r,
+    const uint8_t *m, size_t size, uint64_t bytes, size_t j)
+{
+	size_t end = r + size;
+	size_t len_pos = ((end + 8) / 64 + 1) * 64 - 8;
+	size_t pos = j * 64;
+	unsigned i;
+
+	if (pos >= r && pos + 64 <= end)
+		return m + pos - r;
+	for (i = 0; i != 64; i++) {
+		if (pos < r)
+			buf[i] = head[pos];
+		else if (pos < end)
+			buf[i] = m[pos - r];
+		else if (pos == end)
+			buf[i] = 0x80;
+		else if (pos < len_pos)
+			buf[i] = 0;
+		else
+			buf[i] = (bytes * 8) >> (8 * (len_pos + 7 - pos));
+		pos++;
+	}
+	return buf;
+}
+
+
+/*
+ * lanes hashes LANES messages that continue the state "h" with "bytes" bytes
+ * hashed so far, of which the last bytes % 64 are still in "head". "words" is
+ * the number of words of the state and of the hash.
+ */
+
+static void lanes(uint8_t *res, unsigned words, const uint32_t *h,
+    const uint8_t *head, uint64_t bytes, const void *const *data, size_t size,
+    lanes_fn *compress)
+{
+	unsigned r = bytes % 64;
+	size_t blocks = (r + size + 8) / 64 + 1;
+	vec st[8], w[80];
+	uint8_t buf[64];
+	const uint8_t *p;
+	unsigned i, l;
+	size_t j;
+
+	for (i = 0; i != words; i++)
+		for (l = 0; l != LANES; l++)
+			st[i][l] = h[i];
+	for (j = 0; j != blocks; j++) {
+		for (l = 0; l != LANES; l++) {
+			p = pad_block(buf, head, r, data[l], size, bytes + size,
+			    j);
+			for (i = 0; i != 16; i++)
+				w[i][l] = load_be32(p + 4 * i);
+		}
+		compress(st, w);
+	}
+	for (l = 0; l != LANES; l++)
+		for (i = 0; i != words; i++)
+			store_be32(res + 4 * (l * words + i), st[i][l]);
+	memset(st, 0, sizeof(st));
+	memset(w, 0, sizeof(w));
+	memset(buf, 0, sizeof(buf));
+}
+
+#endif /* LANES */
+
+
+/* --- SHA1 ---------------------------------------------------------------- */
+
+
+void sha1_init(struct sha1_ctx *ctx)
+{
+	memcpy(ctx->h, sha1_iv, sizeof(sha1_iv));
+	ctx->bytes = 0;
+}
+
+
+void sha1_update(struct sha1_ctx *ctx, const void *data, size_t size)
+{
+	update(ctx->h, ctx->buf, &ctx->bytes, data, size, sha1_blocks);
+}
+
+
+void sha1_final(struct sha1_ctx *ctx, uint8_t res[SHA1_HASH_BYTES])
+{
+	unsigned i;
+
+	final(ctx->h, ctx->buf, ctx->bytes, sha1_blocks);
+	for (i = 0; i != 5; i++)
+		store_be32(res + 4 * i, ctx->h[i]);
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+
+void sha1_batch(uint8_t (*res)[SHA1_HASH_BYTES], const struct sha1_ctx *start,
+    const void *const *data, size_t size, unsigned n)
+{
+	struct sha1_ctx init, ctx;
+	unsigned i = 0;
+
+	if (!start) {
+		sha1_init(&init);
+		start = &init;
+	}
+#ifdef LANES
+	if (!use_ni())
+		for (; i + LANES <= n; i += LANES)
+			lanes(res[i], 5, start->h, start->buf, start->bytes,
+			    data + i, size, sha1_compress_lanes);
+#endif
+	for (; i != n; i++) {
+		ctx = *start;
+		sha1_update(&ctx, data[i], size);
+		sha1_final(&ctx, res[i]);
+	}
+}
+
+
+/* --- SHA256 -------------------------------------------------------------- */
+
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+	memcpy(ctx->h, sha256_iv, sizeof(sha256_iv));
+	ctx->bytes = 0;
+}
+
+
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t size)
+{
+	update(ctx->h, ctx->buf, &ctx->bytes, data, size, sha256_blocks);
+}
+
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t res[SHA256_HASH_BYTES])
+{
+	unsigned i;
+
+	final(ctx->h, ctx->buf, ctx->bytes, sha256_blocks);
+	for (i = 0; i != 8; i++)
+		store_be32(res + 4 * i, ctx->h[i]);
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+
+void sha256_batch(uint8_t (*res)[SHA256_HASH_BYTES],
+    const struct sha256_ctx *start, const void *const *data, size_t size,
+    unsigned n)
+{
+	struct sha256_ctx init, ctx;
+	unsigned i = 0;
+
+	if (!start) {
+		sha256_init(&init);
+		start = &init;
+	}
+#ifdef LANES
+	if (!use_ni())
+		for (; i + LANES <= n; i += LANES)
+			lanes(res[i], 8, start->h, start->buf, start->bytes,
+			    data + i, size, sha256_compress_lanes);
+#endif
+	for (; i != n; i++) {
+		ctx = *start;
+		sha256_update(&ctx, data[i], size);
+		sha256_final(&ctx, res[i]);
+	}
+}
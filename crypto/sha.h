@@ -8,6 +8,7 @@
 #ifndef SHA_H
 #define	SHA_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -19,6 +20,11 @@
 #define	SHA256_BLOCK_BYTES	64	/* 512 bits */
 
 
+/*
+ * sha*_begin, sha*_hash, and sha*_end hash one message at a time, with the
+ * hardware accelerator on the device. They are not reentrant.
+ */
+
 void sha1_begin(void);
 void sha1_hash(const uint8_t *data, size_t size);
 void sha1_end(uint8_t res[SHA1_HASH_BYTES]);
@@ -27,4 +33,49 @@ void sha256_begin(void);
 void sha256_hash(const uint8_t *data, size_t size);
 void sha256_end(uint8_t res[SHA256_HASH_BYTES]);
 
+/*
+ * The context-based API is implemented in software (sha-soft.c), and keeps all
+ * its state in the context. Any number of hashes can therefore be in progress
+ * at the same time. sha*_final clears the context.
+ *
+ * sha*_batch hashes "n" messages of "size" bytes each, data[0] to
+ * data[n - 1], and stores their hashes in res[0] to res[n - 1]. If "start" is
+ * not NULL, each message is preceded by what has already been hashed into
+ * "start", e.g., the key block of HMAC. "start" is not changed.
+ */
+
+struct sha1_ctx {
+	uint32_t	h[5];
+	uint64_t	bytes;		/* bytes hashed so far */
+	uint8_t		buf[SHA1_BLOCK_BYTES];	/* partial block */
+};
+
+struct sha256_ctx {
+	uint32_t	h[8];
+	uint64_t	bytes;
+	uint8_t		buf[SHA256_BLOCK_BYTES];
+};
+
+void sha1_init(struct sha1_ctx *ctx);
+void sha1_update(struct sha1_ctx *ctx, const void *data, size_t size);
+void sha1_final(struct sha1_ctx *ctx, uint8_t res[SHA1_HASH_BYTES]);
+void sha1_batch(uint8_t (*res)[SHA1_HASH_BYTES], const struct sha1_ctx *start,
+    const void *const *data, size_t size, unsigned n);
+
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t size);
+void sha256_final(struct sha256_ctx *ctx, uint8_t res[SHA256_HASH_BYTES]);
+void sha256_batch(uint8_t (*res)[SHA256_HASH_BYTES],
+    const struct sha256_ctx *start, const void *const *data, size_t size,
+    unsigned n);
+
+#ifndef SDK
+/*
+ * On x86 hosts, sha_ni selects the SHA instructions: -1 to use them if the CPU
+ * has them (default), 0 to never use them, e.g., for testing the other code.
+ */
+extern int sha_ni;
+#endif
+
+
 #endif /* !SHA_H */
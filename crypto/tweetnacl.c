@@ -10,18 +10,23 @@ typedef i64 gf[16];
 extern void randombytes(u8 *,u64);
 
 static const u8
-  _0[16],
-  _9[32] = {9};
+#ifndef CURVE25519_REF10
+  _9[32] = {9},
+#endif
+  _0[16];
 static const gf
   gf0,
   gf1 = {1},
+#ifndef CURVE25519_REF10
   _121665 = {0xDB41,1},
+#endif
   D = {0x78a3, 0x1359, 0x4dca, 0x75eb, 0xd8ab, 0x4141, 0x0a4d, 0x0070, 0xe898, 0x7779, 0x4079, 0x8cc7, 0xfe73, 0x2b6f, 0x6cee, 0x5203},
   D2 = {0xf159, 0x26b2, 0x9b94, 0xebd6, 0xb156, 0x8283, 0x149a, 0x00e0, 0xd130, 0xeef3, 0x80f2, 0x198e, 0xfce7, 0x56df, 0xd9dc, 0x2406},
   X = {0xd51a, 0x8f25, 0x2d60, 0xc956, 0xa7b2, 0x9525, 0xc760, 0x692c, 0xdc5c, 0xfdd6, 0xe231, 0xc0a4, 0x53fe, 0xcd6e, 0x36d3, 0x2169},
   Y = {0x6658, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666},
   I = {0xa0b0, 0x4a0e, 0x1b27, 0xc4ee, 0xe478, 0xad2f, 0x1806, 0x2f43, 0xd7a7, 0x3dfb, 0x0099, 0x2b4d, 0xdf0b, 0x4fc1, 0x2480, 0x2b83};
 
+#ifndef SECRETBOX_WORDS
 static u32 L32(u32 x,int c) { return (x << c) | ((x&0xffffffff) >> (32 - c)); }
 
 static u32 ld32(const u8 *x)
@@ -31,6 +36,7 @@ static u32 ld32(const u8 *x)
   u = (u<<8)|x[1];
   return (u<<8)|x[0];
 }
+#endif /* !SECRETBOX_WORDS */
 
 static u64 dl64(const u8 *x)
 {
@@ -39,11 +45,13 @@ static u64 dl64(const u8 *x)
   return u;
 }
 
+#ifndef SECRETBOX_WORDS
 sv st32(u8 *x,u32 u)
 {
   int i;
   FOR(i,4) { x[i] = u; u >>= 8; }
 }
+#endif /* !SECRETBOX_WORDS */
 
 sv ts64(u8 *x,u64 u)
 {
@@ -68,6 +76,7 @@ int crypto_verify_32(const u8 *x,const u8 *y)
   return vn(x,y,32);
 }
 
+#ifndef SECRETBOX_WORDS
 sv core(u8 *out,const u8 *in,const u8 *k,const u8 *c,int h)
 {
   u32 w[16],x[16],y[16],t[4];
@@ -120,15 +129,18 @@ int crypto_core_hsalsa20(u8 *out,const u8 *in,const u8 *k,const u8 *c)
   return 0;
 }
 
+#endif /* !SECRETBOX_WORDS */
+
 static const u8 sigma[16] = "expand 32-byte k";
 
-int crypto_stream_salsa20_xor(u8 *c,const u8 *m,u64 b,const u8 *n,const u8 *k)
+#ifndef SECRETBOX_WORDS
+int crypto_stream_salsa20_xor_ic(u8 *c,const u8 *m,u64 b,const u8 *n,u64 ic,const u8 *k)
 {
   u8 z[16],x[64];
   u32 u,i;
   if (!b) return 0;
-  FOR(i,16) z[i] = 0;
   FOR(i,8) z[i] = n[i];
+  FOR(i,8) { z[i+8] = ic; ic >>= 8; }
   while (b >= 64) {
     crypto_core_salsa20(x,z,k,sigma);
     FOR(i,64) c[i] = (m?m[i]:0) ^ x[i];
@@ -149,6 +161,12 @@ int crypto_stream_salsa20_xor(u8 *c,const u8 *m,u64 b,const u8 *n,const u8 *k)
   return 0;
 }
 
+int crypto_stream_salsa20_xor(u8 *c,const u8 *m,u64 b,const u8 *n,const u8 *k)
+{
+  return crypto_stream_salsa20_xor_ic(c,m,b,n,0,k);
+}
+#endif /* !SECRETBOX_WORDS */
+
 int crypto_stream_salsa20(u8 *c,u64 d,const u8 *n,const u8 *k)
 {
   return crypto_stream_salsa20_xor(c,0,d,n,k);
@@ -168,6 +186,7 @@ int crypto_stream_xor(u8 *c,const u8 *m,u64 d,const u8 *n,const u8 *k)
   return crypto_stream_salsa20_xor(c,m,d,n+16,s);
 }
 
+#ifndef SECRETBOX_WORDS
 sv add1305(u32 *h,const u32 *c)
 {
   u32 j,u = 0;
@@ -234,6 +253,7 @@ int crypto_onetimeauth(u8 *out,const u8 *m,u64 n,const u8 *k)
   FOR(j,16) out[j] = h[j];
   return 0;
 }
+#endif /* !SECRETBOX_WORDS */
 
 int crypto_onetimeauth_verify(const u8 *h,const u8 *m,u64 n,const u8 *k)
 {
@@ -391,6 +411,8 @@ sv pow2523(gf o,const gf i)
   FOR(a,16) o[a]=c[a];
 }
 
+/* see curve25519.c */
+#ifndef CURVE25519_REF10
 int crypto_scalarmult(u8 *q,const u8 *n,const u8 *p)
 {
   u8 z[32];
@@ -441,11 +463,14 @@ int crypto_scalarmult(u8 *q,const u8 *n,const u8 *p)
   pack25519(q,x+16);
   return 0;
 }
+#endif /* !CURVE25519_REF10 */
 
+#ifndef CURVE25519_REF10
 int crypto_scalarmult_base(u8 *q,const u8 *n)
 { 
   return crypto_scalarmult(q,n,_9);
 }
+#endif /* !CURVE25519_REF10 */
 
 int crypto_box_keypair(u8 *y,u8 *x)
 {
@@ -0,0 +1,111 @@
+/*
+ * arena.c - Memory for database entries
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * Entries, their names, and their fields are small objects that live until the
+ * database is closed, or until the entry changes. Instead of allocating each of
+ * them with malloc, we take them from large chunks, one after the other. The
+ * objects of an entry that is read from storage thus end up next to each other.
+ *
+ * Freed objects go on a free list per size class (multiples of ARENA_ALIGN),
+ * and are reused by the next object of the same size class. Closing the
+ * database frees all the chunks at once.
+ *
+ * Objects can contain secrets, so we clear them when freeing.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "alloc.h"
+#include "arena.h"
+
+
+#define	ARENA_CHUNK	4096	/* bytes per chunk, including the header */
+
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t		size;
+} __attribute__((aligned(ARENA_ALIGN)));
+
+
+static size_t round_size(size_t size)
+{
+	assert(size && size <= ARENA_MAX);
+	return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+
+static void new_chunk(struct arena *a)
+{
+	struct arena_chunk *c;
+
+	c = alloc_size(ARENA_CHUNK);
+	memset(c, 0, ARENA_CHUNK);
+	c->next = a->chunks;
+	c->size = ARENA_CHUNK;
+	a->chunks = c;
+	a->next = c + 1;
+	a->end = (uint8_t *) c + ARENA_CHUNK;
+	a->stats.size += ARENA_CHUNK;
+	a->stats.chunks++;
+}
+
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	size_t rounded = round_size(size);
+	void **list = &a->free[rounded / ARENA_ALIGN - 1];
+	void *p;
+
+	if (*list) {
+		p = *list;
+		*list = *(void **) p;
+		*(void **) p = NULL;
+		a->stats.free -= rounded;
+	} else {
+		if (!a->next || (uint8_t *) a->end - (uint8_t *) a->next <
+		    (ptrdiff_t) rounded)
+			new_chunk(a);
+		p = a->next;
+		a->next = (uint8_t *) a->next + rounded;
+	}
+	a->stats.in_use += rounded;
+	a->stats.objects++;
+	if (a->stats.in_use > a->stats.high_water)
+		a->stats.high_water = a->stats.in_use;
+	return p;
+}
+
+
+void arena_free(struct arena *a, void *p, size_t size)
+{
+	size_t rounded = round_size(size);
+	void **list = &a->free[rounded / ARENA_ALIGN - 1];
+
+	memset(p, 0, rounded);
+	*(void **) p = *list;
+	*list = p;
+	a->stats.in_use -= rounded;
+	a->stats.free += rounded;
+	a->stats.objects--;
+}
+
+
+void arena_free_all(struct arena *a)
+{
+	while (a->chunks) {
+		struct arena_chunk *c = a->chunks;
+
+		a->chunks = c->next;
+		memset(c, 0, c->size);
+		free(c);
+	}
+	memset(a, 0, sizeof(*a));
+}
@@ -0,0 +1,52 @@
+/*
+ * arena.h - Memory for database entries
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+#ifndef ARENA_H
+#define	ARENA_H
+
+#include <stddef.h>
+
+
+#define	ARENA_MAX	512	/* largest object we can allocate */
+#define	ARENA_ALIGN	8
+#define	ARENA_CLASSES	(ARENA_MAX / ARENA_ALIGN)
+
+
+struct arena_chunk;
+
+struct arena_stats {
+	size_t		size;		/* bytes in chunks */
+	size_t		in_use;		/* bytes in objects */
+	size_t		high_water;	/* maximum of in_use */
+	size_t		free;		/* bytes of freed objects, for reuse */
+	unsigned	chunks;
+	unsigned	objects;
+};
+
+struct arena {
+	struct arena_chunk *chunks;
+	void		*next;		/* unused part of the current chunk */
+	void		*end;
+	void		*free[ARENA_CLASSES];
+	struct arena_stats stats;
+};
+
+
+/*
+ * arena_alloc never fails (like alloc_size), and returns zeroed memory.
+ * arena_free must be given the same size as arena_alloc. It clears the object,
+ * and keeps it for reuse by objects of the same size class. arena_free_all
+ * clears and frees all the memory of the arena.
+ *
+ * A zeroed "struct arena" is an empty arena.
+ */
+
+void *arena_alloc(struct arena *a, size_t size);
+void arena_free(struct arena *a, void *p, size_t size);
+void arena_free_all(struct arena *a);
+
+#endif /* !ARENA_H */
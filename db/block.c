@@ -9,6 +9,9 @@
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#ifndef SDK
+#include <pthread.h>
+#endif
 
 #include "hal.h"
 #include "sha.h"
@@ -21,9 +24,6 @@
 
 PSRAM_NOINIT uint8_t io_buf[STORAGE_BLOCK_SIZE];
 
-static PSRAM_NOINIT uint8_t bc[STORAGE_BLOCK_SIZE];
-	// @@@ beyond-worst-case size
-
 
 static enum block_type classify_block(const uint8_t *b)
 {
@@ -49,19 +49,20 @@ static enum block_type classify_block(const uint8_t *b)
 }
 
 
-enum block_type block_read(const struct dbcrypt *c, uint16_t *seq,
-    void *payload, unsigned *payload_len, unsigned n)
+/*
+ * block_parse decrypts the content, i.e., header and payload, directly into
+ * "payload", and then moves the payload down over the header.
+ */
+
+enum block_type block_parse(const struct dbcrypt *c, uint16_t *seq,
+    void *payload, unsigned *payload_len, const void *raw)
 {
-	const struct block_header *hdr = (const void *) bc;
+	struct block_header hdr;
 	enum block_type type;
+	unsigned len = 0;
 	int got;
 
-	assert(n >= RESERVED_BLOCKS);
-	assert(n < storage_blocks());
-
-	if (!storage_read_block(io_buf, n))
-		return bt_error;
-	type = classify_block(io_buf);
+	type = classify_block(raw);
 	if (!payload)
 		return type;
 	switch (type) {
@@ -72,35 +73,158 @@ enum block_type block_read(const struct dbcrypt *c, uint16_t *seq,
 	default:
 		break;
 	}
-	got = db_decrypt(c, bc, sizeof(bc), io_buf);
-	if (got < 0) {
-		memset(bc, 0, sizeof(bc));
+	got = db_decrypt(c, payload, *payload_len, raw);
+	if (got < 0)
 		return bt_invalid;
-	}
-	assert((unsigned) got >= sizeof(*hdr));
-	assert((unsigned) got <= sizeof(*hdr) + *payload_len);
-	type = hdr->type;
-	switch (hdr->type) {
+	assert((unsigned) got >= sizeof(hdr));
+	memcpy(&hdr, payload, sizeof(hdr));
+	type = hdr.type;
+	switch (hdr.type) {
 	case bt_data:
+	case bt_packed:
+	case bt_counters:
 	case bt_settings:
+	case bt_summary:
 		if (seq)
-			*seq = hdr->seq;
-		memcpy(payload, bc + sizeof(*hdr), got - sizeof(*hdr));
-		*payload_len = got - sizeof(*hdr);
+			*seq = hdr.seq;
+		len = got - sizeof(hdr);
+		memmove(payload, payload + sizeof(hdr), len);
 		break;
 	case bt_empty:
-		*payload_len = 0;
 		break;
 	default:
 		type = bt_invalid;
-		*payload_len = 0;
 		break;
 	}
-	memset(bc, 0, sizeof(bc));
+	/* don't leave any plaintext beyond the payload */
+	memset(payload + len, 0, got - len);
+	*payload_len = len;
 	return type;
 }
 
 
+static void parse_one(const struct dbcrypt *c, struct block_parsed *out,
+    const uint8_t *raw)
+{
+	out->length = sizeof(out->payload);
+	out->type = block_parse(c, &out->seq, out->payload, &out->length, raw);
+}
+
+
+#ifdef SDK
+
+void block_parse_chunk(const struct dbcrypt *c, struct block_parsed *out,
+    const void *raw, unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i != n; i++)
+		parse_one(c, out + i, raw + i * STORAGE_BLOCK_SIZE);
+}
+
+#else /* SDK */
+
+/*
+ * The calling thread and block_threads - 1 workers take the next block of the
+ * chunk until all are parsed. The workers are started when first needed, and
+ * then wait for the next chunk.
+ */
+
+unsigned block_threads = 1;
+
+static struct {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	work;		/* there are blocks to parse */
+	pthread_cond_t	done;		/* all blocks have been parsed */
+	unsigned	workers;
+	const struct dbcrypt *c;
+	struct block_parsed *out;
+	const uint8_t	*raw;
+	unsigned	n;
+	unsigned	next;		/* next block to parse */
+	unsigned	parsed;		/* blocks parsed */
+} pool = {
+	.mutex	= PTHREAD_MUTEX_INITIALIZER,
+	.work	= PTHREAD_COND_INITIALIZER,
+	.done	= PTHREAD_COND_INITIALIZER,
+};
+
+
+/* parse_next parses blocks until none are left. We hold pool.mutex. */
+
+static void parse_next(void)
+{
+	unsigned i;
+
+	while (pool.next != pool.n) {
+		i = pool.next++;
+		pthread_mutex_unlock(&pool.mutex);
+		parse_one(pool.c, pool.out + i,
+		    pool.raw + i * STORAGE_BLOCK_SIZE);
+		pthread_mutex_lock(&pool.mutex);
+		if (++pool.parsed == pool.n)
+			pthread_cond_signal(&pool.done);
+	}
+}
+
+
+static void *worker(void *arg)
+{
+	pthread_mutex_lock(&pool.mutex);
+	while (1) {
+		while (pool.next == pool.n)
+			pthread_cond_wait(&pool.work, &pool.mutex);
+		parse_next();
+	}
+	return NULL;
+}
+
+
+void block_parse_chunk(const struct dbcrypt *c, struct block_parsed *out,
+    const void *raw, unsigned n)
+{
+	pthread_t thread;
+	unsigned i;
+
+	if (block_threads < 2 || n < 2) {
+		for (i = 0; i != n; i++)
+			parse_one(c, out + i, raw + i * STORAGE_BLOCK_SIZE);
+		return;
+	}
+	pthread_mutex_lock(&pool.mutex);
+	while (pool.workers < block_threads - 1) {
+		if (pthread_create(&thread, NULL, worker, NULL))
+			break;
+		pthread_detach(thread);
+		pool.workers++;
+	}
+	pool.c = c;
+	pool.out = out;
+	pool.raw = raw;
+	pool.n = n;
+	pool.next = pool.parsed = 0;
+	pthread_cond_broadcast(&pool.work);
+	parse_next();
+	while (pool.parsed != pool.n)
+		pthread_cond_wait(&pool.done, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+#endif /* !SDK */
+
+
+enum block_type block_read(const struct dbcrypt *c, uint16_t *seq,
+    void *payload, unsigned *payload_len, unsigned n)
+{
+	assert(n >= RESERVED_BLOCKS);
+	assert(n < storage_blocks());
+
+	if (!storage_read_block(io_buf, n))
+		return bt_error;
+	return block_parse(c, seq, payload, payload_len, io_buf);
+}
+
+
 bool block_validate(const struct dbcrypt *c, unsigned n)
 {
 	int got;
@@ -108,39 +232,69 @@ bool block_validate(const struct dbcrypt *c, unsigned n)
 	assert(n < storage_blocks());
 	if (!storage_read_block(io_buf, n))
 		return 0;
-	got =  db_decrypt(c, bc, sizeof(bc), io_buf);
-	memset(bc, 0, sizeof(bc));
+	got = db_decrypt(c, NULL, 0, io_buf);
 	return got >= 0;
 }
 
 
+unsigned block_capacity(const struct dbcrypt *c)
+{
+	return db_capacity(c) - sizeof(struct block_header);
+}
+
+
 bool block_write(const struct dbcrypt *c, enum block_type type, uint16_t seq,
     const void *payload, unsigned length, unsigned n)
 {
-	struct block_header *hdr = (void *) bc;
+	struct block_header hdr;
 
 	assert(n >= RESERVED_BLOCKS);
 	assert(n < storage_blocks());
-	assert(sizeof(*hdr) + length <= sizeof(bc));
 
-	memset(io_buf, 0, sizeof(io_buf));
-	memset(hdr, 0, sizeof(*hdr));
-	hdr->type = type;
-	hdr->seq = seq;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.type = type;
+	hdr.seq = seq;
 	switch (type) {
 	case bt_empty:
 		length = 0;
 		break;
 	case bt_data:
+	case bt_packed:
+	case bt_counters:
 	case bt_settings:
-		memcpy(bc + sizeof(*hdr), payload, length);
+	case bt_summary:
 		break;
 	default:
 		ABORT();
 	}
-	if (!db_encrypt(c, io_buf, bc, sizeof(*hdr) + length))
+	/*
+	 * db_encrypt fills all of io_buf, and encrypts header and payload
+	 * there.
+	 */
+	if (type == bt_counters) {
+		assert(sizeof(hdr) + length <= DB_SLOT_SIZE);
+		if (!db_encrypt_slotted(c, io_buf, &hdr, sizeof(hdr), payload,
+		    length))
+			return 0;
+	} else {
+		if (!db_encrypt(c, io_buf, &hdr, sizeof(hdr), payload, length))
+			return 0;
+	}
+	return storage_write_block(io_buf, n);
+}
+
+
+bool block_append(const struct dbcrypt *c, const void *payload,
+    unsigned length, unsigned n)
+{
+	assert(n >= RESERVED_BLOCKS);
+	assert(n < storage_blocks());
+	assert(length <= DB_SLOT_SIZE);
+
+	if (!storage_read_block(io_buf, n))
+		return 0;
+	if (db_encrypt_slot(c, io_buf, payload, length) < 0)
 		return 0;
-	memset(bc, 0, sizeof(bc));
 	return storage_write_block(io_buf, n);
 }
 
@@ -32,7 +32,7 @@
  * Encrypted data:
  *	16	Hash
  *	*	Payload (zero-padded to fill the block)
- *	1	  Content type (empty, data)
+ *	1	  Content type (empty, data, packed)
  *	1	  Reserved (set to zero when writing, ignore when reading)
  *	2	  Sequence number (little-endian)
  */
@@ -41,6 +41,8 @@ enum content_type {
 	ct_empty		= 3,	/* the block is allocated but does not
 					   contain valid data */
 	ct_data			= 4,	/* only block in a sequence */
+	ct_packed		= 7,	/* records of several entries */
+	ct_counters		= 8,	/* log of HOTP counters (slotted) */
 };
 
 /*
@@ -56,6 +58,9 @@ enum block_type {
 	bt_empty	= ct_empty,
 	bt_data		= ct_data,
 	bt_settings	= 5,	/* block contains settings */
+	bt_summary	= 6,	/* summary of block states, see summary.c */
+	bt_packed	= ct_packed,
+	bt_counters	= ct_counters,
 };
 
 struct block_header {
@@ -73,11 +78,14 @@ extern PSRAM_NOINIT uint8_t io_buf[STORAGE_BLOCK_SIZE];
  * block_read returns the decrypted payload in the buffer at "payload".
  * When calling block_read, payload_len points to the size of the buffer. After
  * a successful read, the length of the decrypted payload is stored in
- * *payload_len.
+ * *payload_len. Since the block is decrypted directly into the buffer, the
+ * buffer must be large enough for the entire encrypted content, including the
+ * block header. STORAGE_BLOCK_SIZE bytes are always enough.
  *
- * If the block type is anything other than bt_data, neither sequence number
- * nor payload data are returned. If the sequence number is not needed, a NULL
- * pointer can be passed for "seq".
+ * If the block type is anything other than bt_data, bt_packed, bt_counters,
+ * bt_settings, or bt_summary, neither sequence number nor payload data are
+ * returned. If the sequence number is not needed, a NULL pointer can be passed
+ * for "seq".
  *
  * If "payload" is NULL, only the block type (without resolving whether what
  * looks like bt_data is really valid) is returned, but no attempt is made to
@@ -86,8 +94,39 @@ extern PSRAM_NOINIT uint8_t io_buf[STORAGE_BLOCK_SIZE];
 enum block_type block_read(const struct dbcrypt *c, uint16_t *seq,
     void *payload, unsigned *payload_len, unsigned n);
 
+/*
+ * block_parse is like block_read, but takes the raw block content from "raw"
+ * instead of reading it from storage. This allows the caller to read several
+ * blocks at once with storage_read_blocks.
+ */
+enum block_type block_parse(const struct dbcrypt *c, uint16_t *seq,
+    void *payload, unsigned *payload_len, const void *raw);
+
+/*
+ * block_parse_chunk parses "n" consecutive raw blocks at "raw" with
+ * block_parse, and stores the results in out[0] to out[n - 1]. On the host,
+ * it uses up to block_threads threads.
+ */
+
+struct block_parsed {
+	enum block_type	type;
+	uint16_t	seq;
+	unsigned	length;
+	uint8_t		payload[STORAGE_BLOCK_SIZE];
+};
+
+#ifndef SDK
+extern unsigned block_threads;
+#endif
+
+void block_parse_chunk(const struct dbcrypt *c, struct block_parsed *out,
+    const void *raw, unsigned n);
+
 bool block_validate(const struct dbcrypt *c, unsigned n);
 
+/* block_capacity returns the maximum payload size of a block */
+unsigned block_capacity(const struct dbcrypt *c);
+
 /*
  * block_write requires the block to be erased. Note that attempting to write
  * to a block that is not completelly erased is likely to produce an invalid
@@ -96,6 +135,16 @@ bool block_validate(const struct dbcrypt *c, unsigned n);
 bool block_write(const struct dbcrypt *c, enum block_type type, uint16_t seq,
     const void *payload, unsigned length, unsigned n);
 
+/*
+ * bt_counters blocks are slotted (see dbcrypt.h): block_write puts the header
+ * and up to DB_SLOT_SIZE - sizeof(struct block_header) bytes of payload into
+ * slot 0, and block_append adds up to DB_SLOT_SIZE bytes in the next slot. It
+ * returns 0 if the block is full, or if writing fails. block_read returns the
+ * payload of all slots, with unused slots set to zero.
+ */
+bool block_append(const struct dbcrypt *c, const void *payload,
+    unsigned length, unsigned n);
+
 bool block_delete(unsigned n);
 
 #endif /* !BLOCK_H */
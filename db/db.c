@@ -17,19 +17,34 @@
 #include "util.h"
 #include "alloc.h"
 #include "rnd.h"
+#include "timer.h"
 #include "span.h"
 #include "storage.h"
 #include "block.h"
 #include "settings.h"
+#include "summary.h"
 #include "db.h"
 
 
 static bool update_entry(struct db_entry *de, unsigned new);
+static bool tsort_entry(struct db_entry *de);
+static bool deferred(const struct db_entry *de);
+static bool changed(struct db_entry *de, int new);
+static void resort(struct db_entry *de, bool prev_only);
+static bool log_counter(struct db_entry *de, const void *data,
+    unsigned len);
 
 
 PSRAM_NOINIT uint8_t payload_buf[STORAGE_BLOCK_SIZE];
 	// @@@ beyond-worst-case size
 
+/*
+ * db_open and db_is_erased read one erase block (storage_erase_size() blocks)
+ * at a time. db_open reads the next chunk into the other buffer while it
+ * decrypts the current one.
+ */
+#define	SCAN_BUFS	2
+
 struct db main_db;
 const enum field_type order2ft[] = {
     ft_end, ft_id, ft_prev, ft_user, ft_email, ft_pw, ft_pw2,
@@ -40,49 +55,271 @@ const unsigned field_types = sizeof(ft2order);
 
 /* --- Get an erased block, erasing if needed ------------------------------ */
 
+/*
+ * Wear leveling: we allocate blocks in a circle, starting after the block we
+ * allocated last (db->alloc_next). When we run out of erased blocks, we erase
+ * the next reclaimable erase block after that point. This way, frequently
+ * updated entries move through the whole storage, instead of wearing out the
+ * same few erase blocks. Only erase blocks holding data that never changes are
+ * left alone.
+ *
+ * This is all the wear leveling we do: we don't keep erase counts on flash, and
+ * allocation doesn't look at the in-memory counts from storage-io.c. Those only
+ * count erases since power-up, to check the rotation (e.g., tests/wear.sh). In
+ * particular, erase blocks that were erased more often before a power cycle, or
+ * that hold static data, are not compensated for.
+ *
+ * The summary remembers alloc_next, so we can continue where we left off after
+ * db_open.
+ *
+ * Erasing takes tens of milliseconds, so we try not to do it while the user is
+ * waiting. When there have been no writes for GC_IDLE_MS, db_gc erases one
+ * erase block at a time until we have db->gc_sectors erase blocks worth of
+ * erased blocks.
+ */
+
+#define	GC_IDLE_MS	500	/* start reclaiming after this much idle time */
+#define	GC_STEP_MS	50	/* time between erasing erase blocks */
 
-static int get_erased_block(struct db *db)
+
+
+static bool reclaim(struct db *db, struct db_span **spans, unsigned *count)
 {
 	unsigned erase_size = storage_erase_size();
 	int n;
 
+	n = span_pull_erase_block(spans, erase_size, db->alloc_next);
+	if (n < 0)
+		return 0;
+	*count -= erase_size;
+	if (summary_log(db, n, erase_size) &&
+	    storage_erase_blocks(n, erase_size)) {
+		span_add(&db->erased, n, erase_size);
+		db->stats.erased += erase_size;
+	} else {
+		db->stats.error += erase_size;
+	}
+	return 1;
+}
+
+
+static bool reclaim_any(struct db *db)
+{
+	return reclaim(db, &db->empty, &db->stats.empty) ||
+	    reclaim(db, &db->deleted, &db->stats.deleted);
+}
+
+
+static void db_gc(void *user)
+{
+	struct db *db = user;
+
+	if (db->stats.erased >= db->gc_sectors * storage_erase_size())
+		return;
+	if (!reclaim_any(db))
+		return;
+	db->gc.background++;
+	timer_set(&db->gc_timer, GC_STEP_MS, db_gc, db);
+}
+
+
+static void gc_schedule(struct db *db)
+{
+	timer_set(&db->gc_timer, GC_IDLE_MS, db_gc, db);
+}
+
+
+static int get_erased_block(struct db *db)
+{
+	int n;
+
+	if (db_opening(db))
+		return -1;
 	while (1) {
-		n = span_pull_one(&db->erased);
+		n = span_pull_one(&db->erased, db->alloc_next);
 		if (n >= 0) {
 			db->stats.erased--;
 			break;
 		}
-		n = span_pull_erase_block(&db->empty, erase_size);
-		if (n >= 0) {
-			db->stats.empty -= erase_size;
-			if (storage_erase_blocks(n, erase_size)) {
-				db->stats.erased += erase_size;
-				continue;
-			}
-			db->stats.error += erase_size;
-		}
-		n = span_pull_erase_block(&db->deleted, erase_size);
-		if (n >= 0) {
-			db->stats.deleted -= erase_size;
-			if (storage_erase_blocks(n, erase_size)) {
-				db->stats.erased += erase_size;
-				continue;
-			}
-			db->stats.error += erase_size;
-		}
+		if (!reclaim_any(db))
+			return -1;
+		db->gc.foreground++;
+	}
+	gc_schedule(db);
+	/* the block must not look erased to the next db_open */
+	if (!summary_alloc(db, n)) {
+		span_add(&db->erased, n, 1);
+		db->stats.erased++;
 		return -1;
 	}
+	db->alloc_next =
+	    (unsigned) n + 1 == db->summary_base ? RESERVED_BLOCKS : n + 1;
 	return n;
 }
 
 
+/* --- Name index --------------------------------------------------------- */
+
+/*
+ * Open addressing with linear probing. The table is at most half full, and
+ * its size is a power of two.
+ */
+
+#define	INDEX_MIN_SIZE	16
+
+
+static unsigned hash_name(const char *name, unsigned len)
+{
+	uint32_t h = 2166136261;	/* FNV-1a */
+
+	while (len--) {
+		h ^= (uint8_t) *name++;
+		h *= 16777619;
+	}
+	return h;
+}
+
+
+static void index_put(struct db *db, struct db_entry *de)
+{
+	unsigned mask = db->index_size - 1;
+	unsigned i = hash_name(de->name, strlen(de->name)) & mask;
+
+	while (db->index[i])
+		i = (i + 1) & mask;
+	db->index[i] = de;
+}
+
+
+static void index_add(struct db *db, struct db_entry *de)
+{
+	if (2 * (db->index_entries + 1) > db->index_size) {
+		struct db_entry **old = db->index;
+		unsigned old_size = db->index_size;
+		unsigned i;
+
+		db->index_size = old_size ? 2 * old_size : INDEX_MIN_SIZE;
+		db->index = alloc_type_n(struct db_entry *, db->index_size);
+		memset(db->index, 0, db->index_size * sizeof(*db->index));
+		for (i = 0; i != old_size; i++)
+			if (old[i])
+				index_put(db, old[i]);
+		free(old);
+	}
+	index_put(db, de);
+	db->index_entries++;
+}
+
+
+static void index_remove(struct db *db, const struct db_entry *de)
+{
+	unsigned mask = db->index_size - 1;
+	unsigned i = hash_name(de->name, strlen(de->name)) & mask;
+	unsigned j, k;
+
+	while (db->index[i] != de) {
+		assert(db->index[i]);
+		i = (i + 1) & mask;
+	}
+	db->index[i] = NULL;
+	db->index_entries--;
+
+	/* move back entries that would otherwise be unreachable */
+	for (j = (i + 1) & mask; db->index[j]; j = (j + 1) & mask) {
+		k = hash_name(db->index[j]->name, strlen(db->index[j]->name)) &
+		    mask;
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			db->index[i] = db->index[j];
+			db->index[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+
+struct db_entry *db_find_entry(const struct db *db, const char *name,
+    unsigned len)
+{
+	unsigned mask = db->index_size - 1;
+	unsigned i;
+
+	if (!db->index_size)
+		return NULL;
+	for (i = hash_name(name, len) & mask; db->index[i];
+	    i = (i + 1) & mask) {
+		const struct db_entry *de = db->index[i];
+
+		if (strlen(de->name) == len && !memcmp(de->name, name, len))
+			return db->index[i];
+	}
+	return NULL;
+}
+
+
 /* --- Helper functions ---------------------------------------------------- */
 
 
-static void free_field(struct db_field *f)
+/*
+ * Entries, names, and fields are allocated from db->arena. The data of a field
+ * is stored right after the field. If the data grows beyond that, it moves to
+ * a separate object.
+ */
+
+static char *new_name(struct db *db, const char *s, unsigned len)
+{
+	char *name;
+
+	name = arena_alloc(&db->arena, len + 1);
+	memcpy(name, s, len);
+	return name;
+}
+
+
+static void free_name(struct db *db, char *name)
+{
+	arena_free(&db->arena, name, strlen(name) + 1);
+}
+
+
+static struct db_field *new_field(struct db *db, enum field_type type,
+    const void *data, unsigned len)
+{
+	struct db_field *f;
+
+	f = arena_alloc(&db->arena, sizeof(*f) + len);
+	f->type = type;
+	f->len = f->room = len;
+	f->data = f + 1;
+	memcpy(f->data, data, len);
+	return f;
+}
+
+
+static void set_field_data(struct db *db, struct db_field *f,
+    const void *data, unsigned len)
+{
+	void *old = f->data == f + 1 ? NULL : f->data;
+	unsigned old_len = f->len;
+
+	if (len <= f->room) {
+		memmove(f + 1, data, len);
+		memset((uint8_t *) (f + 1) + len, 0, f->room - len);
+		f->data = f + 1;
+	} else {
+		f->data = arena_alloc(&db->arena, len);
+		memcpy(f->data, data, len);
+	}
+	f->len = len;
+	if (old)
+		arena_free(&db->arena, old, old_len);
+}
+
+
+static void free_field(struct db *db, struct db_field *f)
 {
-	free(f->data);
-	free(f);
+	if (f->data != f + 1)
+		arena_free(&db->arena, f->data, f->len);
+	arena_free(&db->arena, f, sizeof(*f) + f->room);
 }
 
 
@@ -92,16 +329,18 @@ static void free_fields(struct db_entry *de)
 		struct db_field *this = de->fields;
 
 		de->fields = this->next;
-		free_field(this);
+		free_field(de->db, this);
 	}
 }
 
 
 static void free_entry(struct db_entry *de)
 {
-	free(de->name);
+	struct db *db = de->db;
+
+	free_name(db, de->name);
 	free_fields(de);
-	free(de);
+	arena_free(&db->arena, de, sizeof(*de));
 }
 
 
@@ -117,11 +356,7 @@ static void add_field(struct db_entry *de, enum field_type type,
 	for (anchor = &de->fields; *anchor; anchor = &(*anchor)->next)
 		if ((*anchor)->type > type)
 			break;
-	f = alloc_type(struct db_field);
-	f->type = type;
-	f->len = len;
-	f->data = alloc_size(len);
-	memcpy(f->data, data, len);
+	f = new_field(de->db, type, data, len);
 	f->next = *anchor;
 	*anchor = f;
 	de->db->generation++;
@@ -136,10 +371,20 @@ bool db_change_field(struct db_entry *de, enum field_type type,
 	struct db_field *f;
 	int new = -1;
 
+	if (db_opening(db))
+		return 0;
 if (debugging)
   printf("db_change_field: %s.%u -> \"%.*s\"\n",
     de->name, type, size, (char *) data);
-	if (!de->defer) {
+	if (type == ft_hotp_counter && !deferred(de)) {
+		f = db_field_find(de, type);
+		if (f && f->len == size && log_counter(de, data, size)) {
+			set_field_data(db, f, data, size);
+			db->generation++;
+			return 1;
+		}
+	}
+	if (!deferred(de)) {
 		new = get_erased_block(db);
 		if (new < 0)
 			return 0;
@@ -150,34 +395,30 @@ if (debugging)
 			break;
 	if (*anchor && (*anchor)->type == type) {
 		f = *anchor;
-		free(f->data);
+		set_field_data(db, f, data, size);
 	} else {
-		f = alloc_type(struct db_field);
-		f->type = type;
+		f = new_field(db, type, data, size);
 		f->next = *anchor;
 		*anchor = f;
 	}
-	f->len = size;
-	f->data = alloc_size(size);
-	memcpy(f->data, data, size);
 
 	switch (type) {
 	case ft_id:
-		free(de->name);
-		de->name = alloc_size(size + 1);
-		memcpy(de->name, data, size);
-		de->name[size] = 0;
-		db_tsort(db);
+		index_remove(db, de);
+		free_name(db, de->name);
+		de->name = new_name(db, data, size);
+		index_add(db, de);
+		resort(de, 0);
 		break;
 	case ft_prev:
-		db_tsort(db);
+		resort(de, 1);
 		break;
 	default:
 		db->generation++;
 		break;
 	}
 
-	return de->defer || update_entry(de, new);
+	return changed(de, new);
 }
 
 
@@ -185,9 +426,12 @@ bool db_delete_field(struct db_entry *de, struct db_field *f)
 {
 	struct db *db = de->db;
 	struct db_field **anchor;
+	enum field_type type = f->type;
 	int new = -1;
 
-	if (!de->defer) {
+	if (db_opening(db))
+		return 0;
+	if (!deferred(de)) {
 		new = get_erased_block(db);
 		if (new < 0)
 			return 0;
@@ -195,13 +439,16 @@ bool db_delete_field(struct db_entry *de, struct db_field *f)
 
 	for (anchor = &de->fields; *anchor != f; anchor = &(*anchor)->next);
 	*anchor = f->next;
-	free_field(f);
+	free_field(db, f);
 
-	/* just in case we deleted ft_prev */
-	if (!db_tsort(db))
+	if (type == ft_prev)
+		resort(de, 1);
+	else if (!db->sorted && !db->transaction)
+		db_tsort(db);
+	else
 		db->generation++;
 
-	return de->defer || update_entry(de, new);
+	return changed(de, new);
 }
 
 
@@ -219,63 +466,452 @@ struct db_field *db_field_find(const struct db_entry *de, enum field_type type)
 /* --- Database entries: storage operations -------------------------------- */
 
 
-static bool write_entry(const struct db_entry *de)
+/*
+ * Entries are stored in packed blocks, each holding the records of one or more
+ * entries:
+ *
+ * Offset
+ * |	Size
+ * 0	2	Length of the fields (little-endian)
+ * 2	2	Sequence number of the entry (little-endian)
+ * 4	*	Fields (TLV, as in bt_data blocks)
+ *
+ * The list of records ends with a length of zero, or at the end of the
+ * payload. The sequence number in the block header is not used. Older
+ * databases have bt_data blocks, each holding the fields of a single entry.
+ *
+ * Records are never changed individually. Whenever one entry of a block
+ * changes, we write all the entries of the block to a new block, and delete
+ * the old one. Each write increments the sequence number of all the entries
+ * written, so if we crash before deleting the old block, db_open still picks
+ * the new records.
+ *
+ * New entries, and entries that are alone in their block, join the block in
+ * db->pack_block if there is room. If an entry grows beyond what its block can
+ * hold, it moves to a block of its own, and the rest of the entries to another
+ * one.
+ */
+
+#define	RECORD_HEADER	4
+
+
+static unsigned record_size(const struct db_entry *de)
+{
+	const struct db_field *f;
+	unsigned size = RECORD_HEADER;
+
+	for (f = de->fields; f; f = f->next)
+		size += 2 + f->len;
+	return size;
+}
+
+
+static uint8_t *put_fields(uint8_t *p, const struct db_entry *de)
 {
-	const void *end = payload_buf + sizeof(payload_buf);
-	uint8_t *p = payload_buf;
 	const struct db_field *f;
-	bool ok;
 
-	memset(payload_buf, 0, sizeof(payload_buf));
 	for (f = de->fields; f; f = f->next) {
-		if ((const void *) p + f->len + 2 > end) {
-			debug("write_entry: %p + %u + 2 > %p\n",
-			    p, f->len, end);
-			return 0;
-		}
 		*p++ = f->type;
 		*p++ = f->len;
 		memcpy(p, f->data, f->len);
 		p += f->len;
 	}
-	ok = block_write(de->db->c, bt_data, de->seq, payload_buf,
-	    p - payload_buf, de->block);
-	if (ok)
-		de->db->stats.data++;
-	return ok;
+	return p;
 }
 
 
-static bool update_entry(struct db_entry *de, unsigned new)
+static uint8_t *put_record(uint8_t *p, const struct db_entry *de)
 {
-	struct db *db = de->db;
-	unsigned old = de->block;
+	unsigned len = record_size(de) - RECORD_HEADER;
+
+	*p++ = len;
+	*p++ = len >> 8;
+	*p++ = de->seq;
+	*p++ = de->seq >> 8;
+	return put_fields(p, de);
+}
+
+
+/*
+ * An entry whose record does not fit in a packed block may still fit in a
+ * bt_data block, which has no record header.
+ */
+
+static bool fits_packed(const struct db *db, const struct db_entry *de)
+{
+	return record_size(de) <= block_capacity(db->c);
+}
+
+
+static bool fits_data(const struct db *db, const struct db_entry *de)
+{
+	return record_size(de) - RECORD_HEADER <= block_capacity(db->c);
+}
+
+
+/*
+ * Entries that have not been stored yet, i.e., dummies and entries added with
+ * db_load_entry, have block -1. They must never be mistaken for the entries
+ * of a block, so we only compare blocks of stored entries.
+ */
+
+static bool stored(const struct db_entry *de)
+{
+	return (int) de->block >= 0;
+}
+
+
+static bool in_block(const struct db_entry *de, unsigned n)
+{
+	return stored(de) && de->block == n;
+}
+
+
+/* block_bytes returns the size of the records in block "n", except "skip" */
+
+static unsigned block_bytes(const struct db *db, unsigned n,
+    const struct db_entry *skip)
+{
+	const struct db_entry *de;
+	unsigned size = 0;
+
+	for (de = db->entries; de; de = de->next)
+		if (in_block(de, n) && de != skip)
+			size += record_size(de);
+	return size;
+}
+
+
+static void discard_block(struct db *db, unsigned n)
+{
+	// @@@ complain more if block_delete fails ?
+	if (block_delete(n)) {
+		span_add(&db->deleted, n, 1);
+		db->stats.deleted++;
+	}
+}
+
+
+static void drop_block(struct db *db, unsigned n)
+{
+	// @@@ complain if block_delete fails ?
+	if (block_delete(n)) {
+		span_add(&db->deleted, n, 1);
+		db->stats.data--;
+		db->stats.deleted++;
+	}
+}
+
+
+/*
+ * write_packed writes the entries of block "from" (if "have_from"), except
+ * "skip", plus "add" (if not NULL) to block "n". If writing fails, it deletes
+ * block "n", and the entries stay where they were.
+ */
+
+static bool packs(const struct db_entry *de, bool have_from, unsigned from,
+    const struct db_entry *skip, const struct db_entry *add)
+{
+	if (de == add)
+		return 1;
+	return have_from && in_block(de, from) && de != skip;
+}
+
+
+static bool write_packed(struct db *db, unsigned n, bool have_from,
+    unsigned from, const struct db_entry *skip, struct db_entry *add)
+{
+	const uint8_t *end = payload_buf + block_capacity(db->c);
+	uint8_t *p = payload_buf;
+	struct db_entry *de;
+
+	memset(payload_buf, 0, sizeof(payload_buf));
+	for (de = db->entries; de; de = de->next) {
+		if (!packs(de, have_from, from, skip, add))
+			continue;
+		if (p + record_size(de) > end) {
+			debug("write_packed: %u + %u > %u\n",
+			    (unsigned) (p - payload_buf), record_size(de),
+			    (unsigned) (end - payload_buf));
+			discard_block(db, n);
+			return 0;
+		}
+		de->seq++;
+		p = put_record(p, de);
+	}
+	if (!block_write(db->c, bt_packed, 0, payload_buf, p - payload_buf,
+	    n)) {
+		discard_block(db, n);
+		return 0;
+	}
+	for (de = db->entries; de; de = de->next)
+		if (packs(de, have_from, from, skip, add)) {
+			de->block = n;
+			de->dirty = 0;
+			de->logged = 0;
+		}
+	db->stats.data++;
+	return 1;
+}
 
-	old = de->block;
-	de->block = new;
+
+/*
+ * write_data writes "de" alone to bt_data block "n". If writing fails, it
+ * deletes block "n", and the entry stays where it was.
+ */
+
+static bool write_data(struct db *db, unsigned n, struct db_entry *de)
+{
+	uint8_t *p;
+
+	if (!fits_data(db, de)) {
+		debug("write_data: %u > %u\n", record_size(de) - RECORD_HEADER,
+		    block_capacity(db->c));
+		discard_block(db, n);
+		return 0;
+	}
+	memset(payload_buf, 0, sizeof(payload_buf));
+	p = put_fields(payload_buf, de);
 	de->seq++;
+	if (!block_write(db->c, bt_data, de->seq, payload_buf, p - payload_buf,
+	    n)) {
+		discard_block(db, n);
+		return 0;
+	}
+	de->block = n;
+	de->dirty = 0;
+	de->logged = 0;
+	db->stats.data++;
+	return 1;
+}
 
-	if (!write_entry(de)) {
-		// @@@ complain more if block_delete fails ?
-		if (block_delete(new)) {
-			span_add(&db->deleted, new, 1);
-			db->stats.deleted++;
+
+/*
+ * store_entry writes entry "de", and the entries sharing its block (if it is
+ * stored), using the erased block "new".
+ */
+
+static bool store_entry(struct db_entry *de, unsigned new)
+{
+	struct db *db = de->db;
+	unsigned capacity = block_capacity(db->c);
+	bool have_old = stored(de);
+	unsigned old = de->block;
+	unsigned others = have_old ? block_bytes(db, old, de) : 0;
+	int pack = db->pack_block;
+	bool in_pack = have_old && pack == (int) old;
+	int rest = -1;
+
+	if (!others && pack >= 0 && !in_pack &&
+	    block_bytes(db, pack, NULL) + record_size(de) <= capacity) {
+		if (!write_packed(db, new, 1, pack, NULL, de))
+			return 0;
+		drop_block(db, pack);
+		if (have_old)
+			drop_block(db, old);
+		db->pack_block = new;
+		return 1;
+	}
+	if (others + record_size(de) <= capacity) {
+		if (!write_packed(db, new, have_old, old, NULL, de))
+			return 0;
+		if (have_old)
+			drop_block(db, old);
+		if (!others || in_pack)
+			db->pack_block = new;
+		return 1;
+	}
+
+	/*
+	 * "de" no longer fits with the other entries of its block. The others
+	 * move to a block of their own, and "de" to "new", alone. If even that
+	 * is too small for a record, "de" gets a bt_data block.
+	 */
+	if (!fits_data(db, de)) {
+		debug("store_entry: %u > %u\n", record_size(de) - RECORD_HEADER,
+		    capacity);
+		discard_block(db, new);
+		return 0;
+	}
+	if (others) {
+		rest = get_erased_block(db);
+		if (rest < 0) {
+			discard_block(db, new);
+			return 0;
+		}
+		if (!write_packed(db, rest, 1, old, de, NULL)) {
+			discard_block(db, new);
+			return 0;
 		}
+	}
+	if (fits_packed(db, de) ? !write_packed(db, new, 0, 0, NULL, de) :
+	    !write_data(db, new, de))
+		return 0;
+	if (have_old)
+		drop_block(db, old);
+	if (in_pack)
+		db->pack_block = rest;
+	return 1;
+}
+
+
+static bool update_entry(struct db_entry *de, unsigned new)
+{
+	return store_entry(de, new);
+}
+
+
+/* --- HOTP counter log ---------------------------------------------------- */
+
+/*
+ * Incrementing an HOTP counter would rewrite the block of the entry, and delete
+ * the old one, which sooner or later costs an erase. Instead, we add the new
+ * counter to the counter log, a slotted block (see dbcrypt.h), which only
+ * costs programming one slot.
+ *
+ * Slot 0 only holds the block header. The other slots contain:
+ *
+ * Offset
+ * |	Size
+ * 0	16	Name of the entry (NUL-padded)
+ * 16	2	Sequence number of the entry (little-endian)
+ * 18	6	Reserved (zero)
+ * 24	8	Counter (as in the ft_hotp_counter field)
+ *
+ * db_open applies a slot if the sequence number matches the entry it read.
+ * Later slots supersede earlier ones. Since writing an entry increments its
+ * sequence number, this also makes older slots obsolete.
+ *
+ * When the log is full, we fold it: we write all entries with logged counters,
+ * and replace the log with an empty one.
+ */
+
+#define	LOG_NAME	0
+#define	LOG_SEQ		16
+#define	LOG_COUNTER	24
+#define	LOG_FIRST	(DB_SLOT_SIZE - sizeof(struct block_header))
+
+
+static bool new_counter_log(struct db *db)
+{
+	int n;
+
+	n = get_erased_block(db);
+	if (n < 0)
+		return 0;
+	if (!block_write(db->c, bt_counters, 0, payload_buf, 0, n)) {
+		discard_block(db, n);
 		return 0;
 	}
-	// @@@ complain if block_delete fails ?
-	if (block_delete(old)) {
-		span_add(&db->deleted, old, 1);
-		db->stats.data--;
+	db->counter_block = n;
+	db->stats.special++;
+	return 1;
+}
+
+
+static bool fold_counters(struct db *db)
+{
+	struct db_entry *de;
+
+	for (de = db->entries; de; de = de->next) {
+		int new;
+
+		if (!de->logged)
+			continue;
+		new = get_erased_block(db);
+		if (new < 0 || !update_entry(de, new))
+			return 0;
+	}
+	/*
+	 * db_open expects at most one log, so if we can't delete the old one,
+	 * we keep it, and try again the next time it is full.
+	 */
+	if (db->counter_block >= 0) {
+		if (!block_delete(db->counter_block))
+			return 0;
+		span_add(&db->deleted, db->counter_block, 1);
+		db->stats.special--;
 		db->stats.deleted++;
+		db->counter_block = -1;
+	}
+	return new_counter_log(db);
+}
+
+
+static bool append_counter(struct db *db, const struct db_entry *de,
+    const void *data, unsigned len)
+{
+	uint8_t slot[DB_SLOT_SIZE];
+	bool ok;
+
+	memset(slot, 0, sizeof(slot));
+	memcpy(slot + LOG_NAME, de->name, strlen(de->name));
+	slot[LOG_SEQ] = de->seq;
+	slot[LOG_SEQ + 1] = de->seq >> 8;
+	memcpy(slot + LOG_COUNTER, data, len);
+	ok = block_append(db->c, slot, sizeof(slot), db->counter_block);
+	memset(slot, 0, sizeof(slot));
+	return ok;
+}
+
+
+/*
+ * log_counter returns 0 if the counter could not be logged, and the entry has
+ * to be written instead. The caller only updates the field after the new value
+ * has been logged, so that a failure leaves the entry as it is on flash.
+ */
+
+static bool log_counter(struct db_entry *de, const void *data, unsigned len)
+{
+	struct db *db = de->db;
+
+	if (strlen(de->name) > LOG_SEQ - LOG_NAME ||
+	    len > DB_SLOT_SIZE - LOG_COUNTER)
+		return 0;
+	if (db->counter_block < 0 || !append_counter(db, de, data, len)) {
+		if (!fold_counters(db) || !append_counter(db, de, data, len))
+			return 0;
 	}
+	de->logged = 1;
 	return 1;
 }
 
 
+static void apply_counters(struct db *db)
+{
+	const uint8_t *p, *end;
+	unsigned len = sizeof(payload_buf);
+
+	if (db->counter_block < 0)
+		return;
+	if (block_read(db->c, NULL, payload_buf, &len, db->counter_block) !=
+	    bt_counters)
+		return;
+	end = payload_buf + len;
+	for (p = payload_buf + LOG_FIRST; p + DB_SLOT_SIZE <= end;
+	    p += DB_SLOT_SIZE) {
+		const char *name = (const char *) p + LOG_NAME;
+		uint16_t seq = p[LOG_SEQ] | p[LOG_SEQ + 1] << 8;
+		struct db_entry *de;
+		struct db_field *f;
+
+		de = db_find_entry(db, name, strnlen(name, LOG_SEQ - LOG_NAME));
+		if (!de || de->seq != seq)
+			continue;
+		f = db_field_find(de, ft_hotp_counter);
+		if (!f || f->len > DB_SLOT_SIZE - LOG_COUNTER)
+			continue;
+		set_field_data(db, f, p + LOG_COUNTER, f->len);
+		de->logged = 1;
+	}
+}
+
+
 bool db_entry_defer_update(struct db_entry *de, bool defer)
 {
-	if (!defer) {
+	if (!defer && de->db->transaction) {
+		de->dirty = 1;
+	} else if (!defer) {
 		int new;
 
 		new = get_erased_block(de->db);
@@ -289,6 +925,83 @@ bool db_entry_defer_update(struct db_entry *de, bool defer)
 }
 
 
+/* --- Transactions -------------------------------------------------------- */
+
+
+/*
+ * While a transaction is open, changes to entries only mark them as dirty, and
+ * changes to "id" and "prev" fields only mark the list as unsorted. db_commit
+ * then sorts once, and writes each dirty entry to a new block.
+ */
+
+static bool deferred(const struct db_entry *de)
+{
+	return de->defer || de->db->transaction;
+}
+
+
+/*
+ * changed writes an entry after a change, unless writing is deferred. "new" is
+ * the block we allocated for the entry, or -1 if writing is deferred.
+ */
+
+static bool changed(struct db_entry *de, int new)
+{
+	if (de->defer)
+		return 1;
+	if (de->db->transaction) {
+		de->dirty = 1;
+		return 1;
+	}
+	return update_entry(de, new);
+}
+
+
+static void resort(struct db_entry *de, bool prev_only)
+{
+	struct db *db = de->db;
+
+	if (db->transaction) {
+		db->sorted = 0;
+		db->generation++;
+	} else if (!prev_only || !tsort_entry(de)) {
+		db_tsort(db);
+	}
+}
+
+
+void db_begin(struct db *db)
+{
+	db->transaction++;
+}
+
+
+bool db_commit(struct db *db)
+{
+	struct db_entry *de;
+	bool ok = 1;
+
+	assert(db->transaction);
+	if (--db->transaction)
+		return 1;
+	if (!db->sorted)
+		db_tsort(db);
+	for (de = db->entries; de; de = de->next) {
+		int new;
+
+		if (!de->dirty)
+			continue;
+		de->dirty = 0;
+		if (de->defer)
+			continue;
+		new = get_erased_block(db);
+		if (new < 0 || !update_entry(de, new))
+			ok = 0;
+	}
+	return ok;
+}
+
+
 /* --- Database entries: creation  ----------------------------------------- */
 
 /*
@@ -337,14 +1050,16 @@ bool db_entry_defer_update(struct db_entry *de, bool defer)
  */
 
 static struct db_entry *new_entry(struct db *db, const char *name,
-    const char *prev)
+    unsigned len, const char *prev)
 {
 	struct db_entry *de, **anchor;
 //	struct db_entry *e = NULL;
 
-	de = alloc_type(struct db_entry);
-	memset(de, 0, sizeof(*de));
+	de = arena_alloc(&db->arena, sizeof(*de));
 	de->db = db;
+	de->name = new_name(db, name, len);
+	index_add(db, de);
+	db->sorted = 0;
 //	if (prev)
 //		for (e = db->entries; e; e = e->next)
 //			if (!strcmp(e->name, prev))
@@ -353,7 +1068,7 @@ static struct db_entry *new_entry(struct db *db, const char *name,
 //		anchor = &e->next;
 //	} else {
 		for (anchor = &db->entries; *anchor; anchor = &(*anchor)->next)
-			if (strcmp((*anchor)->name, name) > 0)
+			if (strcmp((*anchor)->name, de->name) > 0)
 				break;
 //	}
 	de->next = *anchor;
@@ -367,23 +1082,20 @@ struct db_entry *db_new_entry(struct db *db, const char *name)
 	struct db_entry *de;
 	int new;
 
+	if (db_opening(db))
+		return NULL;
 	new = get_erased_block(db);
 	if (new < 0)
 		return NULL;
 	db->generation++;
-	de = new_entry(db, name, NULL);
-	de->name = stralloc(name);
-	de->block = new;
+	de = new_entry(db, name, strlen(name), NULL);
 	rnd_bytes(&de->seq, sizeof(de->seq));
 	add_field(de, ft_id, name, strlen(name));
 	db_tsort(db);
-	if (write_entry(de))
+	de->block = -1;
+	if (store_entry(de, new))
 		return de;
 	// @@@ complain
-	if (block_delete(new)) {
-		span_add(&db->deleted, new, 1);
-		db->stats.deleted++;
-	}
 	return NULL;
 }
 
@@ -394,8 +1106,7 @@ struct db_entry *db_dummy_entry(struct db *db, const char *name,
 	struct db_entry *de;
 
 	db->generation++;
-	de = new_entry(db, name, NULL);
-	de->name = stralloc(name);
+	de = new_entry(db, name, strlen(name), NULL);
 	de->block = -1;
 	de->defer = 1;
 	if (prev)
@@ -404,96 +1115,215 @@ struct db_entry *db_dummy_entry(struct db *db, const char *name,
 }
 
 
+struct db_entry *db_load_entry(struct db *db, struct db_entry *after,
+    const char *name)
+{
+	struct db_entry **anchor = after ? &after->next : &db->entries;
+	struct db_entry *de;
+
+	if (db_opening(db))
+		return NULL;
+	db->generation++;
+	de = arena_alloc(&db->arena, sizeof(*de));
+	de->db = db;
+	de->name = new_name(db, name, strlen(name));
+	de->block = -1;
+	de->defer = 1;
+	index_add(db, de);
+	db->sorted = 0;
+	de->next = *anchor;
+	*anchor = de;
+	add_field(de, ft_id, name, strlen(name));
+	return de;
+}
+
+
 /* --- Database entries: sorting ------------------------------------------- */
 
 
+/*
+ * db_tsort is Kahn's algorithm [1], made stable in the following way: we make
+ * passes over the list, and emit each entry whose predecessor has already been
+ * emitted (possibly earlier in the same pass). If a pass emits nothing, only
+ * cycles are left, and we break the first one in list order by ignoring the
+ * "prev" field of its first entry.
+ *
+ * Instead of making the passes, we calculate in which pass each entry would be
+ * emitted: roots are in the first pass, and an entry follows its predecessor
+ * in the same pass if it comes after it in the list, and in the next pass
+ * otherwise. Sorting by pass and position then yields the same order in
+ * O(n + e).
+ *
+ * [1] https://en.wikipedia.org/wiki/Topological_sorting#Kahn's_algorithm
+ */
+
+static struct db_entry *find_prev(const struct db_entry *e)
+{
+	const struct db_field *f = db_field_find(e, ft_prev);
+
+	/* ignore unmatched references */
+	return f ? db_find_entry(e->db, f->data, f->len) : NULL;
+}
+
+
 unsigned db_tsort(struct db *db)
 {
 	struct tmp {
-		struct db_entry *in;
-		const struct db_entry *prev;
-		struct db_entry *out;
-	} *tmp, *t, *t2;
-	struct db_entry *e, *e2;
+		struct db_entry *e;
+		int child;	/* first follower, -1 if none */
+		int sibling;	/* next follower of the same entry */
+		unsigned pass;	/* 0 if not reached yet */
+	} *tmp;
+	unsigned *queue, *start;
+	unsigned head = 0, tail = 0;
+	unsigned next = 0, max = 1;
+	struct db_entry *e;
 	unsigned n = 0;
 	unsigned i;
 
 	for (e = db->entries; e; e = e->next)
-		n++;
+		e->order = n++;
 	if (!n)
 		return 0;
 
 	db->generation++;
+	db->sorted = 1;
 
 	/* allocate temporary variables */
-	tmp = t = alloc_type_n(struct tmp, n);
+	tmp = alloc_type_n(struct tmp, n);
+	queue = alloc_type_n(unsigned, n);
 	for (e = db->entries; e; e = e->next) {
-		struct db_field *f;
-
-		t->in = e;
-		t->prev = NULL;
-		for (f = e->fields; f; f = f->next)
-			if (f->type == ft_prev)
-				break;
-		if (f)
-			for (e2 = db->entries; e2; e2 = e2->next)
-				if (f->len == strlen(e2->name) &&
-				    !memcmp(f->data, e2->name, f->len)) {
-					t->prev = e2;
-					break;
-				}
-			/* ignore unmatched references */
-		t++;
+		tmp[e->order].e = e;
+		tmp[e->order].child = -1;
+		tmp[e->order].pass = 0;
+	}
+	for (i = n; i--;) {
+		const struct db_entry *prev = find_prev(tmp[i].e);
+
+		if (prev) {
+			tmp[i].sibling = tmp[prev->order].child;
+			tmp[prev->order].child = i;
+		} else {
+			tmp[i].pass = 1;
+			queue[tail++] = i;
+		}
 	}
 
-	/*
-	 * Based on Kahn's algorithm
-	 * https://en.wikipedia.org/wiki/Topological_sorting#Kahn's_algorithm
-	 */
-	i = 0;
-	while (1) {
-		bool more = 0;
-		bool progress = 0;
-
-		for (t = tmp; t != tmp + n; t++) {
-			if (!t->in)
-				continue;
-			if (t->prev) {
-				more = 1;
-			} else {
-				progress = 1;
-				tmp[i].out = t->in;
-				i++;
-				for (t2 = tmp; t2 != tmp + n; t2++)
-					if (t2->prev == t->in)
-						t2->prev = NULL;
-				t->in = NULL;
+	while (1) {
+		while (head != tail) {
+			const struct tmp *t = tmp + queue[head++];
+			int c;
+
+			for (c = t->child; c >= 0; c = tmp[c].sibling) {
+				if (tmp[c].pass)
+					continue;
+				tmp[c].pass = t->pass +
+				    ((unsigned) c < t->e->order);
+				if (tmp[c].pass > max)
+					max = tmp[c].pass;
+				queue[tail++] = c;
 			}
 		}
-		if (!more)
+		if (tail == n)
 			break;
 
 		/* break cycles */
-		if (!progress)
-			for (t = tmp; t != tmp + n; t++)
-				if (t->in && t->prev) {
-					t->prev = NULL;
-					break;
-				}
+		while (tmp[next].pass)
+			next++;
+		tmp[next].pass = ++max;
+		queue[tail++] = next;
+		db->sorted = 0;
+	}
+
+	/* sort by pass, then by position */
+	start = alloc_type_n(unsigned, max + 1);
+	memset(start, 0, (max + 1) * sizeof(unsigned));
+	for (i = 0; i != n; i++)
+		start[tmp[i].pass]++;
+	for (head = 0, i = 0; i != max + 1; i++) {
+		tail = start[i];
+		start[i] = head;
+		head += tail;
 	}
-	assert(i == n);
+	for (i = 0; i != n; i++)
+		queue[start[tmp[i].pass]++] = i;
+	assert(start[max] == n);
 
 	/* apply new order */
-	db->entries = tmp[0].out;
-	for (t = tmp; t != tmp + n; t++)
-		t->out->next = t + 1 == tmp + n ? NULL : t[1].out;
+	db->entries = tmp[queue[0]].e;
+	for (i = 0; i != n; i++) {
+		e = tmp[queue[i]].e;
+		e->order = i;
+		e->next = i + 1 == n ? NULL : tmp[queue[i + 1]].e;
+	}
 
+	free(start);
+	free(queue);
 	free(tmp);
 
 	return n;
 }
 
 
+/*
+ * When the list is sorted and all entries come after their predecessor, we
+ * don't need a full sort if only the "prev" field of "de" has changed:
+ * - if the predecessor is before "de", or there is none, the order stays the
+ *   same,
+ * - else, db_tsort would defer "de" and all the entries that follow it to a
+ *   second pass, i.e., move them to the end of the list.
+ *
+ * tsort_entry returns 0 if the change creates a cycle, or if the list is not
+ * in the state described above. Then we need a full sort.
+ */
+
+static bool tsort_entry(struct db_entry *de)
+{
+	struct db *db = de->db;
+	const struct db_entry *prev = find_prev(de);
+	struct db_entry **anchor, **tail;
+	struct db_entry *moving = NULL;
+	struct db_entry *e;
+
+	if (!db->sorted || prev == de)
+		return 0;
+	db->generation++;
+	if (!prev)
+		return 1;
+	for (e = db->entries; e != de; e = e->next) {
+		if (e == prev)
+			return 1;
+		e->order = 0;
+	}
+
+	/* "order" is 1 if the entry moves, 0 otherwise */
+	de->order = 1;
+	for (e = de->next; e; e = e->next) {
+		const struct db_entry *p = find_prev(e);
+
+		e->order = p && p->order;
+		if (e == prev && e->order)
+			return 0;
+	}
+
+	tail = &moving;
+	anchor = &db->entries;
+	while (*anchor) {
+		e = *anchor;
+		if (e->order) {
+			*anchor = e->next;
+			*tail = e;
+			tail = &e->next;
+		} else {
+			anchor = &e->next;
+		}
+	}
+	*anchor = moving;
+	*tail = NULL;
+	return 1;
+}
+
+
 /* --- Database entries: reordering ---------------------------------------- */
 
 
@@ -522,6 +1352,8 @@ void db_move_after(struct db_entry *e, const struct db_entry *after)
 	struct db_entry *e2;
 	struct db_field *f = db_field_find(e, ft_prev);
 
+	if (db_opening(db))
+		return;
 	if (after) {
 if (debugging)
   printf("move_after: %s -> %s\n", e->name, after->name);
@@ -537,14 +1369,14 @@ if (debugging)
 		return;
 	}
 
-if (debugging)
-  printf("followers:\n");
 	/*
-	 * db_change_field and db_delete_entry sort the database, so we just
-	 * restart to be safe.
+	 * Within the transaction, the order of the list doesn't change, and
+	 * each entry we change is written only once, when we commit.
 	 */
-again:
-	f = db_field_find(e, ft_prev);
+	db_begin(db);
+
+if (debugging)
+  printf("followers:\n");
 	for (e2 = db->entries; e2; e2 = e2->next)
 		if (e2 != e && is_prev(e, e2)) {
 			if (f) {
@@ -556,20 +1388,16 @@ again:
 				assert(f2);
 				db_delete_field(e2, f2);
 			}
-			goto again;
 		}
 
 if (debugging)
   printf("followers2:\n");
-again2:
 	for (e2 = db->entries; e2; e2 = e2->next)
 {
 if (debugging)
   printf("\t%s: %p =? %p, (%s) %u\n", e2->name, e2, e, e->name, is_prev(e, e2));
-		if (e2 != e && is_prev(after, e2)) {
+		if (e2 != e && is_prev(after, e2))
 			db_change_field(e2, ft_prev, e->name, strlen(e->name));
-			goto again2;
-		}
 }
 
 	if (after) {
@@ -580,7 +1408,7 @@ if (debugging)
 			db_delete_field(e, f);
 	}
 
-	db_tsort(db);
+	db_commit(db);
 }
 
 
@@ -589,6 +1417,8 @@ void db_move_before(struct db_entry *e, const struct db_entry *before)
 	struct db *db = e->db;
 	const struct db_entry *prev;
 
+	if (db_opening(db))
+		return;
 	if (before == db->entries) {
 		prev = NULL;
 	} else if (before) {
@@ -615,11 +1445,36 @@ bool db_delete_entry(struct db_entry *de)
 	struct db *db = de->db;
 	struct db_entry **anchor;
 
+	if (db_opening(db))
+		return 0;
+	/* move the entries sharing the block out of the way */
+	if (stored(de) && block_bytes(db, de->block, de)) {
+		int new;
+
+		new = get_erased_block(db);
+		if (new < 0)
+			return 0;
+		if (!write_packed(db, new, 1, de->block, de, NULL))
+			return 0;
+		if (db->pack_block == (int) de->block)
+			db->pack_block = new;
+	} else if (db->pack_block == (int) de->block) {
+		db->pack_block = -1;
+	}
+
 	for (anchor = &db->entries; *anchor != de;
 	    anchor = &(*anchor)->next);
 	*anchor = de->next;
+	index_remove(db, de);
 
-	db_tsort(db);
+	/*
+	 * Entries following "de" lose their predecessor, but keep their
+	 * place.
+	 */
+	if (db->sorted || db->transaction)
+		db->generation++;
+	else
+		db_tsort(db);
 
 	if (!block_delete(de->block))
 		return 0;
@@ -631,6 +1486,112 @@ bool db_delete_entry(struct db_entry *de)
 }
 
 
+/* --- Database entries: packing ------------------------------------------- */
+
+
+/*
+ * db_pack only packs entries that have an "id" field, i.e., not dummies, and
+ * that fit in a packed block. Larger entries stay in their bt_data block, or,
+ * if they have not been stored yet, get one.
+ */
+
+static bool packable(const struct db_entry *de)
+{
+	return db_field_find(de, ft_id) && fits_packed(de->db, de);
+}
+
+
+static int pack_large(struct db *db)
+{
+	struct db_entry *de;
+	int blocks = 0;
+	int n;
+
+	for (de = db->entries; de; de = de->next) {
+		if (stored(de) || !db_field_find(de, ft_id) ||
+		    fits_packed(db, de))
+			continue;
+		n = get_erased_block(db);
+		if (n < 0 || !write_data(db, n, de))
+			return -1;
+		blocks++;
+	}
+	return blocks;
+}
+
+
+int db_pack(struct db *db)
+{
+	unsigned capacity = block_capacity(db->c);
+	struct db_span *old = NULL;
+	struct db_entry *first = db->entries;
+	struct db_entry *de, *e;
+	unsigned size;
+	uint8_t *p;
+	int blocks;
+	int n;
+
+	if (db_opening(db))
+		return -1;
+	blocks = pack_large(db);
+	if (blocks < 0)
+		return -1;
+	while (first) {
+		size = 0;
+		for (de = first; de; de = de->next) {
+			if (!packable(de))
+				continue;
+			if (size + record_size(de) > capacity)
+				break;
+			size += record_size(de);
+		}
+		if (!size)
+			break;
+		n = get_erased_block(db);
+		if (n < 0) {
+			blocks = -1;
+			break;
+		}
+		memset(payload_buf, 0, sizeof(payload_buf));
+		p = payload_buf;
+		for (e = first; e != de; e = e->next)
+			if (packable(e)) {
+				e->seq++;
+				p = put_record(p, e);
+			}
+		if (!block_write(db->c, bt_packed, 0, payload_buf,
+		    p - payload_buf, n)) {
+			discard_block(db, n);
+			blocks = -1;
+			break;
+		}
+		db->stats.data++;
+		for (e = first; e != de; e = e->next) {
+			if (!packable(e))
+				continue;
+			if (stored(e))
+				span_add(&old, e->block, 1);
+			e->block = n;
+			e->logged = 0;
+		}
+		db->pack_block = n;
+		blocks++;
+		first = de;
+
+		/*
+		 * Free the blocks we've emptied right away, so that we can
+		 * pack a database that fills most of the storage. Blocks that
+		 * still hold entries come back when we move their last entry.
+		 */
+		while ((n = span_pull_one(&old, 0)) >= 0)
+			if (!block_bytes(db, n, NULL))
+				drop_block(db, n);
+	}
+	span_free_all(old);
+	return blocks;
+}
+
+
 /* --- Database entries: iteration ----------------------------------------- */
 
 
@@ -689,6 +1650,30 @@ void db_stats(const struct db *db, struct db_stats *s)
 }
 
 
+void db_io_stats(struct storage_io_stats *s)
+{
+	storage_io_stats(s);
+}
+
+
+void db_io_reset(void)
+{
+	storage_io_reset();
+}
+
+
+void db_gc_stats(const struct db *db, struct db_gc_stats *s)
+{
+	*s = db->gc;
+}
+
+
+void db_mem_stats(const struct db *db, struct arena_stats *s)
+{
+	*s = db->arena.stats;
+}
+
+
 static const void *tlv_item(const void **p, const void *end,
     enum field_type *type, unsigned *len)
 {
@@ -725,19 +1710,14 @@ static bool process_payload(struct db *db, unsigned block, uint16_t seq,
 	struct db_entry *de;
 	const void *p, *q;
 	enum field_type type;
-	char *name;
 	unsigned len;
 
 	p = payload;
 	q = tlv_item(&p, end, &type, &len);
 	if (!q || type != ft_id)
 		return 0;
-	name = alloc_string(q, len);
-	for (de = db->entries; de; de = de->next)
-		if (!strcmp(de->name, name))
-			break;
+	de = db_find_entry(db, q, len);
 	if (de) {
-		free(name);
 		/*
 		 * @@@ We lose blocks here. Should either have an "obsolete"
 		 * type or consider it as "empty".
@@ -746,6 +1726,8 @@ static bool process_payload(struct db *db, unsigned block, uint16_t seq,
 			return 1;
 		free_fields(de);
 	} else {
+		const char *name = q;
+		unsigned name_len = len;
 		char *prev = NULL;
 
 		while (1) {
@@ -757,10 +1739,10 @@ static bool process_payload(struct db *db, unsigned block, uint16_t seq,
 				break;
 			}
 		}
-		de = new_entry(db, name, prev);
-		de->name = name;
+		de = new_entry(db, name, name_len, prev);
 		free(prev);
 	}
+	db->generation++;	/* for db_open_step */
 	de->block = block;
 	de->seq = seq;
 	p = payload;
@@ -774,71 +1756,355 @@ static bool process_payload(struct db *db, unsigned block, uint16_t seq,
 }
 
 
+static bool process_packed(struct db *db, unsigned block,
+    const uint8_t *payload, unsigned size)
+{
+	const uint8_t *end = payload + size;
+	const uint8_t *p = payload;
+	bool ok = 0;
+
+	while (p + RECORD_HEADER <= end) {
+		unsigned len = p[0] | p[1] << 8;
+		uint16_t seq = p[2] | p[3] << 8;
+
+		if (!len)
+			break;
+		p += RECORD_HEADER;
+		if (p + len > end)
+			return 0;
+		if (!process_payload(db, block, seq, p, len))
+			return 0;
+		p += len;
+		ok = 1;
+	}
+	return ok;
+}
+
+
+static void scan_free(struct db *db);
+
+
 void db_open_empty(struct db *db, const struct dbcrypt *c)
 {
+	/* the timer may still be pending from using "db" before */
+	timer_cancel(&db->gc_timer);
+	scan_free(db);
 	memset(db, 0, sizeof(*db));
 	db->c = c;
 	db->generation = 0;
 	db->stats.total = storage_blocks();
 	db->entries = NULL;
 	db->settings_block = -1;
+	db->pack_block = -1;
+	db->counter_block = -1;
+	db->summary_base = db->stats.total;
+	db->summary_block = -1;
+	db->alloc_next = RESERVED_BLOCKS;
+	db->gc_sectors = DB_GC_SECTORS;
 }
 
 
-bool db_open_progress(struct db *db, const struct dbcrypt *c,
-    void (*progress)(void *user, unsigned i, unsigned n), void *user)
+/*
+ * scan_block processes block "n", and returns its state for the summary. If
+ * "p" is not NULL, it points to the block, which has already been read from
+ * storage and decrypted.
+ */
+
+static enum summary_state scan_block(struct db *db, unsigned n,
+    const struct block_parsed *p)
 {
-	unsigned i;
+	const uint8_t *payload = payload_buf;
+	unsigned payload_len = sizeof(payload_buf);
+	enum block_type type;
 	uint16_t seq;
 
+	db->scanned++;
+	if (p) {
+		type = p->type;
+		seq = p->seq;
+		payload = p->payload;
+		payload_len = p->length;
+	} else {
+		type = block_read(db->c, &seq, payload_buf, &payload_len, n);
+	}
+	switch (type) {
+	case bt_error:
+		db->stats.error++;
+		break;
+	case bt_deleted:
+		return ss_deleted;
+	case bt_erased:
+		return ss_erased;
+	case bt_invalid:
+	case bt_summary:	/* not in the summary area */
+		db->stats.invalid++;
+		break;
+	case bt_empty:
+		return ss_empty;
+	case bt_data:
+		if (process_payload(db, n, seq, payload, payload_len))
+			db->stats.data++;
+		else
+			db->stats.invalid++;
+		break;
+	case bt_packed:
+		if (process_packed(db, n, payload, payload_len))
+			db->stats.data++;
+		else
+			db->stats.invalid++;
+		break;
+	case bt_counters:
+		/* we only ever have one, see fold_counters */
+		db->stats.special++;
+		db->counter_block = n;
+		break;
+	case bt_settings:
+		if (settings_process(seq, payload, payload_len)) {
+			db->stats.special++;
+			db->settings_block = n;
+		} else {
+			db->stats.invalid++;
+		}
+		break;
+	default:
+		ABORT();
+	}
+	return ss_live;
+}
+
+
+/* chunk_size returns the number of live blocks (up to "max") at "n" */
+
+static unsigned chunk_size(const uint8_t *state, unsigned n, unsigned end,
+    unsigned max)
+{
+	unsigned n_blocks = 0;
+
+	while (n_blocks != max && n + n_blocks != end &&
+	    state[n + n_blocks] == ss_live)
+		n_blocks++;
+	return n_blocks;
+}
+
+
+/*
+ * Opening the database can take seconds, so we scan the blocks in steps. The
+ * UI can then show the entries found so far between the steps. Until the scan
+ * is complete, we don't know which blocks are free, nor whether there are
+ * newer copies of the entries we found, so all changes fail.
+ */
+
+struct db_scan {
+	uint8_t		*state;		/* summary state of each block */
+	unsigned	next;		/* next block to scan */
+	unsigned	chunk;		/* blocks per chunk */
+	uint8_t		*raw[SCAN_BUFS]; /* chunk buffers, as read */
+	struct block_parsed *parsed;	/* the decrypted blocks of the chunk */
+	unsigned	buf;		/* raw buffer we decrypt from */
+	unsigned	first, got;	/* blocks in raw[buf] */
+	bool		ahead;		/* reading the next chunk */
+	unsigned	ahead_first, ahead_n;
+};
+
+
+/*
+ * read_ahead starts reading the chunk of live blocks at or after block "n" into
+ * the next raw buffer.
+ */
+
+static void read_ahead(struct db *db, unsigned n)
+{
+	struct db_scan *scan = db->scan;
+
+	while (n != db->summary_base && scan->state[n] != ss_live)
+		n++;
+	if (n == db->summary_base)
+		return;
+	scan->ahead_first = n;
+	scan->ahead_n = chunk_size(scan->state, n, db->summary_base,
+	    scan->chunk);
+	scan->ahead = storage_read_start(scan->raw[(scan->buf + 1) % SCAN_BUFS],
+	    n, scan->ahead_n);
+}
+
+
+/*
+ * read_chunk reads the chunk of live blocks starting at block "n" (or takes it
+ * from the read ahead), starts reading the next chunk, and decrypts the blocks
+ * into scan->parsed. If reading fails, scan->got is zero, and we read block by
+ * block.
+ */
+
+static void read_chunk(struct db *db, unsigned n)
+{
+	struct db_scan *scan = db->scan;
+	bool ok;
+
+	scan->first = n;
+	if (scan->ahead && scan->ahead_first == n) {
+		ok = storage_read_wait();
+		scan->ahead = 0;
+		scan->buf = (scan->buf + 1) % SCAN_BUFS;
+		scan->got = ok ? scan->ahead_n : 0;
+	} else {
+		if (scan->ahead) {
+			storage_read_wait();
+			scan->ahead = 0;
+		}
+		scan->got = chunk_size(scan->state, n, db->summary_base,
+		    scan->chunk);
+		ok = storage_read_blocks(scan->raw[scan->buf], n, scan->got);
+		if (!ok)
+			scan->got = 0;
+	}
+	if (!ok)
+		return;
+	read_ahead(db, n + scan->got);
+	block_parse_chunk(db->c, scan->parsed, scan->raw[scan->buf],
+	    scan->got);
+}
+
+
+static void scan_free(struct db *db)
+{
+	struct db_scan *scan = db->scan;
+	unsigned i;
+
+	if (!scan)
+		return;
+	/* don't let the read ahead land in a buffer we free */
+	if (scan->ahead)
+		storage_read_wait();
+	memset(scan->parsed, 0, scan->chunk * sizeof(struct block_parsed));
+	free(scan->parsed);
+	for (i = 0; i != SCAN_BUFS; i++)
+		free(scan->raw[i]);
+	free(scan->state);
+	free(scan);
+	db->scan = NULL;
+}
+
+
+void db_open_begin(struct db *db, const struct dbcrypt *c)
+{
+	struct db_scan *scan;
+	unsigned i;
+
 	db_open_empty(db, c);
-	for (i = RESERVED_BLOCKS; i != db->stats.total; i++) {
-		unsigned payload_len = sizeof(payload_buf);
+	scan = alloc_type(struct db_scan);
+	scan->state = summary_load(db);
+	if (!scan->state) {
+		scan->state = alloc_size(db->stats.total);
+		memset(scan->state, ss_live, db->stats.total);
+	}
+	scan->chunk = storage_erase_size();
+	for (i = 0; i != SCAN_BUFS; i++)
+		scan->raw[i] = alloc_size(scan->chunk * STORAGE_BLOCK_SIZE);
+	scan->parsed = alloc_type_n(struct block_parsed, scan->chunk);
+	scan->next = RESERVED_BLOCKS;
+	scan->buf = 0;
+	scan->first = scan->got = 0;
+	scan->ahead = 0;
+	db->scan = scan;
+}
 
-		if (progress)
-			progress(user, i, db->stats.total);
-		switch (block_read(c, &seq, payload_buf, &payload_len, i)) {
-		case bt_error:
-			db->stats.error++;
-			break;
-		case bt_deleted:
-			span_add(&db->deleted, i, 1);
-			db->stats.deleted++;
-			break;
-		case bt_erased:
+
+static void open_finish(struct db *db)
+{
+	struct db_scan *scan = db->scan;
+	unsigned i;
+
+	/* don't skip blocks summary_alloc logged but we didn't allocate */
+	for (i = 1; i != SUMMARY_AHEAD && db->alloc_next > RESERVED_BLOCKS &&
+	    scan->state[db->alloc_next - 1] == ss_erased; i++)
+		db->alloc_next--;
+
+	apply_counters(db);
+	memset(payload_buf, 0, sizeof(payload_buf));
+	db->scan = NULL;
+	db_tsort(db);
+
+	/*
+	 * Only write a summary if we know that the key is right. Otherwise, we
+	 * would make the next db_open with the right key skip blocks.
+	 */
+	if (db->stats.data || db->stats.empty || db->settings_block != -1) {
+		summary_refresh(db, scan->state);
+		gc_schedule(db);
+	}
+	db->scan = scan;
+	scan_free(db);
+}
+
+
+bool db_open_step(struct db *db, unsigned blocks)
+{
+	struct db_scan *scan = db->scan;
+	uint8_t *state = scan->state;
+	unsigned i;
+
+	for (i = scan->next; i != db->summary_base && blocks; i++) {
+		enum summary_state ss;
+
+		ss = state[i];
+		if (ss == ss_live) {
+			if (i >= scan->first + scan->got)
+				read_chunk(db, i);
+			ss = scan_block(db, i,
+			    scan->got ? scan->parsed + i - scan->first : NULL);
+			blocks--;
+		}
+		switch (ss) {
+		case ss_erased:
 			span_add(&db->erased, i, 1);
 			db->stats.erased++;
 			break;
-		case bt_invalid:
-			db->stats.invalid++;
+		case ss_deleted:
+			span_add(&db->deleted, i, 1);
+			db->stats.deleted++;
 			break;
-		case bt_empty:
+		case ss_empty:
 			span_add(&db->empty, i, 1);
 			db->stats.empty++;
 			break;
-		case bt_data:
-			if (process_payload(db, i, seq, payload_buf,
-			    payload_len))
-				db->stats.data++;
-			else
-				db->stats.invalid++;
-			break;
-		case bt_settings:
-			if (settings_process(seq, payload_buf, payload_len)) {
-				db->stats.special++;
-				db->settings_block = i;
-			} else {
-				db->stats.invalid++;
-			}
-			break;
 		default:
-			ABORT();
+			break;
 		}
+		state[i] = ss;
+	}
+	scan->next = i;
+	if (i == db->summary_base) {
+		open_finish(db);
+		return 1;
+	}
+	return 0;
+}
+
+
+bool db_opening(const struct db *db)
+{
+	return db->scan;
+}
+
+
+unsigned db_open_position(const struct db *db)
+{
+	return db->scan ? db->scan->next : db->summary_base;
+}
+
+
+bool db_open_progress(struct db *db, const struct dbcrypt *c,
+    void (*progress)(void *user, unsigned i, unsigned n), void *user)
+{
+	db_open_begin(db, c);
+	while (1) {
+		if (progress)
+			progress(user, db_open_position(db), db->summary_base);
+		if (db_open_step(db, DB_OPEN_STEP))
+			break;
 	}
 	if (progress)
-		progress(user, i, i);
-	memset(payload_buf, 0, sizeof(payload_buf));
-	db_tsort(db);
+		progress(user, db->summary_base, db->summary_base);
 	return 1;
 }
 
@@ -851,34 +2117,48 @@ bool db_open(struct db *db, const struct dbcrypt *c)
 
 void db_close(struct db *db)
 {
-	while (db->entries) {
-		struct db_entry *this = db->entries;
-
-		db->entries = this->next;
-		free_entry(this);
-	}
+	scan_free(db);
+	timer_cancel(&db->gc_timer);
+	db->entries = NULL;
+	arena_free_all(&db->arena);
 	span_free_all(db->erased);
 	span_free_all(db->deleted);
 	span_free_all(db->empty);
+	free(db->index);
+	storage_flush();
 }
 
 
 bool db_is_erased(void)
 {
 	unsigned n = storage_blocks();
-	unsigned i;
+	unsigned chunk = storage_erase_size();
+	uint8_t *buf = alloc_size(chunk * STORAGE_BLOCK_SIZE);
+	bool erased = 1;
+	unsigned i, j;
 
 	/*
 	 * @@@ We should tart at zero because also the presence of pad blocks
 	 * is sufficient to indicate that the Flash is initialized.
 	 */
-	for (i = RESERVED_BLOCKS; i != n; i++) {
-		enum block_type type = block_read(NULL, NULL, NULL, NULL, i);
-
-		if (type != bt_error && type != bt_erased)
-		    return 0;
+	for (i = RESERVED_BLOCKS; i < n && erased; i += chunk) {
+		unsigned n_blocks = n - i < chunk ? n - i : chunk;
+		bool ok = storage_read_blocks(buf, i, n_blocks);
+
+		for (j = 0; j != n_blocks; j++) {
+			enum block_type type = ok ?
+			    block_parse(NULL, NULL, NULL, NULL,
+			    buf + j * STORAGE_BLOCK_SIZE) :
+			    block_read(NULL, NULL, NULL, NULL, i + j);
+
+			if (type != bt_error && type != bt_erased) {
+				erased = 0;
+				break;
+			}
+		}
 	}
-	return 1;
+	free(buf);
+	return erased;
 }
 
 
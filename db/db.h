@@ -18,13 +18,18 @@
 #include <stdint.h>
 
 #include "hal.h"
+#include "timer.h"
 #include "storage.h"
+#include "arena.h"
 
 
 #define	MAX_NAME_LEN	16	/* maximum length of an entry name */
 #define	MAX_STRING_LEN	64	/* maximum length of user, email, pw */
 #define	MAX_SECRET_LEN	20	/* maximum bytes of HOTP/TOTP secret */
 
+#define	DB_GC_SECTORS	2	/* default number of erase blocks to keep
+				   erased */
+
 
 /*
  * Use of "packed":
@@ -60,6 +65,7 @@ enum __attribute__((__packed__)) field_type {
 struct db_field {
 	enum field_type type;
 	uint8_t		len;
+	uint8_t		room;	/* bytes of data stored after the field */
 	void		*data;
 	struct db_field	*next;
 };
@@ -72,6 +78,9 @@ struct db_entry {
 	uint16_t	seq;
 	unsigned	block;
 	bool		defer;	/* defer writing changes to storage */
+	bool		dirty;	/* changed in the current transaction */
+	bool		logged;	/* counter is in the counter log */
+	unsigned	order;	/* scratch space for sorting */
 	struct db_field	*fields;
 	struct db_entry	*next;
 };
@@ -87,7 +96,13 @@ struct db_stats {
 	unsigned	special;
 };
 
+struct db_gc_stats {
+	unsigned	foreground;	/* erases while allocating a block */
+	unsigned	background;	/* erases when idle */
+};
+
 struct db_span;
+struct db_scan;
 
 struct db {
 	const struct dbcrypt *c;
@@ -97,7 +112,27 @@ struct db {
 	struct db_span *deleted;
 	struct db_span *empty;
 	struct db_entry	*entries;
+	bool sorted;	/* entries are sorted and follow their "prev" */
+	unsigned transaction;	/* nesting depth of db_begin */
 	int settings_block;
+	int pack_block;		/* packed block new entries join, -1 if none */
+	int counter_block;	/* HOTP counter log, -1 if none */
+	unsigned summary_base;	/* first block of the summary area */
+	int summary_block;	/* current summary, -1 if none */
+	uint16_t summary_seq;
+	unsigned summary_log;	/* entries in the change log */
+	unsigned summary_first;	/* blocks logged last: first ... */
+	unsigned summary_end;	/* ... and one past the last */
+	unsigned scanned;	/* blocks read by db_open */
+	unsigned alloc_next;	/* where get_erased_block starts looking */
+	unsigned gc_sectors;	/* erase blocks to keep erased */
+	struct db_entry **index; /* entries by name */
+	unsigned index_size;	/* 0 or a power of two */
+	unsigned index_entries;
+	struct timer gc_timer;
+	struct db_gc_stats gc;
+	struct arena arena;	/* entries, names, and fields */
+	struct db_scan *scan;	/* non-NULL while opening */
 };
 
 
@@ -138,8 +173,43 @@ bool db_delete_field(struct db_entry *de, struct db_field *f);
 
 bool db_entry_defer_update(struct db_entry *de, bool defer);
 
+/*
+ * Changes between db_begin and db_commit are only made in memory. db_commit
+ * sorts the database once, and writes each changed entry once. Transactions
+ * can be nested; only the outermost db_commit writes.
+ *
+ * db_commit returns 0 if writing any of the entries failed.
+ */
+
+void db_begin(struct db *db);
+bool db_commit(struct db *db);
+
 struct db_entry *db_new_entry(struct db *db, const char *name);
 
+/*
+ * db_load_entry adds an entry after "after" (at the beginning if NULL), without
+ * sorting, and without writing it to storage. Changes to the entry are not
+ * written either. This lets tools/dbtool.c build large databases in memory, in
+ * the order of its input, and then write them all with db_pack.
+ */
+
+struct db_entry *db_load_entry(struct db *db, struct db_entry *after,
+    const char *name);
+
+/*
+ * db_pack rewrites all entries into as few blocks as possible. This converts
+ * databases that still have one entry per block. Dummy entries are not
+ * written, and entries too large for a packed block keep (or get) a block of
+ * their own. It returns the number of blocks written, or -1 if writing failed.
+ */
+
+int db_pack(struct db *db);
+
+/* db_find_entry returns the entry named "name" (not NUL-terminated), or NULL */
+
+struct db_entry *db_find_entry(const struct db *db, const char *name,
+    unsigned len);
+
 /*
  * Adjusts "prev" fields in the database such that entry "e" is sorted after
  * entry "after":
@@ -170,6 +240,33 @@ bool db_update_settings(struct db *db, uint16_t seq,
 
 void db_stats(const struct db *db, struct db_stats *s);
 
+/*
+ * db_io_stats returns the storage operations since power-up, or since the last
+ * db_io_reset.
+ */
+void db_io_stats(struct storage_io_stats *s);
+void db_io_reset(void);
+
+void db_gc_stats(const struct db *db, struct db_gc_stats *s);
+void db_mem_stats(const struct db *db, struct arena_stats *s);
+
+/*
+ * db_open_begin starts opening the database, and db_open_step scans at most
+ * "blocks" blocks that may contain data. db_open_step returns 1 once the whole
+ * database has been scanned. Until then, db_opening returns 1, the entries are
+ * those found so far, in alphabetical order, and all changes fail. The entries
+ * are sorted by "prev" only at the end, so the order does not depend on how
+ * the scan was split into steps. db_open_position returns the next block to
+ * scan, for showing progress.
+ */
+
+#define	DB_OPEN_STEP	16	/* blocks per step of db_open */
+
+void db_open_begin(struct db *db, const struct dbcrypt *c);
+bool db_open_step(struct db *db, unsigned blocks);
+bool db_opening(const struct db *db);
+unsigned db_open_position(const struct db *db);
+
 bool db_open_progress(struct db *db, const struct dbcrypt *c,
     void (*progress)(void *user, unsigned i, unsigned n), void *user);
 bool db_open(struct db *db, const struct dbcrypt *c);
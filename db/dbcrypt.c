@@ -14,12 +14,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#ifndef SDK
+#include <pthread.h>
+#endif
 
 #include "hal.h"
 #include "debug.h"
 #include "alloc.h"
 #include "rnd.h"
 #include "tweetnacl.h"
+#include "secretbox.h"
 #include "storage.h"
 #include "block.h"
 #include "dbcrypt.h"
@@ -33,6 +37,13 @@
 struct peer {
 	uint8_t k[crypto_box_BEFORENMBYTES];
 	uint8_t pk[crypto_box_PUBLICKEYBYTES];
+	/*
+	 * Layout of the last block from this writer we could decrypt: number
+	 * of readers (0 if we haven't decrypted any block yet), and our
+	 * position in the reader list.
+	 */
+	uint8_t hint_readers;
+	uint8_t hint_slot;
 	struct peer *next;
 };
 
@@ -45,12 +56,25 @@ struct dbcrypt {
 	 */
 	struct peer *readers;
 	/*
-	 * "cache" are writers of blocks we decrypt, but who are not in the		 * readers list.
+	 * "cache" are writers of blocks we decrypt, but who are not in the
+	 * readers list. The most recently used writer is at the beginning of
+	 * the list.
 	 */
 	struct peer *cache;
+	unsigned cached;	/* number of peers in "cache" */
+	struct dbcrypt_stats stats;
 };
 
 
+/*
+ * Maximum number of writers in the cache. Blocks are normally written by us or
+ * by one of our readers, so the cache only needs to hold the occasional
+ * foreign writer.
+ */
+
+#define	MAX_CACHED	8
+
+
 /*
  * Each block contains at least:
  * - the write's pubkey (Pw),
@@ -68,64 +92,238 @@ struct dbcrypt {
 			    crypto_secretbox_KEYBYTES)
 
 /*
- * MAX_MLEN is the maximum message length given to crypto_secretbox and
- * crypto_secretbox_open. It is the size of the maximum payload plus the
- * required padding.
+ * secretbox bytes addition to the encrypted payload
  */
 
-#define	MAX_MLEN	(STORAGE_BLOCK_SIZE + crypto_secretbox_ZEROBYTES - \
-			    BLOCK_OVERHEAD)
+#define	BOX_OVERHEAD	SECRETBOX_MACBYTES
 
 /*
- * secretbox bytes addition to the encrypted payload
+ * A box in the block is the authenticator, followed by the ciphertext. We seal
+ * the plaintext in place, in the block, and open boxes directly into the
+ * caller's buffer, so there are no intermediary buffers.
  */
 
-#define	BOX_OVERHEAD	(crypto_secretbox_ZEROBYTES -		\
-			    crypto_secretbox_BOXZEROBYTES)
+
+/* --- Record keys --------------------------------------------------------- */
 
 /*
- * NaCl's C API applies padding to its input and output buffers, so we can't
- * operate directly on block and plaintext buffers (which have no room for the
- * padding), but have to go through intermediary buffers.
- *
- * @@@ note: we keep these buffers in chip RAM for now. could they safely go to
- * pSRAM ?
+ * The record key is encrypted like the message of a secretbox, but without
+ * authenticator. That is, it is XORed with bytes 32 to 63 of the XSalsa20 key
+ * stream.
+ */
+
+static void key_xor(uint8_t *out, const uint8_t *in, const uint8_t *nonce,
+    const uint8_t *k)
+{
+	uint8_t ks[crypto_secretbox_ZEROBYTES + crypto_secretbox_KEYBYTES];
+	unsigned i;
+
+	t0();
+	if (crypto_stream(ks, sizeof(ks), nonce, k))
+		DIE("crypto_stream failed");
+	t1("key_xor:crypto_stream\n");
+
+	for (i = 0; i != crypto_secretbox_KEYBYTES; i++)
+		out[i] = in[i] ^ ks[crypto_secretbox_ZEROBYTES + i];
+	memset(ks, 0, sizeof(ks));
+}
+
+
+/* --- Locking ------------------------------------------------------------- */
+
+/*
+ * On the host, several threads can decrypt blocks at the same time (see
+ * block_parse_chunk). They share the cache of writers, the layout hints, and
+ * the statistics of the dbcrypt context, so we protect them with a lock.
+ */
+
+#ifdef SDK
+
+static void lock(void)
+{
+}
+
+
+static void unlock(void)
+{
+}
+
+#else /* SDK */
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void lock(void)
+{
+	pthread_mutex_lock(&mutex);
+}
+
+
+static void unlock(void)
+{
+	pthread_mutex_unlock(&mutex);
+}
+
+#endif /* !SDK */
+
+
+/* --- Slots --------------------------------------------------------------- */
+
+/*
+ * In a slotted block, the space after the reader list holds slots of
+ * DB_SLOT_SIZE bytes, each in a box of its own. The nonce of slot i is the
+ * nonce of the block with the second byte XORed with i + 1. (The nonces of the
+ * record keys change the first byte.) This way, each box under the record key
+ * has a different nonce.
+ */
+
+#define	SLOT_BYTES	(DB_SLOT_SIZE + BOX_OVERHEAD)
+
+
+static unsigned slots(const void *block, const uint8_t *encrypted)
+{
+	return (block + STORAGE_BLOCK_SIZE - (const void *) encrypted) /
+	    SLOT_BYTES;
+}
+
+
+static void slot_nonce(uint8_t *nonce2, const void *block, unsigned slot)
+{
+	memcpy(nonce2, block + crypto_box_PUBLICKEYBYTES,
+	    crypto_secretbox_NONCEBYTES);
+	nonce2[1] ^= slot + 1;
+}
+
+
+static bool slot_unused(const uint8_t *p)
+{
+	unsigned i;
+
+	for (i = 0; i != SLOT_BYTES; i++)
+		if (p[i] != 0xff)
+			return 0;
+	return 1;
+}
+
+
+/*
+ * encrypt_slot stores "head" (of "head_len" bytes), followed by "content", in
+ * the slot, and encrypts the slot in place.
+ */
+
+static void encrypt_slot(const void *block, uint8_t *encrypted,
+    unsigned slot, const void *head, unsigned head_len, const void *content,
+    unsigned length, const uint8_t *rk)
+{
+	uint8_t *p = encrypted + slot * SLOT_BYTES;
+	uint8_t *m = p + BOX_OVERHEAD;
+	uint8_t nonce2[crypto_secretbox_NONCEBYTES];
+
+	assert(head_len + length <= DB_SLOT_SIZE);
+	if (head_len)
+		memcpy(m, head, head_len);
+	if (length)
+		memcpy(m + head_len, content, length);
+	memset(m + head_len + length, 0, DB_SLOT_SIZE - head_len - length);
+	slot_nonce(nonce2, block, slot);
+
+	t0();
+	secretbox_seal(m, p, m, DB_SLOT_SIZE, nonce2, rk);
+	t1("db_encrypt:secretbox_seal(slot)\n");
+}
+
+
+/* decrypt_slot stores the content in "content", unless it is NULL */
+
+static bool decrypt_slot(void *content, const void *block,
+    const uint8_t *encrypted, unsigned slot, const uint8_t *rk)
+{
+	const uint8_t *p = encrypted + slot * SLOT_BYTES;
+	uint8_t nonce2[crypto_secretbox_NONCEBYTES];
+	bool ok;
+
+	slot_nonce(nonce2, block, slot);
+
+	t0();
+	ok = secretbox_open(content, p, p + BOX_OVERHEAD, DB_SLOT_SIZE, nonce2,
+	    rk);
+	t1("db_decrypt:secretbox_open(slot)\n");
+
+	return ok;
+}
+
+
+/*
+ * decrypt_slots returns the content of all the slots, or -1 if slot 0 can't be
+ * decrypted. Slots that are unused, or that we can't decrypt, read as zero.
  */
 
-static uint8_t in_buf[STORAGE_BLOCK_SIZE + crypto_secretbox_ZEROBYTES];
-static uint8_t out_buf[STORAGE_BLOCK_SIZE + crypto_secretbox_ZEROBYTES];
+static int decrypt_slots(void *content, unsigned size, const void *block,
+    const uint8_t *encrypted, const uint8_t *rk)
+{
+	unsigned n = slots(block, encrypted);
+	unsigned i;
+
+	if (!decrypt_slot(content, block, encrypted, 0, rk))
+		return -1;
+	if (!content)
+		return DB_SLOT_SIZE;
+	assert(n * DB_SLOT_SIZE <= size);
+	for (i = 1; i != n; i++)
+		if (!decrypt_slot(content + i * DB_SLOT_SIZE, block, encrypted,
+		    i, rk))
+			memset(content + i * DB_SLOT_SIZE, 0, DB_SLOT_SIZE);
+	return n * DB_SLOT_SIZE;
+}
 
 
 /* --- Encrypt ------------------------------------------------------------- */
 
 
+/*
+ * db_encrypt_payload stores "head" and "content" after the room for the
+ * authenticator, zero-pads them to the end of the block, and encrypts them in
+ * place.
+ */
+
 static void db_encrypt_payload(void *block, uint8_t *encrypted,
-    const void *content, unsigned length, const uint8_t *rk)
+    const void *head, unsigned head_len, const void *content, unsigned length,
+    const uint8_t *rk)
 {
 	const uint8_t *block_end = block + STORAGE_BLOCK_SIZE;
 	uint8_t *nonce = block + crypto_box_PUBLICKEYBYTES;
-	unsigned encrypted_bytes = block_end - encrypted;
-	unsigned mlen = crypto_secretbox_ZEROBYTES - BOX_OVERHEAD +
-	    encrypted_bytes;
+	uint8_t *m = encrypted + BOX_OVERHEAD;
+	unsigned mlen = block_end - m;
 
-	assert(mlen <= sizeof(in_buf));
-	assert(mlen <= sizeof(out_buf));
-	memset(in_buf, 0, sizeof(in_buf));
-	memcpy(in_buf + crypto_secretbox_ZEROBYTES, content, length);
+	assert(head_len + length <= mlen);
+	if (head_len)
+		memcpy(m, head, head_len);
+	if (length)
+		memcpy(m + head_len, content, length);
+	memset(m + head_len + length, 0, mlen - head_len - length);
 
 	t0();
-	if (crypto_secretbox(out_buf, in_buf, mlen, nonce, rk))
-		DIE("crypto_secretbox failed");
-	t1("db_encrypt:crypto_secretbox\n");
+	secretbox_seal(m, encrypted, m, mlen, nonce, rk);
+	t1("db_encrypt:secretbox_seal\n");
+}
+
 
-	memcpy(encrypted, out_buf + crypto_secretbox_BOXZEROBYTES,
-	    mlen - crypto_secretbox_BOXZEROBYTES);
-	assert(encrypted + mlen - crypto_secretbox_BOXZEROBYTES == block_end);
+unsigned db_capacity(const struct dbcrypt *c)
+{
+	const struct peer *reader;
+	unsigned n_readers = 0;
+
+	for (reader = c->readers; reader; reader = reader->next)
+		n_readers++;
+	return STORAGE_BLOCK_SIZE - crypto_box_PUBLICKEYBYTES -
+	    crypto_secretbox_NONCEBYTES -
+	    n_readers * crypto_secretbox_KEYBYTES - BOX_OVERHEAD;
 }
 
 
-bool db_encrypt(const struct dbcrypt *c, void *block, const void *content,
-    unsigned length)
+static bool encrypt_block(const struct dbcrypt *c, void *block,
+    const void *head, unsigned head_len, const void *content, unsigned length,
+    bool slotted)
 {
 	/* --- block layout --- */
 
@@ -145,7 +343,7 @@ bool db_encrypt(const struct dbcrypt *c, void *block, const void *content,
 	unsigned encrypted_bytes = block_end - encrypted;
 
 	assert(encrypted + BOX_OVERHEAD <= block_end);
-	assert(encrypted_bytes >= length + BOX_OVERHEAD);
+	assert(encrypted_bytes >= head_len + length + BOX_OVERHEAD);
 
 	/* --- generate nonce and record key --- */
 
@@ -156,7 +354,14 @@ bool db_encrypt(const struct dbcrypt *c, void *block, const void *content,
 
 	/* --- encrypt --- */
 
-	db_encrypt_payload(block, encrypted, content, length, rk);
+	if (slotted) {
+		memset(encrypted, 0xff, encrypted_bytes);
+		encrypt_slot(block, encrypted, 0, head, head_len, content,
+		    length, rk);
+	} else {
+		db_encrypt_payload(block, encrypted, head, head_len, content,
+		    length, rk);
+	}
 
 	/* --- populate the rest of the block --- */
 
@@ -167,22 +372,10 @@ bool db_encrypt(const struct dbcrypt *c, void *block, const void *content,
 	uint8_t i = 0;
 
 	for (reader = c->readers; reader; reader = reader->next) {
-		memset(in_buf, 0, crypto_secretbox_ZEROBYTES);
-		memcpy(in_buf + crypto_secretbox_ZEROBYTES, rk,
-		    crypto_secretbox_KEYBYTES);
 		memcpy(nonce2, nonce, crypto_secretbox_NONCEBYTES);
 		i++;
 		nonce2[0] ^= i;
-
-		t0();
-		if (crypto_stream_xor(out_buf, in_buf,
-		    crypto_secretbox_ZEROBYTES + crypto_secretbox_KEYBYTES,
-		    nonce2, reader->k))
-			DIE("crypto_stream_xor failed");
-		t1("db_encrypt:crypto_stream_xor\n");
-
-		memcpy(b, out_buf + crypto_secretbox_ZEROBYTES,
-		    crypto_secretbox_KEYBYTES);
+		key_xor(b, rk, nonce2, reader->k);
 		b += crypto_secretbox_KEYBYTES;
 	}
 	assert(b == encrypted);
@@ -190,63 +383,117 @@ bool db_encrypt(const struct dbcrypt *c, void *block, const void *content,
 	/* --- clean up --- */
 
 	memset(rk, 0, sizeof(rk));
-	memset(in_buf, 0, sizeof(in_buf));
-	memset(out_buf, 0, sizeof(out_buf));
 
 	return 1;
 }
 
 
-/* --- Decrypt ------------------------------------------------------------- */
+bool db_encrypt(const struct dbcrypt *c, void *block, const void *head,
+    unsigned head_len, const void *content, unsigned length)
+{
+	return encrypt_block(c, block, head, head_len, content, length, 0);
+}
 
 
-static int db_decrypt_payload(void *content, unsigned size, const void *block,
-    const uint8_t *encrypted, const uint8_t *rk)
+bool db_encrypt_slotted(const struct dbcrypt *c, void *block,
+    const void *head, unsigned head_len, const void *content, unsigned length)
 {
-	int length = -1; /* -1 means that we could not decrypt the block */
-	const uint8_t *block_end = block + STORAGE_BLOCK_SIZE;
-	const uint8_t *nonce = block + crypto_box_PUBLICKEYBYTES;
-	unsigned encrypted_bytes = block_end - encrypted;
+	return encrypt_block(c, block, head, head_len, content, length, 1);
+}
 
-	/* --- decrypt the payload --- */
 
-	unsigned mlen = crypto_secretbox_BOXZEROBYTES + encrypted_bytes;
+/* --- Shared public-key encryption secrets ------------------------------- */
+
+
+/*
+ * find_writer returns the peer with Shared(Sr, Pw), looking for it first in the
+ * reader list, then in the cache, and only calculating the shared secret if
+ * neither has it.
+ */
+
+static struct peer *find_writer(struct dbcrypt *c, const uint8_t *wpk)
+{
+	struct peer *p, **anchor;
+
+	for (p = c->readers; p; p = p->next)
+		if (!memcmp(p->pk, wpk, crypto_box_PUBLICKEYBYTES)) {
+			c->stats.shared_hit++;
+			return p;
+		}
+	for (anchor = &c->cache; *anchor; anchor = &(*anchor)->next)
+		if (!memcmp((*anchor)->pk, wpk, crypto_box_PUBLICKEYBYTES)) {
+			p = *anchor;
+			*anchor = p->next;
+			p->next = c->cache;
+			c->cache = p;
+			c->stats.shared_hit++;
+			return p;
+		}
 
-	assert(mlen <= sizeof(in_buf));
-	assert(mlen <= sizeof(out_buf));
-	memset(in_buf, 0, crypto_secretbox_BOXZEROBYTES);
-	memcpy(in_buf + crypto_secretbox_BOXZEROBYTES, encrypted,
-	    encrypted_bytes);
+	c->stats.shared_miss++;
+	if (c->cached < MAX_CACHED) {
+		p = alloc_type(struct peer);
+		c->cached++;
+	} else {
+		/* reuse the least recently used peer */
+		for (anchor = &c->cache; (*anchor)->next;
+		    anchor = &(*anchor)->next);
+		p = *anchor;
+		*anchor = NULL;
+	}
 
 	t0();
-	if (crypto_secretbox_open(out_buf, in_buf, mlen, nonce, rk)) {
-		debug("crypto_secretbox failed\n");
-		goto cleanup;
+	if (crypto_box_beforenm(p->k, wpk, c->sk)) {
+		debug("crypto_box_beforenm failed\n");
+		memset(p, 0, sizeof(*p));
+		free(p);
+		c->cached--;
+		return NULL;
 	}
-	t1("db_decrypt:crypto_secretbox_open\n");
+	t1("db_decrypt:crypto_box_beforenm\n");
+	memcpy(p->pk, wpk, crypto_box_PUBLICKEYBYTES);
+	p->hint_readers = 0;
+	p->next = c->cache;
+	c->cache = p;
+	return p;
+}
 
-	/* --- extract the payload --- */
 
-	length = mlen - crypto_secretbox_ZEROBYTES;
-	assert(mlen >= crypto_secretbox_ZEROBYTES);
-	assert((unsigned) length <= size);
-	memcpy(content, out_buf + crypto_secretbox_ZEROBYTES, length);
+/* --- Decrypt ------------------------------------------------------------- */
 
-	/* --- clean up --- */
 
-cleanup:
-	memset(in_buf, 0, sizeof(in_buf));
-	memset(out_buf, 0, sizeof(out_buf));
+static int db_decrypt_payload(void *content, unsigned size, const void *block,
+    const uint8_t *encrypted, const uint8_t *rk)
+{
+	const uint8_t *block_end = block + STORAGE_BLOCK_SIZE;
+	const uint8_t *nonce = block + crypto_box_PUBLICKEYBYTES;
+	unsigned length = block_end - encrypted - BOX_OVERHEAD;
+
+	assert(!content || length <= size);
+
+	t0();
+	if (!secretbox_open(content, encrypted, encrypted + BOX_OVERHEAD,
+	    length, nonce, rk)) {
+		debug("secretbox_open failed\n");
+		return -1;
+	}
+	t1("db_decrypt:secretbox_open\n");
 
 	return length;
 }
 
 
+/*
+ * db_try_decrypt decrypts the block with a single box, or, if "slotted", as a
+ * slotted block. If "rk_out" is not NULL and decrypting succeeded, it returns
+ * the record key there.
+ */
+
 static int db_try_decrypt(void *content, unsigned size, const void *block,
     const uint8_t *encrypted, unsigned i, const uint8_t *ek,
-    const uint8_t *shared)
+    const uint8_t *shared, bool slotted, uint8_t *rk_out)
 {
-	int length = -1; /* means that we could not decrypt the block */
+	int length;
 	const uint8_t *nonce = block + crypto_box_PUBLICKEYBYTES;
 	uint8_t rk[crypto_box_PUBLICKEYBYTES];
 	uint8_t nonce2[crypto_secretbox_NONCEBYTES];
@@ -255,40 +502,63 @@ static int db_try_decrypt(void *content, unsigned size, const void *block,
 
 	memcpy(nonce2, nonce, crypto_secretbox_NONCEBYTES);
 	nonce2[0] ^= i + 1;
-	memset(in_buf, 0, crypto_secretbox_ZEROBYTES);
-	memcpy(in_buf + crypto_secretbox_ZEROBYTES, ek,
-	    crypto_secretbox_KEYBYTES);
-
-	t0();
-	if (crypto_stream_xor(out_buf, in_buf,
-	    crypto_secretbox_ZEROBYTES + crypto_secretbox_KEYBYTES, nonce2,
-	    shared)) {
-		debug("crypto_stream_xor failed\b");
-		goto cleanup;
-	}
-	t1("db_decrypt:crypto_stream_xor\n");
-
-	memcpy(rk, out_buf + crypto_secretbox_ZEROBYTES,
-	    crypto_secretbox_KEYBYTES);
+	key_xor(rk, ek, nonce2, shared);
 
 	/* --- decrypt the payload --- */
 
-	length = db_decrypt_payload(content, size, block, encrypted, rk);
+	if (slotted)
+		length = decrypt_slots(content, size, block, encrypted, rk);
+	else
+		length = db_decrypt_payload(content, size, block, encrypted,
+		    rk);
+	if (length >= 0 && rk_out)
+		memcpy(rk_out, rk, crypto_secretbox_KEYBYTES);
 
 	/* --- clean up --- */
 
-cleanup:
 	memset(rk, 0, sizeof(rk));
 
 	return length;
 }
 
 
-int db_decrypt(const struct dbcrypt *c, void *content, unsigned size,
-    const void *block)
+/*
+ * db_try_layout tries to decrypt the block assuming that it has "n_readers"
+ * readers and that our record key is at position "i". "shared" is the shared
+ * secret with the writer.
+ */
+
+static int db_try_layout(struct dbcrypt *c, void *content, unsigned size,
+    const void *block, unsigned n_readers, unsigned i, const uint8_t *shared,
+    bool slotted, uint8_t *rk_out, const uint8_t **encrypted_out)
 {
-	int length = -1; /* means that we could not decrypt the block */
+	const uint8_t *reader_list = block + crypto_box_PUBLICKEYBYTES +
+	    crypto_secretbox_NONCEBYTES;
+	const uint8_t *encrypted =
+	    reader_list + n_readers * crypto_secretbox_KEYBYTES;
+
+	lock();
+	c->stats.trials++;
+	unlock();
+	if (encrypted_out)
+		*encrypted_out = encrypted;
+	return db_try_decrypt(content, size, block, encrypted, i,
+	    reader_list + i * crypto_secretbox_KEYBYTES, shared, slotted,
+	    rk_out);
+}
+
+
+/*
+ * try_layouts tries the layout of the last block from writer "w" first, then
+ * all possible layouts and record keys. "k" and the hint are copies taken from
+ * "w".
+ */
 
+static int try_layouts(struct dbcrypt *c, struct peer *w, void *content,
+    unsigned size, const void *block, const uint8_t *k, unsigned hint_readers,
+    unsigned hint_slot, bool slotted, uint8_t *rk_out,
+    const uint8_t **encrypted_out)
+{
 	/* --- block layout --- */
 
 	const uint8_t *block_end = block + STORAGE_BLOCK_SIZE;
@@ -296,17 +566,20 @@ int db_decrypt(const struct dbcrypt *c, void *content, unsigned size,
 	const uint8_t *nonce = wpk + crypto_box_PUBLICKEYBYTES;
 	const uint8_t *reader_list = nonce + crypto_secretbox_NONCEBYTES;
 	unsigned n_readers;
+	int length;
 
-	/* --- shared public-key encryption secret --- */
-
-	uint8_t shared[crypto_secretbox_KEYBYTES];
+	/* --- try the layout of the last block from this writer --- */
 
-	t0();
-	if (crypto_box_beforenm(shared, wpk, c->sk)) {
-		debug("crypto_box_beforenm failed\n");
-		return -1;
+	/*
+	 * A writer normally uses the same reader list for all its blocks, so
+	 * this usually succeeds on the first attempt.
+	 */
+	if (hint_readers) {
+		length = db_try_layout(c, content, size, block,
+		    hint_readers, hint_slot, k, slotted, rk_out, encrypted_out);
+		if (length != -1)
+			return length;
 	}
-	t1("db_decrypt:crypto_box_beforenm\n");
 
 	/* --- try all possible layouts and record keys --- */
 
@@ -328,38 +601,136 @@ int db_decrypt(const struct dbcrypt *c, void *content, unsigned size,
 
 		/* --- find a suitable encrypted key --- */
 
-		const uint8_t *b = reader_list;
 		unsigned i;
 
 		for (i = 0; i != n_readers; i++) {
-			/* @@@ should first search the reader list and the
-			   cache of share public-key encryption secrets  */
 			/* @@@ cache decrypted record keys ? */
 
+			if (n_readers == hint_readers && i == hint_slot)
+				continue;
+
 			/* --- decrypt the payload --- */
 
-			length = db_try_decrypt(content,size, block, encrypted,
-			    i, b, shared);
+			length = db_try_layout(c, content, size, block,
+			    n_readers, i, k, slotted, rk_out, encrypted_out);
 
 			if (length != -1) {
 				debug("db_decrypt: found at %u / %u\n",
 				    i, n_readers);
-				goto done;
+				lock();
+				if (!memcmp(w->pk, wpk,
+				    crypto_box_PUBLICKEYBYTES)) {
+					w->hint_readers = n_readers;
+					w->hint_slot = i;
+				}
+				unlock();
+				return length;
 			}
-
-			b += crypto_secretbox_KEYBYTES;
 		}
 	}
+	return -1;
+}
 
-	/* --- clean up --- */
 
-done:
-	memset(shared, 0, sizeof(shared));
+/*
+ * decrypt_block is db_decrypt, but can also return the record key and where
+ * the encrypted data begins. "content" can be NULL.
+ */
+
+static int decrypt_block(const struct dbcrypt *c, void *content,
+    unsigned size, const void *block, uint8_t *rk_out,
+    const uint8_t **encrypted_out)
+{
+	int length; /* -1 means that we could not decrypt the block */
+
+	/*
+	 * The cache of shared secrets and the layout hints don't change what
+	 * the dbcrypt context decrypts, so we treat them as mutable also when
+	 * the context is const.
+	 */
+	struct dbcrypt *cc = (struct dbcrypt *) c;
+	const uint8_t *wpk = block;	/* writer's pubkey */
+
+	/* --- shared public-key encryption secret --- */
+
+	/*
+	 * We work on a copy of the secret and the hint, since another thread
+	 * may reuse the peer for a different writer while we decrypt.
+	 */
+	uint8_t k[crypto_box_BEFORENMBYTES];
+	unsigned hint_readers = 0, hint_slot = 0;
+	struct peer *w;
+
+	lock();
+	w = find_writer(cc, wpk);
+	if (w) {
+		memcpy(k, w->k, sizeof(k));
+		hint_readers = w->hint_readers;
+		hint_slot = w->hint_slot;
+	}
+	unlock();
+	if (!w)
+		return -1;
+
+	/*
+	 * Only counter logs are slotted, so we try the slotted format only
+	 * after the block failed to decrypt with all layouts, instead of after
+	 * each wrong layout.
+	 */
+	length = try_layouts(cc, w, content, size, block, k, hint_readers,
+	    hint_slot, 0, rk_out, encrypted_out);
+	if (length == -1)
+		length = try_layouts(cc, w, content, size, block, k,
+		    hint_readers, hint_slot, 1, rk_out, encrypted_out);
 
+	memset(k, 0, sizeof(k));
 	return length;
 }
 
 
+int db_decrypt(const struct dbcrypt *c, void *content, unsigned size,
+    const void *block)
+{
+	return decrypt_block(c, content, size, block, NULL, NULL);
+}
+
+
+/* --- Add to slotted blocks ----------------------------------------------- */
+
+
+int db_encrypt_slot(const struct dbcrypt *c, void *block, const void *content,
+    unsigned length)
+{
+	uint8_t rk[crypto_secretbox_KEYBYTES];
+	const uint8_t *encrypted;
+	uint8_t *p;
+	unsigned n, slot;
+
+	if (decrypt_block(c, NULL, 0, block, rk, &encrypted) < 0)
+		return -1;
+
+	/* the new slot goes after the last one in use */
+	n = slots(block, encrypted);
+	for (slot = n; slot; slot--)
+		if (!slot_unused(encrypted + (slot - 1) * SLOT_BYTES))
+			break;
+	if (!slot || slot == n) {
+		memset(rk, 0, sizeof(rk));
+		return -1;
+	}
+
+	p = (uint8_t *) encrypted;
+	encrypt_slot(block, p, slot, NULL, 0, content, length, rk);
+	memset(rk, 0, sizeof(rk));
+
+	/* we only program the new slot */
+	memset(block, 0xff, p + slot * SLOT_BYTES - (uint8_t *) block);
+	p += (slot + 1) * SLOT_BYTES;
+	memset(p, 0xff, (uint8_t *) block + STORAGE_BLOCK_SIZE - p);
+	return slot;
+}
+
+
 /* --- Retrieve the public key --------------------------------------------- */
 
 
@@ -369,6 +740,15 @@ const void *dbcrypt_pubkey(const struct dbcrypt *c)
 }
 
 
+/* --- Statistics ---------------------------------------------------------- */
+
+
+void dbcrypt_stats(const struct dbcrypt *c, struct dbcrypt_stats *s)
+{
+	*s = c->stats;
+}
+
+
 /* --- Manage the dbcrypt context ------------------------------------------ */
 
 
@@ -384,16 +764,15 @@ struct dbcrypt *dbcrypt_init(const void *sk, unsigned bytes)
 	t0();
 	if (crypto_scalarmult_base(c->pk, sk))
 		DIE("crypto_scalarmult_base failed");
-	t1("dbcrypt_init:crypto_scalarmult_base(1)\n");
+	t1("dbcrypt_init:crypto_scalarmult_base\n");
 
 	p = alloc_type(struct peer);
 	c->readers = p;
+	p->hint_readers = 0;
 	p->next = NULL;
 
-	t0();
-	if (crypto_scalarmult_base(p->pk, sk))
-		DIE("crypto_scalarmult_base failed");
-	t1("dbcrypt_init:crypto_scalarmult_base(2)\n");
+	/* we are our first reader */
+	memcpy(p->pk, c->pk, crypto_box_PUBLICKEYBYTES);
 
 	t0();
 	if (crypto_box_beforenm(p->k, p->pk, sk))
@@ -401,6 +780,8 @@ struct dbcrypt *dbcrypt_init(const void *sk, unsigned bytes)
 	t1("dbcrypt_init:crypto_box_beforenm\n");
 
 	c->cache = NULL;
+	c->cached = 0;
+	memset(&c->stats, 0, sizeof(c->stats));
 	return c;
 }
 
@@ -417,6 +798,7 @@ void dbcrypt_add_reader(struct dbcrypt *c, const void *pk, unsigned bytes)
 	*anchor = p;
 	p->next = NULL;
 	memcpy(p->pk, pk, crypto_box_PUBLICKEYBYTES);
+	p->hint_readers = 0;
 
 	t0();
 	if (crypto_box_beforenm(p->k, p->pk, c->sk))
@@ -431,6 +813,7 @@ static void free_peers(struct peer *p)
 		struct peer *next = p->next;
 
 		memset(p, 0, sizeof(*p));
+		free(p);
 		p = next;
 	}
 }
@@ -15,6 +15,14 @@ struct dbcrypt;
 
 #define	DB_NONCE_SIZE	24
 #define	DB_MAX_READERS	12
+#define	DB_SLOT_SIZE	32	/* content bytes per slot */
+
+
+struct dbcrypt_stats {
+	unsigned	shared_hit;	/* shared secret was known */
+	unsigned	shared_miss;	/* shared secret had to be calculated */
+	unsigned	trials;		/* attempts to decrypt a block */
+};
 
 
 const void *dbcrypt_pubkey(const struct dbcrypt *c);
@@ -23,15 +31,46 @@ const void *dbcrypt_pubkey(const struct dbcrypt *c);
  * "Content" is all the encrypted data, including status, payload, hash, and
  * reserved bytes.
  *
- * db_encrypt returns 1 if the encryption was successful, 0 otherwise.
- * db_decrypt returns -1 if decrypting failed, the length of the decrypted
- * content otherwise.
+ * db_encrypt encrypts "head" (of "head_len" bytes), followed by "content", and
+ * stores the result in "block". The plaintext is assembled directly in
+ * "block", and encrypted there, so the caller does not need to prepend the
+ * head in a buffer of its own. db_encrypt returns 1 if the encryption was
+ * successful, 0 otherwise.
+ *
+ * db_decrypt decrypts directly into "content", which has room for "size"
+ * bytes. The content includes the head, and the zero padding up to the end
+ * of the block. db_decrypt returns -1 if decrypting failed, the length of the
+ * decrypted content otherwise. "content" is only written to if decrypting
+ * succeeds. If "content" is NULL, db_decrypt only checks that the block can
+ * be decrypted.
+ *
+ * db_capacity returns the maximum length of the content db_encrypt can store
+ * in a block.
+ *
+ * Slotted blocks can be added to without rewriting them. Each slot is
+ * encrypted separately, and holds DB_SLOT_SIZE bytes of content. The other
+ * slots stay all-ones until they are used. db_encrypt_slotted puts "head" and
+ * "content" into slot 0, and leaves the other slots unused. db_encrypt_slot
+ * takes a slotted block read from storage, and turns it into what has to be
+ * programmed to add "content" in the next slot, i.e., all-ones except for the
+ * new slot.
+ * It returns the slot number, or -1 if the block is full or can't be
+ * decrypted. db_decrypt returns the content of all the slots of a slotted
+ * block, with unused slots set to zero.
  */
 
-bool db_encrypt(const struct dbcrypt *c, void *block, const void *content,
-    unsigned length);
+bool db_encrypt(const struct dbcrypt *c, void *block, const void *head,
+    unsigned head_len, const void *content, unsigned length);
 int db_decrypt(const struct dbcrypt *c, void *content, unsigned size,
     const void *block);
+unsigned db_capacity(const struct dbcrypt *c);
+
+bool db_encrypt_slotted(const struct dbcrypt *c, void *block,
+    const void *head, unsigned head_len, const void *content, unsigned length);
+int db_encrypt_slot(const struct dbcrypt *c, void *block, const void *content,
+    unsigned length);
+
+void dbcrypt_stats(const struct dbcrypt *c, struct dbcrypt_stats *s);
 
 struct dbcrypt *dbcrypt_init(const void *sk, unsigned size);
 void dbcrypt_add_reader(struct dbcrypt *c, const void *pk, unsigned size);
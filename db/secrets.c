@@ -374,7 +374,7 @@ bool secrets_setup_master(uint32_t pin)
 }
 
 
-bool secrets_new(uint32_t pin)
+bool secrets_store(uint32_t pin)
 {
 	/* block layout */
 
@@ -391,13 +391,8 @@ bool secrets_new(uint32_t pin)
 		if (!storage_erase_blocks(n, storage_erase_size()))
 			debug("could not erase %u\n", n);
 
-	/*
-	 * @@@ For later: optionally generate existing master secret from
-	 * BIP-0039 mnemonic sentence.
-	 */
 	memset(io_buf, 0xff, STORAGE_BLOCK_SIZE);
 	*seq = 0;
-	rnd_bytes(master_secret, MASTER_SECRET_BYTES);
 	master_hash(master_pattern, pin);
 	for (i = 0; i != MASTER_SECRET_BYTES; i++)
 		pad[i] = master_pattern[i] ^ master_secret[i];
@@ -416,6 +411,17 @@ bool secrets_new(uint32_t pin)
 }
 
 
+bool secrets_new(uint32_t pin)
+{
+	/*
+	 * @@@ For later: optionally generate existing master secret from
+	 * BIP-0039 mnemonic sentence.
+	 */
+	rnd_bytes(master_secret, MASTER_SECRET_BYTES);
+	return secrets_store(pin);
+}
+
+
 void secrets_test_pad(void)
 {
 	uint8_t res[MASTER_SECRET_BYTES];
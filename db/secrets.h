@@ -24,6 +24,13 @@ bool secrets_setup(uint8_t *secret, int *pad_block, uint32_t pin);
 bool secrets_setup_master(uint32_t pin);
 bool secrets_new(uint32_t pin);
 
+/*
+ * secrets_store erases all the pads, and writes a new one that yields the
+ * current master secret with "pin". secrets_new does the same for a new, random
+ * master secret.
+ */
+bool secrets_store(uint32_t pin);
+
 void secrets_test_pad(void);
 
 bool secrets_init(void);
@@ -1,128 +1,224 @@
 /*
- * span.c - Lists of spans (consecutive blocks)
+ * span.c - Sets of blocks
  *
  * This work is licensed under the terms of the MIT License.
  * A copy of the license can be found in the file LICENSE.MIT
  */
 
+/*
+ * A set has one bit per block. Two summary bitmaps have one bit per word of
+ * the block map:
+ * - "used" is set if the word has any bit set,
+ * - "full" is set if the word contains a complete erase block.
+ * Finding the next block or erase block thus only looks at a few words, even
+ * if the set is sparse.
+ *
+ * Erase blocks must not cross word boundaries, i.e., the erase size must be a
+ * power of two and not larger than 32 blocks.
+ */
+
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
 
 #include "alloc.h"
+#include "storage.h"
 #include "span.h"
 
 
+#define	WORD_BITS	32
+
+
 struct db_span {
-	unsigned start;
-	unsigned len;
-	struct db_span *next;
+	unsigned words;		/* words in "map" */
+	unsigned erase_size;
+	uint32_t group_starts;	/* first bit of each erase block in a word */
+	uint32_t *map;
+	uint32_t *used;
+	uint32_t *full;
 };
 
 
-void span_add(struct db_span **spans, unsigned n, unsigned size)
+static unsigned summary_words(unsigned words)
 {
-	struct db_span *this;
-
-	while (*spans) {
-		this = *spans;
-		if (this->start + this->len == n) {
-			struct db_span *next = this->next;
-
-			this->len += size;
-			if (!next)
-				return;
-			if (next->start != this->start + this->len)
-				return;
-			this->len += next->len;
-			this->next = next->next;
-			free(next);
-			return;
-		}
-		if (this->start == n + size) {
-			this->start -= size;
-			this->len += size;
-			break;
+	return (words + WORD_BITS - 1) / WORD_BITS;
+}
+
+
+static struct db_span *span_new(void)
+{
+	unsigned blocks = storage_blocks();
+	struct db_span *s;
+	unsigned sum, i;
+
+	s = alloc_type(struct db_span);
+	s->words = (blocks + WORD_BITS - 1) / WORD_BITS;
+	s->erase_size = storage_erase_size();
+	assert(s->erase_size <= WORD_BITS);
+	assert(!(WORD_BITS % s->erase_size));
+	s->group_starts = 0;
+	for (i = 0; i != WORD_BITS; i += s->erase_size)
+		s->group_starts |= 1U << i;
+
+	sum = summary_words(s->words);
+	s->map = alloc_type_n(uint32_t, s->words + 2 * sum);
+	s->used = s->map + s->words;
+	s->full = s->used + sum;
+	memset(s->map, 0, (s->words + 2 * sum) * sizeof(uint32_t));
+	return s;
+}
+
+
+/* --- Bit operations ------------------------------------------------------ */
+
+
+/*
+ * groups returns the first bit of each erase block in "w" whose bits are all
+ * set.
+ */
+
+static uint32_t groups(const struct db_span *s, uint32_t w)
+{
+	uint32_t m = w;
+	unsigned i;
+
+	for (i = 1; i != s->erase_size; i++)
+		m &= w >> i;
+	return m & s->group_starts;
+}
+
+
+static void set_bit(uint32_t *map, unsigned n, bool on)
+{
+	if (on)
+		map[n / WORD_BITS] |= 1U << (n % WORD_BITS);
+	else
+		map[n / WORD_BITS] &= ~(1U << (n % WORD_BITS));
+}
+
+
+static void update_word(struct db_span *s, unsigned w)
+{
+	set_bit(s->used, w, s->map[w]);
+	set_bit(s->full, w, groups(s, s->map[w]));
+}
+
+
+static void change_range(struct db_span *s, unsigned n, unsigned size,
+    bool on)
+{
+	unsigned last = ~0U;
+
+	while (size--) {
+		set_bit(s->map, n, on);
+		if (n / WORD_BITS != last) {
+			if (last != ~0U)
+				update_word(s, last);
+			last = n / WORD_BITS;
 		}
-		spans = &(*spans)->next;
+		n++;
 	}
-	*spans = this = alloc_type(struct db_span);
-	this->start = n;
-	this->len = size;
-	this->next = NULL;
+	if (last != ~0U)
+		update_word(s, last);
 }
 
 
-int span_pull_one(struct db_span **spans)
+/*
+ * next_word returns the index of the first word at or after "w" whose bit is
+ * set in the summary "sum", or -1 if there is none.
+ */
+
+static int next_word(const struct db_span *s, const uint32_t *sum, unsigned w)
 {
-	struct db_span *this = *spans;
-	unsigned n;
+	unsigned i = w / WORD_BITS;
+	uint32_t m;
 
-	if (!this)
+	if (w >= s->words)
 		return -1;
-	n = this->start;
-	if (--this->len) {
-		this->start++;
-	} else {
-		*spans = this->next;
-		free(this);
+	m = sum[i] & (~0U << (w % WORD_BITS));
+	while (!m) {
+		if (++i == summary_words(s->words))
+			return -1;
+		m = sum[i];
 	}
-	return n;
+	return i * WORD_BITS + __builtin_ctz(m);
 }
 
 
-static inline unsigned round_up(unsigned n, unsigned mod)
+/* --- Set operations ------------------------------------------------------ */
+
+
+void span_add(struct db_span **spans, unsigned n, unsigned size)
 {
-	n += mod - 1;
-	return n - n % mod;
+	if (!*spans)
+		*spans = span_new();
+	change_range(*spans, n, size, 1);
 }
 
 
-int span_pull_erase_block(struct db_span **spans, unsigned erase_size)
+int span_pull_one(struct db_span **spans, unsigned from)
 {
-	struct db_span *this;
+	struct db_span *s = *spans;
+	unsigned w = from / WORD_BITS;
+	uint32_t m = 0;
+	int next;
 	unsigned n;
 
-	while (*spans) {
-		this = *spans;
-		n = round_up(this->start, erase_size);
-		if (this->start + this->len >= n + erase_size)
-			break;
-		spans = &(*spans)->next;
-	}
-	if (!*spans)
+	if (!s)
 		return -1;
-	n = round_up(this->start, erase_size);
-	if (n == this->start) {
-		if (this->len == erase_size) {
-			*spans = this;
-			free(this);
-		} else {
-			this->start += erase_size;
-			this->len -= erase_size;
-		}
-	} else {
-		if (this->start + this->len == n + erase_size) {
-			this->len -= erase_size;
-		} else {
-			struct db_span *next;
-
-			next = alloc_type(struct db_span);
-			next->start = n + erase_size;
-			next->len = this->start + this->len - n - erase_size;
-			next->next = this->next;
-			this->len = n - this->start;
-			this->next = next;
-		}
+	if (w < s->words)
+		m = s->map[w] & (~0U << (from % WORD_BITS));
+	if (!m) {
+		next = next_word(s, s->used, w + 1);
+		if (next < 0)	/* wrap around */
+			next = next_word(s, s->used, 0);
+		if (next < 0)
+			return -1;
+		w = next;
+		m = s->map[w];
 	}
+	n = w * WORD_BITS + __builtin_ctz(m);
+	change_range(s, n, 1, 0);
 	return n;
 }
 
 
-void span_free_all(struct db_span *spans)
+int span_pull_erase_block(struct db_span **spans, unsigned erase_size,
+    unsigned from)
 {
-	while (spans) {
-		struct db_span *next = spans->next;
+	struct db_span *s = *spans;
+	unsigned w, n;
+	uint32_t m = 0;
+	int next;
 
-		free(spans);
-		spans = next;
+	if (!s)
+		return -1;
+	assert(erase_size == s->erase_size);
+	from = (from + erase_size - 1) / erase_size * erase_size;
+	w = from / WORD_BITS;
+	if (w < s->words)
+		m = groups(s, s->map[w]) & (~0U << (from % WORD_BITS));
+	if (!m) {
+		next = next_word(s, s->full, w + 1);
+		if (next < 0)	/* wrap around */
+			next = next_word(s, s->full, 0);
+		if (next < 0)
+			return -1;
+		w = next;
+		m = groups(s, s->map[w]);
 	}
+	n = w * WORD_BITS + __builtin_ctz(m);
+	change_range(s, n, erase_size, 0);
+	return n;
+}
+
+
+void span_free_all(struct db_span *spans)
+{
+	if (!spans)
+		return;
+	free(spans->map);
+	free(spans);
 }
@@ -1,5 +1,5 @@
 /*
- * span.h - Lists of spans (consecutive blocks)
+ * span.h - Sets of blocks
  *
  * This work is licensed under the terms of the MIT License.
  * A copy of the license can be found in the file LICENSE.MIT
@@ -8,12 +8,26 @@
 #ifndef SPAN_H
 #define	SPAN_H
 
+/*
+ * A set of blocks is referenced by a "struct db_span *", which is NULL for an
+ * empty set.
+ */
+
 struct db_span;
 
 
+/* span_add adds blocks n to n + size - 1 to the set */
 void span_add(struct db_span **spans, unsigned n, unsigned size);
-int span_pull_one(struct db_span **spans);
-int span_pull_erase_block(struct db_span **spans, unsigned erase_size);
+
+/*
+ * span_pull_one and span_pull_erase_block return the first block (or erase
+ * block) at or after block "from", and remove it from the set. If there is
+ * none, they wrap around and return the first block (or erase block) of the
+ * set. If the set contains no suitable blocks, they return -1.
+ */
+int span_pull_one(struct db_span **spans, unsigned from);
+int span_pull_erase_block(struct db_span **spans, unsigned erase_size,
+    unsigned from);
 void span_free_all(struct db_span *spans);
 
 #endif /* !SPAN_H */
@@ -11,9 +11,15 @@
  *   one block.
  * - Only erasing writes "one" bits.
  * - Writing (without erasing) only writes zero bits.
+ *
+ * The file is mapped into memory, and changes are written back to the file
+ * according to storage_durability.
+ *
+ * storage_timing adds the latency of the Flash, so that stalls show up in the
+ * simulator. storage_read_start lets the firmware continue while the Flash is
+ * busy, like a DMA transfer would on the device.
  */
 
-#define _GNU_SOURCE /* for fallocate(2) */
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -21,45 +27,269 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <assert.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "storage.h"
 
 
 #define	DEFAULT_FILE_BLOCKS	2048
 #define	ERASE_SIZE		4	/* erasing erases four blocks */
+#define	SECTOR_SIZE		(ERASE_SIZE * STORAGE_BLOCK_SIZE)
+#define	PROGRAM_PAGE		256	/* program page */
 
 
 const char *storage_file = DEFAULT_DB_FILE_NAME;
+enum storage_durability storage_durability = sd_exit;
 
 static int fd = -1;
 static unsigned total_blocks;
-static uint32_t tmp[STORAGE_BLOCK_SIZE / 4];
+static uint8_t *map;
+static int dirty = -1;	/* first block of the sector not yet synced */
+
+struct storage_timing storage_timing;
+uint64_t storage_time_ns;
+uint64_t storage_wait_ns;
+
+
+/* --- Timing model -------------------------------------------------------- */
+
+
+/*
+ * Winbond W25Q128JV, typical values: 50 MHz single-bit SPI reads (the SDK
+ * doesn't use quad mode for data), 0.4 ms page program, 45 ms sector erase.
+ */
+
+static const struct storage_timing w25q128 = {
+	.read_ns	= 160,
+	.program_us	= 400,
+	.erase_us	= 45000,
+};
+
+
+bool storage_timing_parse(const char *s)
+{
+	struct storage_timing t = { 0, 0, 0, 0 };
+	const char *p = s;
+	char *end;
+
+	if (!strncmp(s, "w25q128", 7)) {
+		t = w25q128;
+		p = s + 7;
+	} else {
+		t.read_ns = strtoul(s, &end, 0);
+		if (*end != ',')
+			return 0;
+		t.program_us = strtoul(end + 1, &end, 0);
+		if (*end != ',')
+			return 0;
+		t.erase_us = strtoul(end + 1, &end, 0);
+		p = end;
+	}
+	if (!strcmp(p, ",sleep"))
+		t.sleep = 1;
+	else if (*p)
+		return 0;
+	storage_timing = t;
+	return 1;
+}
+
+
+static void device_sleep(uint64_t ns)
+{
+	struct timespec req = {
+		.tv_sec = ns / 1000000000,
+		.tv_nsec = ns % 1000000000,
+	};
+
+	if (ns)
+		nanosleep(&req, NULL);
+}
+
+
+static void device_time(uint64_t ns)
+{
+	storage_time_ns += ns;
+	storage_wait_ns += ns;
+	if (storage_timing.sleep)
+		device_sleep(ns);
+}
+
+
+/* --- Asynchronous reads -------------------------------------------------- */
+
+
+/*
+ * With storage_timing.sleep, a thread copies the data and then sleeps for as
+ * long as the read would take, and storage_read_wait measures how long it
+ * waits for the thread.
+ *
+ * Otherwise, we copy right away, and only model the timing: the read completes
+ * "ns" after it was started, and meanwhile the firmware's clock advances by the
+ * CPU time it uses. storage_read_wait then waits for the rest.
+ */
+
+static struct {
+	pthread_t	thread;
+	bool		busy;		/* thread is running */
+	bool		modeled;	/* read completes at "ready" */
+	void		*buf;
+	const uint8_t	*from;
+	size_t		size;
+	uint64_t	ns;
+	uint64_t	ready;
+} reader;
+
+
+static void *read_thread(void *arg)
+{
+	memcpy(reader.buf, reader.from, reader.size);
+	device_sleep(reader.ns);
+	return NULL;
+}
+
+
+static uint64_t clock_ns(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* firmware time: the CPU time we used, plus the time we waited for Flash */
+
+static uint64_t firmware_ns(void)
+{
+	return clock_ns(CLOCK_THREAD_CPUTIME_ID) + storage_wait_ns;
+}
+
+
+bool storage_read_wait(void)
+{
+	uint64_t t;
+
+	if (reader.modeled) {
+		t = firmware_ns();
+		if (reader.ready > t)
+			storage_wait_ns += reader.ready - t;
+		reader.modeled = 0;
+	}
+	if (reader.busy) {
+		t = clock_ns(CLOCK_MONOTONIC);
+		pthread_join(reader.thread, NULL);
+		storage_wait_ns += clock_ns(CLOCK_MONOTONIC) - t;
+		reader.busy = 0;
+	}
+	return 1;
+}
+
+
+/* --- Write back changes -------------------------------------------------- */
+
+
+/* msync wants a page-aligned address, and pages may be larger than a sector */
+
+static void sync_sector(unsigned n)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t offset = (size_t) n * STORAGE_BLOCK_SIZE;
+	size_t start = offset - offset % page;
+
+	if (msync(map + start, offset + SECTOR_SIZE - start, MS_SYNC) < 0) {
+		perror(storage_file);
+		exit(1);
+	}
+}
+
+
+static void changed(unsigned n)
+{
+	unsigned sector = n - n % ERASE_SIZE;
+
+	switch (storage_durability) {
+	case sd_write:
+		sync_sector(sector);
+		break;
+	case sd_sector:
+		if (dirty != -1 && (unsigned) dirty != sector)
+			sync_sector(dirty);
+		dirty = sector;
+		break;
+	case sd_exit:
+	case sd_never:
+		break;
+	default:
+		abort();
+	}
+}
+
+
+void storage_flush(void)
+{
+	if (fd == -1)
+		return;
+	storage_read_wait();
+	if (storage_durability == sd_never)
+		return;
+	if (msync(map, (size_t) total_blocks * STORAGE_BLOCK_SIZE,
+	    MS_SYNC) < 0) {
+		perror(storage_file);
+		exit(1);
+	}
+	dirty = -1;
+}
+
+
+/* --- Open the storage file ----------------------------------------------- */
 
 
 static void create_storage(void)
 {
-	fd = open(storage_file, O_RDWR);
-	if (fd < 0) {
+	bool never = storage_durability == sd_never;
+	bool new = 0;
+	struct stat st;
+
+	fd = open(storage_file, never ? O_RDONLY : O_RDWR);
+	if (fd < 0 && !never)
 		fd = open(storage_file, O_CREAT | O_RDWR, 0666);
-		if (fd < 0) {
-			perror(storage_file);
-			exit(1);
-		}
-		total_blocks = DEFAULT_FILE_BLOCKS;
-		if (!storage_erase_blocks(0, DEFAULT_FILE_BLOCKS))
-			exit(1);
-	} else {
-		struct stat st;
+	if (fd < 0) {
+		perror(storage_file);
+		exit(1);
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(storage_file);
+		exit(1);
+	}
 
-		if (fstat(fd, &st) < 0) {
+	/* a new or empty file (mmap can't map zero bytes) gets the default size */
+	if (!st.st_size && !never) {
+		st.st_size = (off_t) DEFAULT_FILE_BLOCKS * STORAGE_BLOCK_SIZE;
+		if (ftruncate(fd, st.st_size) < 0) {
 			perror(storage_file);
 			exit(1);
 		}
-		total_blocks = st.st_size / STORAGE_BLOCK_SIZE;
+		new = 1;
 	}
+	total_blocks = st.st_size / STORAGE_BLOCK_SIZE;
+	if (total_blocks < ERASE_SIZE) {
+		fprintf(stderr, "%s: too small\n", storage_file);
+		exit(1);
+	}
+	map = mmap(NULL, (size_t) total_blocks * STORAGE_BLOCK_SIZE,
+	    PROT_READ | PROT_WRITE, never ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror(storage_file);
+		exit(1);
+	}
+	atexit(storage_flush);
+	if (new && !storage_erase_blocks(0, total_blocks))
+		exit(1);
 }
 
 
@@ -77,93 +307,95 @@ unsigned storage_erase_size(void)
 }
 
 
-bool storage_read_block(void *buf, unsigned n)
-{
-	ssize_t got;
+/* --- Read, write, and erase ---------------------------------------------- */
+
 
+bool storage_read_blocks(void *buf, unsigned n, unsigned n_blocks)
+{
 	if (fd == -1)
 		create_storage();
-	assert(n < total_blocks);
-	got = pread(fd, buf, STORAGE_BLOCK_SIZE,
-	    (off_t) n * STORAGE_BLOCK_SIZE);
-	if (got < 0) {
-		perror(storage_file);
-		exit(1);
-	}
-	if (got != STORAGE_BLOCK_SIZE) {
-		fprintf(stderr, "%s: short write\n", storage_file);
-		exit(1);
-	}
+	assert(n + n_blocks <= total_blocks);
+	storage_read_wait();
+	memcpy(buf, map + (size_t) n * STORAGE_BLOCK_SIZE,
+	    (size_t) n_blocks * STORAGE_BLOCK_SIZE);
+	device_time((uint64_t) storage_timing.read_ns * n_blocks *
+	    STORAGE_BLOCK_SIZE);
+	storage_count_read(n_blocks);
 	return 1;
 }
 
 
-static bool do_write_block(const void *buf, unsigned n)
+bool storage_read_start(void *buf, unsigned n, unsigned n_blocks)
 {
-	ssize_t wrote;
-
 	if (fd == -1)
 		create_storage();
-	assert(n < total_blocks);
-	wrote = pwrite(fd, tmp, STORAGE_BLOCK_SIZE,
-	    (off_t) n * STORAGE_BLOCK_SIZE);
-	if (wrote < 0) {
-		perror(storage_file);
-		exit(1);
-	}
-	if (wrote != STORAGE_BLOCK_SIZE) {
-		fprintf(stderr, "%s: short write\n", storage_file);
-		exit(1);
-	}
-	if (fdatasync(fd) < 0) {
-		perror(storage_file);
-		exit(1);
+	assert(n + n_blocks <= total_blocks);
+	storage_read_wait();
+	reader.buf = buf;
+	reader.from = map + (size_t) n * STORAGE_BLOCK_SIZE;
+	reader.size = (size_t) n_blocks * STORAGE_BLOCK_SIZE;
+	reader.ns = (uint64_t) storage_timing.read_ns * reader.size;
+	storage_time_ns += reader.ns;
+	storage_count_read(n_blocks);
+	if (!storage_timing.sleep) {
+		memcpy(buf, reader.from, reader.size);
+		reader.ready = firmware_ns() + reader.ns;
+		reader.modeled = 1;
+		return 1;
 	}
+	if (pthread_create(&reader.thread, NULL, read_thread, NULL))
+		read_thread(NULL);
+	else
+		reader.busy = 1;
 	return 1;
 }
 
 
+bool storage_read_block(void *buf, unsigned n)
+{
+	return storage_read_blocks(buf, n, 1);
+}
+
+
 bool storage_write_block(const void *buf, unsigned n)
 {
-	ssize_t got;
-	uint32_t *p;
-	const uint32_t *q = buf;
-	bool ret;
+	const uint8_t *q = buf;
+	uint8_t *p, *end;
 
 	if (fd == -1)
 		create_storage();
 	assert(n < total_blocks);
+	storage_read_wait();
 
-	/* read the old block, so that we can preserve "1" bits */
-	got = pread(fd, tmp, STORAGE_BLOCK_SIZE,
-	    (off_t) n * STORAGE_BLOCK_SIZE);
-	if (got < 0) {
-		perror(storage_file);
-		exit(1);
-	}
-	if (got != STORAGE_BLOCK_SIZE) {
-		fprintf(stderr, "%s: short write\n", storage_file);
-		exit(1);
-	}
-
-	/* writing can only turn "1"" into "0" */
-	for (p = tmp; p != (void *) tmp + sizeof(tmp); p++)
-		*p &= *q++;
+	/* writing can only turn "1" into "0" */
+	p = map + (size_t) n * STORAGE_BLOCK_SIZE;
+	end = p + STORAGE_BLOCK_SIZE;
+	while (p != end)
+		*p++ &= *q++;
 
-	ret = do_write_block(tmp, n);
-
-	memset(tmp, 0, sizeof(tmp));
-	return ret;
+	changed(n);
+	device_time((uint64_t) storage_timing.program_us * 1000 *
+	    (STORAGE_BLOCK_SIZE / PROGRAM_PAGE));
+	storage_count_program();
+	return 1;
 }
 
 
 bool storage_erase_blocks(unsigned n, unsigned n_blocks)
 {
+	if (fd == -1)
+		create_storage();
 	assert(!(n % ERASE_SIZE));
 	assert(!(n_blocks % ERASE_SIZE));
-	memset(tmp, 0xff, STORAGE_BLOCK_SIZE);
-	while (n_blocks--)
-		if (!do_write_block(tmp, n++))
-			return 0;
+	assert(n + n_blocks <= total_blocks);
+	storage_read_wait();
+	memset(map + (size_t) n * STORAGE_BLOCK_SIZE, 0xff,
+	    (size_t) n_blocks * STORAGE_BLOCK_SIZE);
+	storage_count_erase(n, n_blocks);
+	for (; n_blocks; n_blocks -= ERASE_SIZE) {
+		changed(n);
+		device_time((uint64_t) storage_timing.erase_us * 1000);
+		n += ERASE_SIZE;
+	}
 	return 1;
 }
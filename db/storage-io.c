@@ -0,0 +1,95 @@
+/*
+ * storage-io.c - Storage I/O and wear counters
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * The storage backends call the storage_count_* functions for each operation.
+ * The counters start at zero when the system starts. Per-sector erase counts
+ * are only kept in memory, i.e., they show the wear since power-up.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "alloc.h"
+#include "storage.h"
+
+
+static struct storage_io_stats io;
+static uint32_t *sector_erases;
+
+
+static uint32_t *erase_counts(void)
+{
+	unsigned sectors;
+
+	if (!sector_erases) {
+		sectors = storage_blocks() / storage_erase_size();
+		sector_erases = alloc_type_n(uint32_t, sectors);
+		memset(sector_erases, 0, sectors * sizeof(uint32_t));
+	}
+	return sector_erases;
+}
+
+
+/* --- Counting ------------------------------------------------------------ */
+
+
+void storage_count_read(unsigned n_blocks)
+{
+	io.reads++;
+	io.read_bytes += n_blocks * STORAGE_BLOCK_SIZE;
+}
+
+
+void storage_count_program(void)
+{
+	io.programs++;
+	io.program_bytes += STORAGE_BLOCK_SIZE;
+}
+
+
+void storage_count_erase(unsigned n, unsigned n_blocks)
+{
+	unsigned erase_size = storage_erase_size();
+	uint32_t *counts = erase_counts();
+	unsigned sector;
+
+	io.erases++;
+	io.erase_bytes += n_blocks * STORAGE_BLOCK_SIZE;
+	for (sector = n / erase_size; n_blocks; n_blocks -= erase_size) {
+		counts[sector]++;
+		if (counts[sector] > io.max_sector_erases)
+			io.max_sector_erases = counts[sector];
+		sector++;
+	}
+}
+
+
+/* --- Retrieving ---------------------------------------------------------- */
+
+
+void storage_io_stats(struct storage_io_stats *s)
+{
+	*s = io;
+}
+
+
+unsigned storage_sector_erases(unsigned sector)
+{
+	assert(sector < storage_blocks() / storage_erase_size());
+	return erase_counts()[sector];
+}
+
+
+void storage_io_reset(void)
+{
+	memset(&io, 0, sizeof(io));
+	if (sector_erases)
+		memset(sector_erases, 0, storage_blocks() /
+		    storage_erase_size() * sizeof(uint32_t));
+}
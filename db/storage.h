@@ -9,6 +9,7 @@
 #define	STORAGE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 
 #define	STORAGE_BLOCK_SIZE	1024
@@ -19,7 +20,44 @@
 #define	DEFAULT_DB_FILE_NAME	"dummy.db"
 
 
+/* when to write changes back to the storage file */
+
+enum storage_durability {
+	sd_write,	/* after each write or erase */
+	sd_sector,	/* when moving on to a different erase block */
+	sd_exit,	/* only in storage_flush and when exiting */
+	sd_never,	/* never, the file is opened read-only */
+};
+
+
+/*
+ * Flash timing model. Each operation adds its cost to storage_time_ns, and the
+ * time the firmware had to wait for it to storage_wait_ns. (The two differ if
+ * the firmware does something else while a storage_read_start completes.) If
+ * "sleep" is set, we actually wait. Otherwise, time_us() advances by the time
+ * waited, i.e., the cost is only visible to the firmware.
+ */
+
+struct storage_timing {
+	unsigned read_ns;	/* per byte read */
+	unsigned program_us;	/* per page written */
+	unsigned erase_us;	/* per erase block */
+	bool sleep;
+};
+
+
 extern const char *storage_file;
+extern enum storage_durability storage_durability;
+extern struct storage_timing storage_timing;
+extern uint64_t storage_time_ns;	/* accumulated device time */
+extern uint64_t storage_wait_ns;	/* time the firmware waited for it */
+
+
+/*
+ * storage_timing_parse accepts "w25q128" or "READ_NS,PROGRAM_US,ERASE_US",
+ * optionally followed by ",sleep".
+ */
+bool storage_timing_parse(const char *s);
 
 #endif /* !SDK */
 
@@ -28,7 +66,52 @@ unsigned storage_blocks(void);
 unsigned storage_erase_size(void);
 
 bool storage_read_block(void *buf, unsigned n);
+
+/*
+ * storage_read_blocks reads "n_blocks" consecutive blocks, starting at block
+ * "n", into "buf". This is faster than reading them one by one.
+ */
+bool storage_read_blocks(void *buf, unsigned n, unsigned n_blocks);
+
+/*
+ * storage_read_start begins reading like storage_read_blocks, but may return
+ * before the data is in "buf". storage_read_wait waits until it is, and returns
+ * whether reading succeeded. Only one read can be pending. All other storage
+ * operations wait for it to complete. storage_read_start returns 0 if it did not
+ * start a read, e.g., because the storage can only read synchronously. The
+ * caller then has to use storage_read_blocks.
+ */
+bool storage_read_start(void *buf, unsigned n, unsigned n_blocks);
+bool storage_read_wait(void);
+
 bool storage_write_block(const void *buf, unsigned n);
 bool storage_erase_blocks(unsigned n, unsigned n_blocks);
 
+/* make sure all changes have reached the storage */
+void storage_flush(void);
+
+
+/* --- I/O and wear counters (storage-io.c) --- */
+
+struct storage_io_stats {
+	unsigned	reads;		/* read operations */
+	unsigned	read_bytes;
+	unsigned	programs;	/* blocks written */
+	unsigned	program_bytes;
+	unsigned	erases;		/* erase operations */
+	unsigned	erase_bytes;
+	unsigned	max_sector_erases; /* highest erase count of a sector */
+};
+
+/* for storage backends */
+void storage_count_read(unsigned n_blocks);
+void storage_count_program(void);
+void storage_count_erase(unsigned n, unsigned n_blocks);
+
+void storage_io_stats(struct storage_io_stats *s);
+
+/* erases of the sector since power-up, for statistics only */
+unsigned storage_sector_erases(unsigned sector);
+void storage_io_reset(void);
+
 #endif /* !STORAGE_H */
@@ -0,0 +1,328 @@
+/*
+ * summary.c - Open-time summary of block states
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * Without a summary, db_open has to read every single block of the storage,
+ * even if most of them are erased. The summary records the state of all blocks
+ * when it was written, so that db_open only has to read blocks that may contain
+ * data, plus any blocks that have changed since.
+ *
+ * The summary is kept in the last SUMMARY_SECTORS erase blocks of the storage.
+ * At most one of them contains the current summary (if there are two, e.g.,
+ * after losing power while replacing the summary, the newer one is used):
+ *
+ * Block
+ * 0	Summary (bt_summary), encrypted like any other block
+ * 1-	Change log: 16-bit little-endian numbers of blocks that were erased
+ *	or allocated after the summary was written. Unused entries are 0xffff.
+ *	Since entries are only added, we can extend the log without erasing.
+ *
+ * Summary payload:
+ *
+ * Offset
+ * |	Size
+ * 0	2	Number of blocks described, starting at RESERVED_BLOCKS
+ * 2	2	Next block to allocate (db->alloc_next)
+ * 4	*	Block states (enum summary_state), two bits per block, starting
+ *		with the least significant bits of the first byte
+ *
+ * If the summary area contains anything else (e.g., data written before we had
+ * summaries), we leave it alone and always scan the whole storage.
+ *
+ * Blocks we consider deleted or empty may have been erased in the meantime,
+ * which would only cost us an unnecessary erase later. However, we must never
+ * consider a block erased if it isn't. We therefore log erasures (for
+ * accuracy), and allocations (for correctness). When the log is full, the
+ * summary is stale and we fall back to scanning everything.
+ *
+ * Each log write costs a flash program, so we avoid writing to the log when
+ * allocating blocks it already covers: when we erase an erase block, we log all
+ * its blocks, and when we allocate a block the log doesn't cover, we also log
+ * the next SUMMARY_AHEAD-1 blocks, which is where the following allocations usually
+ * go. Logging a block that then isn't used only means that db_open reads it.
+ *
+ * The last block in the log also tells us where to continue allocating. db_open
+ * then backs up over blocks we logged ahead but didn't use.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "alloc.h"
+#include "storage.h"
+#include "block.h"
+#include "db.h"
+#include "summary.h"
+
+
+#define	LOG_UNUSED	0xffff
+#define	LOG_PER_BLOCK	(STORAGE_BLOCK_SIZE / 2)
+#define	STATES		4	/* offset of block states in the payload */
+
+
+static unsigned area_blocks(void)
+{
+	return SUMMARY_SECTORS * storage_erase_size();
+}
+
+
+static unsigned log_capacity(void)
+{
+	return (storage_erase_size() - 1) * LOG_PER_BLOCK;
+}
+
+
+static unsigned summary_bytes(unsigned blocks)
+{
+	return STATES + (blocks * 2 + 7) / 8;
+}
+
+
+/* --- Load the summary ---------------------------------------------------- */
+
+
+static bool sector_is_erased(unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i != storage_erase_size(); i++)
+		if (block_read(NULL, NULL, NULL, NULL, n + i) != bt_erased)
+			return 0;
+	return 1;
+}
+
+
+/*
+ * find_summary returns the block containing the most recent summary, -1 if
+ * there is no summary, and -2 if the summary area is used for something else.
+ */
+
+static int find_summary(struct db *db, unsigned base, unsigned covered)
+{
+	int best = -1;
+	unsigned n;
+
+	for (n = base; n != db->stats.total; n += storage_erase_size()) {
+		unsigned len = sizeof(payload_buf);
+		uint16_t seq;
+
+		switch (block_read(db->c, &seq, payload_buf, &len, n)) {
+		case bt_erased:
+			if (!sector_is_erased(n))
+				return -2;
+			break;
+		case bt_summary:
+			if (len < summary_bytes(covered) ||
+			    (unsigned) (payload_buf[0] | payload_buf[1] << 8) !=
+			    covered)
+				return -2;
+			if (best < 0 ||
+			    ((seq + 0x10000 - db->summary_seq) & 0xffff) <
+			    0x8000) {
+				best = n;
+				db->summary_seq = seq;
+			}
+			break;
+		default:
+			return -2;
+		}
+	}
+	return best;
+}
+
+
+static unsigned read_log(struct db *db, uint8_t *state)
+{
+	unsigned entries = 0;
+	unsigned i;
+
+	for (i = 1; i != storage_erase_size(); i++) {
+		const uint8_t *p;
+
+		if (!storage_read_block(io_buf, db->summary_block + i))
+			return log_capacity();
+		for (p = io_buf; p != io_buf + STORAGE_BLOCK_SIZE; p += 2) {
+			unsigned n = p[0] | p[1] << 8;
+
+			if (n == LOG_UNUSED)
+				return entries;
+			if (n >= RESERVED_BLOCKS && n < db->summary_base) {
+				state[n] = ss_live;
+				db->alloc_next = n + 1 == db->summary_base ?
+				    RESERVED_BLOCKS : n + 1;
+			}
+			entries++;
+		}
+	}
+	return entries;
+}
+
+
+uint8_t *summary_load(struct db *db)
+{
+	unsigned base = db->stats.total - area_blocks();
+	unsigned covered = base - RESERVED_BLOCKS;
+	unsigned len = sizeof(payload_buf);
+	uint8_t *state;
+	unsigned i;
+	int n;
+
+	db->summary_base = db->stats.total;
+	db->summary_block = -1;
+	db->summary_log = 0;
+	db->summary_first = db->summary_end = 0;
+
+	/* the summary has to fit into a block, even with many readers */
+	if (db->stats.total < RESERVED_BLOCKS + 2 * area_blocks() ||
+	    summary_bytes(covered) > STORAGE_BLOCK_SIZE / 2)
+		return NULL;
+
+	n = find_summary(db, base, covered);
+	memset(payload_buf, 0, sizeof(payload_buf));
+	if (n == -2) {
+		debug("summary area is in use\n");
+		return NULL;
+	}
+	db->summary_base = base;
+	if (n < 0)
+		return NULL;
+	db->summary_block = n;
+
+	if (block_read(db->c, NULL, payload_buf, &len, n) != bt_summary)
+		return NULL;
+	state = alloc_size(db->stats.total);
+	for (i = 0; i != covered; i++)
+		state[RESERVED_BLOCKS + i] =
+		    payload_buf[STATES + (i >> 2)] >> ((i & 3) * 2) & 3;
+	i = payload_buf[2] | payload_buf[3] << 8;
+	if (i >= RESERVED_BLOCKS && i < base)
+		db->alloc_next = i;
+	memset(payload_buf, 0, sizeof(payload_buf));
+
+	db->summary_log = read_log(db, state);
+	if (db->summary_log == log_capacity()) {
+		debug("summary is stale\n");
+		free(state);
+		return NULL;
+	}
+	return state;
+}
+
+
+/* --- Write a new summary ------------------------------------------------- */
+
+
+static bool summary_write(struct db *db, const uint8_t *state)
+{
+	unsigned erase_size = storage_erase_size();
+	unsigned covered = db->summary_base - RESERVED_BLOCKS;
+	int old = db->summary_block;
+	unsigned n, i;
+	bool ok;
+
+	n = old < 0 ? db->summary_base :
+	    db->summary_base +
+	    (old - db->summary_base + erase_size) % area_blocks();
+
+	memset(payload_buf, 0, sizeof(payload_buf));
+	payload_buf[0] = covered;
+	payload_buf[1] = covered >> 8;
+	payload_buf[2] = db->alloc_next;
+	payload_buf[3] = db->alloc_next >> 8;
+	for (i = 0; i != covered; i++)
+		payload_buf[STATES + (i >> 2)] |=
+		    state[RESERVED_BLOCKS + i] << ((i & 3) * 2);
+
+	ok = storage_erase_blocks(n, erase_size) &&
+	    block_write(db->c, bt_summary, db->summary_seq + 1, payload_buf,
+	    summary_bytes(covered), n);
+	memset(payload_buf, 0, sizeof(payload_buf));
+	if (!ok) {
+		debug("could not write summary to %u\n", n);
+		return 0;
+	}
+
+	db->summary_seq++;
+	db->summary_block = n;
+	db->summary_log = 0;
+	db->summary_first = db->summary_end = 0;
+
+	/* if this fails, we still have the newer summary */
+	if (old >= 0 && !storage_erase_blocks(old, erase_size))
+		debug("could not erase old summary at %u\n", old);
+	return 1;
+}
+
+
+bool summary_refresh(struct db *db, const uint8_t *state)
+{
+	if (db->summary_base == db->stats.total)
+		return 0;
+	if (db->summary_block >= 0 && db->summary_log < log_capacity() / 2)
+		return 1;
+	return summary_write(db, state);
+}
+
+
+/* --- Log changes --------------------------------------------------------- */
+
+
+bool summary_log(struct db *db, unsigned n, unsigned n_blocks)
+{
+	unsigned first = n;
+	unsigned end = n + n_blocks;
+
+	while (n_blocks && db->summary_block >= 0) {
+		unsigned log_block = db->summary_log / LOG_PER_BLOCK;
+		uint8_t *p;
+
+		/* once the log is full, the summary is stale */
+		if (db->summary_log == log_capacity())
+			return 1;
+
+		/* we can only clear bits, so the rest of the block is 0xff */
+		memset(io_buf, 0xff, sizeof(io_buf));
+		p = io_buf + db->summary_log % LOG_PER_BLOCK * 2;
+		while (n_blocks && p != io_buf + STORAGE_BLOCK_SIZE) {
+			*p++ = n;
+			*p++ = n >> 8;
+			n++;
+			n_blocks--;
+		}
+		if (storage_write_block(io_buf, db->summary_block + 1 +
+		    log_block)) {
+			db->summary_log = log_block * LOG_PER_BLOCK +
+			    (p - io_buf) / 2;
+			continue;
+		}
+
+		/* we can't log the change, so the summary has to go */
+		debug("could not log change to %u\n", n);
+		if (!storage_erase_blocks(db->summary_block,
+		    storage_erase_size()))
+			return 0;
+		db->summary_block = -1;
+	}
+	db->summary_first = first;
+	db->summary_end = end;
+	return 1;
+}
+
+
+bool summary_alloc(struct db *db, unsigned n)
+{
+	unsigned n_blocks = SUMMARY_AHEAD;
+
+	if (n >= db->summary_first && n < db->summary_end)
+		return 1;
+	if (n + n_blocks > db->summary_base)
+		n_blocks = db->summary_base - n;
+	return summary_log(db, n, n_blocks);
+}
@@ -0,0 +1,59 @@
+/*
+ * summary.h - Open-time summary of block states
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+#ifndef SUMMARY_H
+#define	SUMMARY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+
+
+#define	SUMMARY_SECTORS	2	/* we alternate between two erase blocks */
+#define	SUMMARY_AHEAD	8	/* blocks to log when allocating */
+
+
+enum summary_state {
+	ss_erased	= 0,
+	ss_deleted	= 1,
+	ss_empty	= 2,
+	ss_live		= 3,	/* anything else: the block has to be read */
+};
+
+
+/*
+ * summary_load sets up the summary area of the database. If it finds a valid
+ * summary, it returns an array with the state of each block (indexed by block
+ * number), where blocks that have changed since the summary was written are
+ * ss_live. The caller has to free the array. If there is no valid summary,
+ * summary_load returns NULL.
+ */
+uint8_t *summary_load(struct db *db);
+
+/*
+ * summary_refresh writes a new summary with the block states in "state", if
+ * there is no summary yet or if its change log is filling up.
+ */
+bool summary_refresh(struct db *db, const uint8_t *state);
+
+/*
+ * summary_log records that "n_blocks" blocks, starting at block "n", are
+ * about to be erased or written. It has to be called before making the change.
+ * summary_log returns 0 if the change could not be recorded and the summary
+ * could not be removed either. In this case, the blocks must not be changed.
+ */
+bool summary_log(struct db *db, unsigned n, unsigned n_blocks);
+
+/*
+ * summary_alloc is like summary_log for allocating block "n". If the change log
+ * already covers the block, it does nothing. Otherwise, it also logs the next
+ * few blocks, so that subsequent allocations don't need another write.
+ */
+bool summary_alloc(struct db *db, unsigned n);
+
+#endif /* !SUMMARY_H */
@@ -23,8 +23,10 @@
 
 #ifdef SDK
 #define	PSRAM_NOINIT	__attribute__((__section__(".psram_noinit")))
+#define	THREAD_LOCAL
 #else
 #define	PSRAM_NOINIT
+#define	THREAD_LOCAL	__thread	/* the host decrypts in threads */
 #endif
 
 #define	CPU_ID_LENGTH	20
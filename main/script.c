@@ -13,18 +13,24 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "hal.h"
 #include "rnd.h"
 #include "timer.h"
 #include "sha.h"
+#include "hotp.h"
+#include "tweetnacl.h"
+#include "secretbox.h"
 #include "bip39enc.h"
 #include "bip39in.h"
 #include "bip39dec.h"
+#include "storage.h"
 #include "block.h"
 #include "secrets.h"
 #include "dbcrypt.h"
 #include "db.h"
+#include "pin.h"
 #include "rmt.h"
 #include "rmt-db.h"
 #include "version.h"
@@ -170,6 +176,34 @@ bool screenshot(const struct gfx_drawable *da, const char *fmt, ...)
 }
 
 
+/* --- Opening the database in steps --------------------------------------- */
+
+
+static unsigned open_step;	/* blocks per step */
+static unsigned open_steps;	/* steps so far */
+static uint64_t open_t0;	/* storage_time_ns when we began */
+
+
+static void open_report(const char *what)
+{
+	printf("%s steps %u scanned %u flash %llu us\n", what, open_steps,
+	    main_db.scanned,
+	    (unsigned long long) (storage_time_ns - open_t0) / 1000);
+}
+
+
+/* open_db_step returns 0 when the database is completely open */
+
+static bool open_db_step(void)
+{
+	open_steps++;
+	if (!db_open_step(&main_db, open_step))
+		return 1;
+	open_report("total");
+	return 0;
+}
+
+
 /* --- Scripting actions --------------------------------------------------- */
 
 
@@ -190,9 +224,9 @@ static struct db_entry *find_entry(const char *name)
 {
 	struct db_entry *e;
 
-	for (e = main_db.entries; e; e = e->next)
-		if (!strcmp(e->name, name))
-			return e;
+	e = db_find_entry(&main_db, name, strlen(name));
+	if (e)
+		return e;
 	fprintf(stderr, "entry \"%s\" not found\n", name);
 	exit(1);
 }
@@ -401,6 +435,412 @@ static void do_bip39_match(const char *arg)
 }
 
 
+/* --- Curve25519 ---------------------------------------------------------- */
+
+
+static bool parse_hex(uint8_t *buf, unsigned size, const char *s)
+{
+	unsigned i;
+
+	for (i = 0; i != size; i++) {
+		char byte[3] = { s[0], s[0] ? s[1] : 0, 0 };
+		char *end;
+
+		buf[i] = strtoul(byte, &end, 16);
+		if (end != byte + 2)
+			return 0;
+		s += 2;
+	}
+	return !*s;
+}
+
+
+static void print_hex(const uint8_t *buf, unsigned size)
+{
+	unsigned i;
+
+	for (i = 0; i != size; i++)
+		printf("%02x%s", buf[i],
+		    i == size - 1 || (i & 31) == 31 ? "\n" : "");
+}
+
+
+/*
+ * RFC 7748, section 5.2: with N iterations, the result becomes the next scalar,
+ * and the old scalar the next point.
+ */
+
+static bool do_x25519(const char *arg)
+{
+	uint8_t k[crypto_scalarmult_SCALARBYTES];
+	uint8_t u[crypto_scalarmult_BYTES];
+	uint8_t r[crypto_scalarmult_BYTES];
+	char ks[2 * sizeof(k) + 1], us[2 * sizeof(u) + 1];
+	unsigned n = 1;
+	unsigned i;
+
+	if (sscanf(arg, "%64s %64s %u", ks, us, &n) < 2)
+		return 0;
+	if (!parse_hex(k, sizeof(k), ks) || !parse_hex(u, sizeof(u), us))
+		return 0;
+	for (i = 0; i != n; i++) {
+		crypto_scalarmult(r, k, u);
+		memcpy(u, k, sizeof(u));
+		memcpy(k, r, sizeof(k));
+	}
+	print_hex(r, sizeof(r));
+	return 1;
+}
+
+
+static bool do_x25519_base(const char *arg)
+{
+	uint8_t k[crypto_scalarmult_SCALARBYTES];
+	uint8_t r[crypto_scalarmult_BYTES];
+
+	if (!parse_hex(k, sizeof(k), arg))
+		return 0;
+	crypto_scalarmult_base(r, k);
+	print_hex(r, sizeof(r));
+	return 1;
+}
+
+
+/* --- Salsa20 and Poly1305 ------------------------------------------------ */
+
+
+#define	MAX_MESSAGE	1024
+
+
+/*
+ * "crypto secretbox" prints the ciphertext, including the authenticator, then
+ * checks that crypto_secretbox_open recovers the message, and that it rejects
+ * the ciphertext after flipping a bit. It also checks that secretbox_seal and
+ * secretbox_open, in place, agree with crypto_secretbox.
+ */
+
+static bool do_secretbox(const char *arg)
+{
+	uint8_t k[crypto_secretbox_KEYBYTES];
+	uint8_t nonce[crypto_secretbox_NONCEBYTES];
+	uint8_t m[crypto_secretbox_ZEROBYTES + MAX_MESSAGE] = { 0, };
+	uint8_t c[crypto_secretbox_ZEROBYTES + MAX_MESSAGE];
+	uint8_t out[crypto_secretbox_ZEROBYTES + MAX_MESSAGE];
+	char ks[2 * sizeof(k) + 1], ns[2 * sizeof(nonce) + 1];
+	char ms[2 * MAX_MESSAGE + 1] = "";
+	unsigned len;
+
+	if (sscanf(arg, "%64s %48s %2048s", ks, ns, ms) < 2)
+		return 0;
+	len = strlen(ms) / 2;
+	if (!parse_hex(k, sizeof(k), ks) || !parse_hex(nonce, sizeof(nonce), ns)
+	    || !parse_hex(m + crypto_secretbox_ZEROBYTES, len, ms))
+		return 0;
+	len += crypto_secretbox_ZEROBYTES;
+
+	crypto_secretbox(c, m, len, nonce, k);
+	print_hex(c + crypto_secretbox_BOXZEROBYTES,
+	    len - crypto_secretbox_BOXZEROBYTES);
+
+	if (crypto_secretbox_open(out, c, len, nonce, k) || memcmp(out, m, len))
+		printf("open failed\n");
+
+	uint8_t *p = out + crypto_secretbox_ZEROBYTES;
+	unsigned mlen = len - crypto_secretbox_ZEROBYTES;
+	uint8_t mac[SECRETBOX_MACBYTES];
+
+	memcpy(p, m + crypto_secretbox_ZEROBYTES, mlen);
+	secretbox_seal(p, mac, p, mlen, nonce, k);
+	if (memcmp(mac, c + crypto_secretbox_BOXZEROBYTES, sizeof(mac)) ||
+	    memcmp(p, c + crypto_secretbox_ZEROBYTES, mlen))
+		printf("seal differs\n");
+	if (!secretbox_open(p, mac, p, mlen, nonce, k) ||
+	    memcmp(p, m + crypto_secretbox_ZEROBYTES, mlen))
+		printf("in-place open failed\n");
+
+	c[len - 1] ^= 1;
+	if (!crypto_secretbox_open(out, c, len, nonce, k))
+		printf("forgery accepted\n");
+	if (secretbox_open(NULL, mac, c + crypto_secretbox_ZEROBYTES, mlen,
+	    nonce, k))
+		printf("forgery accepted\n");
+	return 1;
+}
+
+
+static bool do_poly1305(const char *arg)
+{
+	uint8_t k[crypto_onetimeauth_KEYBYTES];
+	uint8_t m[MAX_MESSAGE];
+	uint8_t a[crypto_onetimeauth_BYTES];
+	char ks[2 * sizeof(k) + 1];
+	char ms[2 * MAX_MESSAGE + 1] = "";
+	unsigned len;
+
+	if (sscanf(arg, "%64s %2048s", ks, ms) < 1)
+		return 0;
+	len = strlen(ms) / 2;
+	if (!parse_hex(k, sizeof(k), ks) || !parse_hex(m, len, ms))
+		return 0;
+	crypto_onetimeauth(a, m, len, k);
+	print_hex(a, sizeof(a));
+	return 1;
+}
+
+
+/* --- SHA and HOTP ------------------------------------------------------- */
+
+
+#define	SHA_COPIES	9	/* one more than the most vector lanes */
+
+
+static void sha_one(bool sha256, uint8_t *res, const uint8_t *m,
+    unsigned len)
+{
+	if (sha256) {
+		struct sha256_ctx ctx;
+
+		sha256_init(&ctx);
+		sha256_update(&ctx, m, len);
+		sha256_final(&ctx, res);
+	} else {
+		struct sha1_ctx ctx;
+
+		sha1_init(&ctx);
+		sha1_update(&ctx, m, len);
+		sha1_final(&ctx, res);
+	}
+}
+
+
+/* "res" holds "n" hashes, back to back */
+
+static void sha_many(bool sha256, uint8_t *res, const void *const *data,
+    unsigned len, unsigned n)
+{
+	if (sha256)
+		sha256_batch((uint8_t (*)[SHA256_HASH_BYTES]) res, NULL, data,
+		    len, n);
+	else
+		sha1_batch((uint8_t (*)[SHA1_HASH_BYTES]) res, NULL, data, len,
+		    n);
+}
+
+
+/*
+ * "crypto sha1" and "crypto sha256" print the hash of the message, then check
+ * that the other implementations agree: with and without the SHA instructions
+ * of x86 CPUs, and in a batch of several copies of the message.
+ */
+
+static bool do_sha(const char *arg, bool sha256)
+{
+	uint8_t m[MAX_MESSAGE];
+	uint8_t res[SHA256_HASH_BYTES], again[SHA256_HASH_BYTES];
+	uint8_t batch[SHA_COPIES * SHA256_HASH_BYTES];
+	const void *data[SHA_COPIES];
+	unsigned bytes = sha256 ? SHA256_HASH_BYTES : SHA1_HASH_BYTES;
+	unsigned len = strlen(arg) / 2;
+	unsigned i, ni;
+
+	if (len > MAX_MESSAGE || !parse_hex(m, len, arg))
+		return 0;
+	for (i = 0; i != SHA_COPIES; i++)
+		data[i] = m;
+	for (ni = 0; ni != 2; ni++) {
+		sha_ni = ni ? -1 : 0;
+		sha_one(sha256, ni ? again : res, m, len);
+		if (!ni)
+			print_hex(res, bytes);
+		else if (memcmp(again, res, bytes))
+			printf("sha_ni differs\n");
+		sha_many(sha256, batch, data, len, SHA_COPIES);
+		for (i = 0; i != SHA_COPIES; i++)
+			if (memcmp(batch + i * bytes, res, bytes))
+				printf("batch %u differs%s\n", i,
+				    ni ? " (sha_ni)" : "");
+	}
+	sha_ni = -1;
+	return 1;
+}
+
+
+#define	MAX_HOTP	32
+
+
+/*
+ * "crypto hotp" prints the six-digit HOTP codes for N consecutive counter
+ * values, calculated with hotp64_batch, and checks them against hotp64.
+ */
+
+static bool do_hotp(const char *arg)
+{
+	uint8_t k[64];
+	char ks[2 * sizeof(k) + 1];
+	unsigned long long count;
+	unsigned n = 1;
+	uint32_t res[MAX_HOTP];
+	unsigned len, i;
+
+	if (sscanf(arg, "%128s %llu %u", ks, &count, &n) < 2)
+		return 0;
+	len = strlen(ks) / 2;
+	if (!n || n > MAX_HOTP || !parse_hex(k, len, ks))
+		return 0;
+	hotp64_batch(res, k, len, count, n);
+	for (i = 0; i != n; i++) {
+		printf("%06u\n", (unsigned) (res[i] % 1000000));
+		if (res[i] != hotp64(k, len, count + i))
+			printf("hotp64 differs\n");
+	}
+	return 1;
+}
+
+
+/* --- Benchmark ----------------------------------------------------------- */
+
+
+static uint64_t cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * box_bench measures the throughput of crypto_secretbox and
+ * crypto_secretbox_open on 1 kB, the size of a storage block, and of
+ * secretbox_seal and secretbox_open, which db_encrypt and db_decrypt use, in
+ * place.
+ */
+
+static void box_bench(unsigned n)
+{
+	uint8_t k[crypto_secretbox_KEYBYTES] = { 0, };
+	uint8_t nonce[crypto_secretbox_NONCEBYTES] = { 0, };
+	uint8_t m[crypto_secretbox_ZEROBYTES + 1024] = { 0, };
+	uint8_t c[sizeof(m)];
+	uint64_t t;
+	unsigned i;
+
+	t = cpu_ns();
+	for (i = 0; i != n; i++)
+		crypto_secretbox(c, m, sizeof(m), nonce, k);
+	t = cpu_ns() - t;
+	printf("secretbox %llu MB/s\n",
+	    (unsigned long long) n * 1024 * 1000 / (t ? t : 1));
+
+	t = cpu_ns();
+	for (i = 0; i != n; i++)
+		if (crypto_secretbox_open(m, c, sizeof(m), nonce, k))
+			printf("open failed\n");
+	t = cpu_ns() - t;
+	printf("secretbox_open %llu MB/s\n",
+	    (unsigned long long) n * 1024 * 1000 / (t ? t : 1));
+
+	t = cpu_ns();
+	for (i = 0; i != n; i++)
+		secretbox_seal(m, c, m, 1024, nonce, k);
+	t = cpu_ns() - t;
+	printf("seal %llu MB/s\n",
+	    (unsigned long long) n * 1024 * 1000 / (t ? t : 1));
+
+	/* "m" now holds the last box, with the authenticator at "c" */
+	t = cpu_ns();
+	for (i = 0; i != n; i++)
+		if (!secretbox_open(c + crypto_secretbox_ZEROBYTES, c, m, 1024,
+		    nonce, k))
+			printf("open failed\n");
+	t = cpu_ns() - t;
+	printf("open %llu MB/s\n",
+	    (unsigned long long) n * 1024 * 1000 / (t ? t : 1));
+}
+
+
+/*
+ * "Unlock" is what happens between entering the PIN and opening the database:
+ * deriving the master secret from the PIN and the pad, and setting up the keys
+ * (see accept_pin in ui_pin.c). If the database is open, we also measure
+ * pin_revalidate, which does the same, and then validates a block.
+ */
+
+/*
+ * hotp_bench measures the CPU time per HOTP code, computing codes one by one
+ * with hotp64, and for consecutive counter values with hotp64_batch.
+ */
+
+static void hotp_bench(unsigned n)
+{
+	static const uint8_t k[20] = "12345678901234567890";
+	uint32_t res[MAX_HOTP];
+	uint64_t t;
+	unsigned i;
+
+	t = cpu_ns();
+	for (i = 0; i != n * MAX_HOTP; i++)
+		res[i % MAX_HOTP] = hotp64(k, sizeof(k), i);
+	printf("hotp %llu ns\n",
+	    (unsigned long long) (cpu_ns() - t) / n / MAX_HOTP);
+
+	t = cpu_ns();
+	for (i = 0; i != n; i++)
+		hotp64_batch(res, k, sizeof(k), (uint64_t) i * MAX_HOTP,
+		    MAX_HOTP);
+	printf("hotp batch %llu ns\n",
+	    (unsigned long long) (cpu_ns() - t) / n / MAX_HOTP);
+}
+
+
+static void crypto_bench(unsigned n)
+{
+	uint8_t secret[MASTER_SECRET_BYTES];
+	uint8_t pk[crypto_scalarmult_BYTES];
+	uint8_t q[crypto_scalarmult_BYTES];
+	uint64_t t;
+	unsigned i;
+
+	t = cpu_ns();
+	for (i = 0; i != n; i++)
+		crypto_scalarmult_base(pk, master_secret);
+	printf("scalarmult_base %llu us\n",
+	    (unsigned long long) (cpu_ns() - t) / n / 1000);
+
+	t = cpu_ns();
+	for (i = 0; i != n; i++)
+		crypto_scalarmult(q, master_secret, pk);
+	printf("scalarmult %llu us\n",
+	    (unsigned long long) (cpu_ns() - t) / n / 1000);
+
+	box_bench(100 * n);
+	hotp_bench(100 * n);
+
+	t = cpu_ns();
+	for (i = 0; i != n; i++) {
+		if (!secrets_setup(secret, NULL, 0xffff1234)) {
+			printf("no pad\n");
+			return;
+		}
+		dbcrypt_free(dbcrypt_init(secret, sizeof(secret)));
+	}
+	printf("unlock %llu us\n",
+	    (unsigned long long) (cpu_ns() - t) / n / 1000);
+	memset(secret, 0, sizeof(secret));
+
+	if (!main_db.c)
+		return;
+	t = cpu_ns();
+	for (i = 0; i != n; i++)
+		if (!pin_revalidate(0xffff1234)) {
+			printf("revalidation failed\n");
+			return;
+		}
+	printf("revalidate %llu us\n",
+	    (unsigned long long) (cpu_ns() - t) / n / 1000);
+}
+
+
 static void show_help(void)
 {
 	printf("Commands:\n\n"
@@ -415,13 +855,42 @@ static void show_help(void)
 "\t\tBEFORE is omitted)\n"
 "db dump\t\tprint the content of the database\n"
 "db sort\t\tsort the database\n"
-"db open\t\topen the database\n"
+"db open [STEP]\topen the database. With STEP, open it in steps of STEP\n"
+"\t\tblocks, until the first entry is found\n"
+"db step [N]\tcontinue opening the database for N steps (default: all)\n"
 "db stats\tshow block statistics\n"
 "db blocks\tdump block types\n"
+"db crypt\tshow decryption statistics\n"
+"db summary\tshow the open-time summary\n"
+"db flash\tshow the simulated Flash time, and how long we waited\n"
+"\t\tfor it\n"
+"db iostats [reset]\n\t\tshow (or reset) storage operations since startup\n"
+"db wear\t\tshow the distribution of erases over the data area\n"
+"db mem\t\tshow how much memory database entries use\n"
+"db pack\t\trewrite all entries into as few blocks as possible\n"
+"db gc [SECTORS]\tshow erase statistics, or set the number of erase blocks\n"
+"\t\tto keep erased\n"
+"db hotp NAME N\tincrement the HOTP counter of an entry N times\n"
 "db new NAME\tcreate a new block\n"
 "db delete NAME\tdelete a block\n"
 "db change NAME\tchange a field in a block\n"
+"db rename NAME NEW\n\t\trename an entry\n"
 "db remove NAME\tremove a field from a block\n"
+"crypto base SCALAR\n\t\tmultiply the base point by a scalar (hex)\n"
+"crypto bench [N]\n\t\tshow the CPU time of scalar multiplications, of\n"
+"\t\tunlocking with PIN 0xffff1234, and (if the database is open)\n"
+"\t\tof revalidating the PIN, averaged over N runs, and the\n"
+"\t\tthroughput of crypto_secretbox on 1 kB blocks, and the time\n"
+"\t\tper HOTP code\n"
+"crypto hotp KEY COUNT [N]\n"
+"\t\tprint the HOTP codes of N counter values from COUNT\n"
+"crypto poly1305 KEY [MESSAGE]\n"
+"\t\tcompute the authenticator of a message (hex)\n"
+"crypto secretbox KEY NONCE [MESSAGE]\n"
+"\t\tencrypt a message (hex), then decrypt it again\n"
+"crypto sha1 MESSAGE\n\t\thash a message (hex) with SHA1\n"
+"crypto sha256 MESSAGE\n\t\thash a message (hex) with SHA256\n"
+"crypto x25519 SCALAR POINT [N]\n\t\tmultiply (hex), N times as in RFC 7748\n"
 "down X Y\ttouch the touch screen\n"
 "drag X0 Y0 X1 Y1\n"
 "\t\tdrag gesture\n"
@@ -688,7 +1157,7 @@ static bool process_cmd(const char *cmd)
 				goto fail;
 			}
 		}
-		if (!strcmp(op, "open")) {
+		if (!strcmp(op, "open") && args <= 2) {
 			struct dbcrypt *c;
 
 			secrets_init();
@@ -697,7 +1166,31 @@ static bool process_cmd(const char *cmd)
 				fprintf(stderr, "dbcrypt_init failed\n");
 				exit(1);
 			}
-			db_open(&main_db, c);
+			if (args == 1) {
+				db_open(&main_db, c);
+				return 1;
+			}
+			open_step = atoi(name);
+			if (!open_step)
+				goto fail;
+			open_steps = 0;
+			open_t0 = storage_time_ns;
+			db_open_begin(&main_db, c);
+			while (!main_db.entries && open_db_step())
+				;
+			if (main_db.entries)
+				open_report("first");
+			return 1;
+		}
+		if (!strcmp(op, "step") && args <= 2) {
+			unsigned steps = ~0U;
+
+			if (args == 2)
+				steps = atoi(name);
+			if (!db_opening(&main_db))
+				goto fail;
+			while (steps-- && open_db_step())
+				;
 			return 1;
 		}
 		if (!strcmp(op, "stats")) {
@@ -709,11 +1202,122 @@ static bool process_cmd(const char *cmd)
 			    main_db.stats.empty);
 			return 1;
 		}
+		if (!strcmp(op, "crypt")) {
+			struct dbcrypt_stats s;
+
+			dbcrypt_stats(main_db.c, &s);
+			printf("shared hit %u miss %u trials %u\n",
+			    s.shared_hit, s.shared_miss, s.trials);
+			return 1;
+		}
+		if (!strcmp(op, "iostats") && args == 1) {
+			struct storage_io_stats s;
+
+			db_io_stats(&s);
+			printf("read %u bytes %u\n", s.reads, s.read_bytes);
+			printf("program %u bytes %u\n",
+			    s.programs, s.program_bytes);
+			printf("erase %u bytes %u max %u\n",
+			    s.erases, s.erase_bytes, s.max_sector_erases);
+			return 1;
+		}
+		if (!strcmp(op, "iostats") && args == 2 &&
+		    !strcmp(name, "reset")) {
+			db_io_reset();
+			return 1;
+		}
+		if (!strcmp(op, "gc")) {
+			struct db_gc_stats s;
+
+			switch (args) {
+			case 1:
+				db_gc_stats(&main_db, &s);
+				printf("gc erased %u foreground %u "
+				    "background %u\n", main_db.stats.erased,
+				    s.foreground, s.background);
+				return 1;
+			case 2:
+				main_db.gc_sectors = atoi(name);
+				return 1;
+			default:
+				goto fail;
+			}
+		}
+		if (!strcmp(op, "pack") && args == 1) {
+			int blocks = db_pack(&main_db);
+
+			if (blocks < 0)
+				printf("failed\n");
+			else
+				printf("%d\n", blocks);
+			return 1;
+		}
+		if (!strcmp(op, "mem") && args == 1) {
+			struct arena_stats s;
+
+			db_mem_stats(&main_db, &s);
+			printf("chunks %u size %u objects %u\n",
+			    s.chunks, (unsigned) s.size, s.objects);
+			printf("in-use %u high %u free %u\n",
+			    (unsigned) s.in_use, (unsigned) s.high_water,
+			    (unsigned) s.free);
+			return 1;
+		}
+		if (!strcmp(op, "wear") && args == 1) {
+			unsigned erase_size = storage_erase_size();
+			unsigned first = RESERVED_BLOCKS / erase_size;
+			unsigned end = main_db.summary_base / erase_size;
+			unsigned min = ~0U, max = 0, sum = 0;
+			unsigned i, count;
+
+			for (i = first; i != end; i++) {
+				unsigned erases = storage_sector_erases(i);
+
+				if (erases < min)
+					min = erases;
+				if (erases > max)
+					max = erases;
+				sum += erases;
+			}
+			printf("sectors %u erases %u min %u max %u\n",
+			    end - first, sum, min, max);
+
+			/* histogram: "erases:sectors" */
+			for (count = min; count <= max; count++) {
+				unsigned sectors = 0;
+
+				for (i = first; i != end; i++)
+					if (storage_sector_erases(i) == count)
+						sectors++;
+				if (sectors)
+					printf("%s%u:%u",
+					    count == min ? "" : " ",
+					    count, sectors);
+			}
+			printf("\n");
+			return 1;
+		}
+		if (!strcmp(op, "flash")) {
+			printf("flash %llu us wait %llu us\n",
+			    (unsigned long long) storage_time_ns / 1000,
+			    (unsigned long long) storage_wait_ns / 1000);
+			return 1;
+		}
+		if (!strcmp(op, "summary")) {
+			if (main_db.summary_block < 0)
+				printf("summary none");
+			else
+				printf("summary %d", main_db.summary_block);
+			printf(" log %u scanned %u\n",
+			    main_db.summary_log, main_db.scanned);
+			return 1;
+		}
 		if (!strcmp(arg, "blocks")) {
 			bool first = 1;
 			unsigned i;
 
-			for (i = RESERVED_BLOCKS; i != main_db.stats.total; i++)
+			for (i = RESERVED_BLOCKS; i != main_db.summary_base;
+			    i++)
 				switch (block_read(main_db.c,
 				    NULL, NULL, NULL, i)) {
 				case bt_data:
@@ -769,6 +1373,35 @@ static bool process_cmd(const char *cmd)
 				printf("failed\n");
 			return 1;
 		}
+		if (!strcmp(op, "hotp") && args == 3) {
+			struct db_entry *de = find_entry(name);
+			const struct db_field *f;
+			uint64_t counter = 0;
+			unsigned left;
+
+			f = db_field_find(de, ft_hotp_counter);
+			if (f)
+				memcpy(&counter, f->data, sizeof(counter));
+			for (left = atoi(prev); left; left--) {
+				counter++;
+				if (!db_change_field(de, ft_hotp_counter,
+				    &counter, sizeof(counter))) {
+					printf("failed\n");
+					return 1;
+				}
+			}
+			printf("%llu\n", (unsigned long long) counter);
+			return 1;
+		}
+		if (!strcmp(op, "rename") && args == 3) {
+			struct db_entry *de = find_entry(name);
+
+			if (db_change_field(de, ft_id, prev, strlen(prev)))
+				printf("%u\n", de->block);
+			else
+				printf("failed\n");
+			return 1;
+		}
 		arg2 = cmd_arg("remove", arg);
 		if (arg2) {
 			struct db_entry *de = find_entry(arg2);
@@ -815,6 +1448,69 @@ static bool process_cmd(const char *cmd)
 		goto fail;
 	}
 
+	/* crypto */
+
+	arg = cmd_arg("crypto", cmd);
+	if (arg) {
+		const char *arg2;
+
+		if (!strcmp("bench", arg)) {
+			crypto_bench(10);
+			return 1;
+		}
+		arg2 = cmd_arg("bench", arg);
+		if (arg2) {
+			n = atoi(arg2);
+			if (!n)
+				goto fail;
+			crypto_bench(n);
+			return 1;
+		}
+		arg2 = cmd_arg("x25519", arg);
+		if (arg2) {
+			if (!do_x25519(arg2))
+				goto fail;
+			return 1;
+		}
+		arg2 = cmd_arg("base", arg);
+		if (arg2) {
+			if (!do_x25519_base(arg2))
+				goto fail;
+			return 1;
+		}
+		arg2 = cmd_arg("secretbox", arg);
+		if (arg2) {
+			if (!do_secretbox(arg2))
+				goto fail;
+			return 1;
+		}
+		arg2 = cmd_arg("poly1305", arg);
+		if (arg2) {
+			if (!do_poly1305(arg2))
+				goto fail;
+			return 1;
+		}
+		arg2 = cmd_arg("sha1", arg);
+		if (arg2) {
+			if (!do_sha(arg2, 0))
+				goto fail;
+			return 1;
+		}
+		arg2 = cmd_arg("sha256", arg);
+		if (arg2) {
+			if (!do_sha(arg2, 1))
+				goto fail;
+			return 1;
+		}
+		arg2 = cmd_arg("hotp", arg);
+		if (arg2) {
+			if (!do_hotp(arg2))
+				goto fail;
+			return 1;
+		}
+		goto fail;
+	}
+
 	/* master*/
 
 	arg = cmd_arg("master", cmd);
@@ -16,6 +16,7 @@
 #include "hal.h"
 #include "fmt.h"
 #include "debug.h"
+#include "storage.h"
 
 
 bool quiet = 0;
@@ -39,7 +40,9 @@ uint64_t time_us(void)
 	if (time_override != -1)
 		return time_override * 1e6;
 	gettimeofday(&tv, NULL);
-	return (uint64_t) tv.tv_sec * 1000000UL + tv.tv_usec;
+	/* without sleeping, waiting for the Flash only advances our clock */
+	return (uint64_t) tv.tv_sec * 1000000UL + tv.tv_usec +
+	    (storage_timing.sleep ? 0 : storage_wait_ns / 1000);
 }
 
 #endif /* !SDK */
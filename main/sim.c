@@ -23,6 +23,7 @@
 #include "gfx.h"
 #include "ui.h"
 #include "storage.h"
+#include "block.h"
 #include "fake-rmt.h"
 #include "script.h"
 #include "sim.h"
@@ -360,9 +361,19 @@ static void usage(const char *name)
 "-D  set the global debugging flag (use changes during development)\n"
 "-d database\n"
 "    set the database file (default: %s)\n"
+"-F w25q128|READ_NS,PROGRAM_US,ERASE_US[,sleep]\n"
+"    simulate Flash latency per byte read, per page written, and per erase\n"
+"    block. With \"sleep\", wait. Else, only advance the clock. Can also be\n"
+"    set with the environment variable SIM_FLASH_TIMING.\n"
+"-j threads\n"
+"    decrypt blocks with that many threads when opening the database\n"
+"    (default: 1). Can also be set with the environment variable SIM_THREADS.\n"
 "-q  quiet. Disable debugging output.\n"
 "-R /path/to/socket\n"
 "    open Unix domain SEQPACKET socket for RMT communication\n"
+"-S write|sector|exit|never\n"
+"    write changes to the database file after each write, when moving to\n"
+"    a different erase block, only on exit, or never (default: exit)\n"
 "-s screenshot\n"
 "    set the screenshot file name. if present, %%u is converted to the\n"
 "    screenshot number (starts at 0). The usual printf conversion\n"
@@ -374,9 +385,17 @@ static void usage(const char *name)
 
 int main(int argc, char **argv)
 {
+	const char *timing = getenv("SIM_FLASH_TIMING");
+	const char *threads = getenv("SIM_THREADS");
 	int c, i;
 
-	while ((c = getopt(argc, argv, "+24CDd:qR:s:")) != EOF)
+	if (timing && !storage_timing_parse(timing)) {
+		fprintf(stderr, "invalid SIM_FLASH_TIMING \"%s\"\n", timing);
+		exit(1);
+	}
+	if (threads)
+		block_threads = atoi(threads);
+	while ((c = getopt(argc, argv, "+24CDd:F:j:qR:S:s:")) != EOF)
 		switch (c) {
 		case '2':
 			zoom = 2;
@@ -393,6 +412,13 @@ int main(int argc, char **argv)
 		case 'd':
 			storage_file = optarg;
 			break;
+		case 'F':
+			if (!storage_timing_parse(optarg))
+				usage(*argv);
+			break;
+		case 'j':
+			block_threads = atoi(optarg);
+			break;
 		case 'q':
 			quiet = 1;
 			break;
@@ -400,6 +426,18 @@ int main(int argc, char **argv)
 			fake_rmt_init(optarg);
 			fake_rmt = 1;
 			break;
+		case 'S':
+			if (!strcmp(optarg, "write"))
+				storage_durability = sd_write;
+			else if (!strcmp(optarg, "sector"))
+				storage_durability = sd_sector;
+			else if (!strcmp(optarg, "exit"))
+				storage_durability = sd_exit;
+			else if (!strcmp(optarg, "never"))
+				storage_durability = sd_never;
+			else
+				usage(*argv);
+			break;
 		case 's':
 			screenshot_name = optarg;
 			break;
@@ -88,11 +88,8 @@ void rmt_db_poll(void)
 			break;
 		case RDOP_SHOW:
 			f = NULL;
-			for (de = main_db.entries; de; de = de->next)
-				if (strlen(de->name) == (size_t) got - 1 &&
-				    !strncmp(de->name, (const char *) buf + 1,
-				    got - 1))
-					break;
+			de = db_find_entry(&main_db, (const char *) buf + 1,
+			    got - 1);
 			if (!de) {
 				op = RDOP_NOT_FOUND;
 				break;
@@ -104,11 +101,8 @@ void rmt_db_poll(void)
 				op = RDOP_INVALID;
 				return;
 			}
-			for (de = main_db.entries; de; de = de->next)
-				if (strlen(de->name) == (size_t) got - 2 &&
-				    !strncmp(de->name, (const char *) buf + 1,
-				    got - 2))
-					break;
+			de = db_find_entry(&main_db, (const char *) buf + 1,
+			    got - 2);
 			if (!de) {
 				op = RDOP_NOT_FOUND;
 				break;
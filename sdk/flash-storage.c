@@ -44,24 +44,54 @@ unsigned storage_erase_size(void)
 }
 
 
-bool storage_read_block(void *buf, unsigned n)
+bool storage_read_blocks(void *buf, unsigned n, unsigned n_blocks)
 {
 	uint32_t addr = FLASH_STORAGE_BASE + n * STORAGE_BLOCK_SIZE;
 	int ret;
 
-	assert(n < FLASH_STORAGE_SIZE / STORAGE_BLOCK_SIZE);
-	ret = bflb_flash_read(addr, buf, STORAGE_BLOCK_SIZE);
-//debug("read (%d 0x%08lx) %d\n", n, (unsigned long) addr, ret);
+	assert(n + n_blocks <= FLASH_STORAGE_SIZE / STORAGE_BLOCK_SIZE);
+	/* a single command, so that the Flash can stream the data */
+	ret = bflb_flash_read(addr, buf, n_blocks * STORAGE_BLOCK_SIZE);
+	storage_count_read(n_blocks);
+//debug("read (%d+%u 0x%08lx) %d\n", n, n_blocks, (unsigned long) addr, ret);
 	return !ret;
 }
 
 
+bool storage_read_block(void *buf, unsigned n)
+{
+	return storage_read_blocks(buf, n, 1);
+}
+
+
+/*
+ * bflb_flash_read only returns when the data has arrived, so we can't read in
+ * the background, and db_open reads each chunk when it needs it. Reading does
+ * not overlap with decryption on the device.
+ *
+ * @@@ to overlap them, we'd have to start a DMA transfer from the
+ * (memory-mapped) Flash here, and wait for it in storage_read_wait.
+ */
+
+bool storage_read_start(void *buf, unsigned n, unsigned n_blocks)
+{
+	return 0;
+}
+
+
+bool storage_read_wait(void)
+{
+	return 1;
+}
+
+
 bool storage_write_block(const void *buf, unsigned n)
 {
 	uint32_t addr = FLASH_STORAGE_BASE + n * STORAGE_BLOCK_SIZE;
 
 /* @@@ we probably need to disable interrupts while erasing / writing Flash */
 	assert(n < FLASH_STORAGE_SIZE / STORAGE_BLOCK_SIZE);
+	storage_count_program();
 	return !bflb_flash_write(addr, (void *) buf, STORAGE_BLOCK_SIZE);
 }
 
@@ -73,6 +103,12 @@ bool storage_erase_blocks(unsigned n, unsigned n_blocks)
 	assert(n < FLASH_STORAGE_SIZE / STORAGE_BLOCK_SIZE);
 	assert(!(n % ERASE_SIZE));
 	assert(!(n_blocks % ERASE_SIZE));
+	storage_count_erase(n, n_blocks);
 	return !bflb_flash_erase(addr, n_blocks * STORAGE_BLOCK_SIZE);
 }
 
+
+void storage_flush(void)
+{
+	/* Flash operations complete before they return */
+}
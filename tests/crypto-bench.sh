@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# crypto-bench.sh - Measure the CPU time of cryptographic operations in the sim
+#
+# This work is licensed under the terms of the MIT License.
+# A copy of the license can be found in the file LICENSE.MIT
+#
+
+#
+# We report the CPU time of one scalar multiplication of the base point, of one
+# of another point, and of unlocking: from entering the PIN until the keys for
+# opening the database are ready. Unlocking does five scalar multiplications
+# (three in secrets_setup, one of the base point and one other in
+# dbcrypt_init), plus hashing. Revalidating the PIN (pin_revalidate, e.g.,
+# before changing it) does the same, and then decrypts a block.
+#
+# We also report the throughput of crypto_secretbox and crypto_secretbox_open
+# on 1 kB, the size of a storage block, and of secretbox_seal and
+# secretbox_open, which encrypt and decrypt the database blocks in place, and
+# the CPU time per HOTP code, computed one by one, and in a batch of
+# consecutive counter values.
+#
+# To compare the implementations of Curve25519, or of Salsa20 and Poly1305, run
+# this once with the sim built normally, and once after
+# make sim CURVE25519=tweetnacl
+# or
+# make sim SECRETBOX=tweetnacl
+#
+
+PK=AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA====
+
+
+usage()
+{
+	echo "usage: $0 [-x] [runs]" 1>&2
+	exit 1
+}
+
+
+while [ "$1" ]; do
+	case "$1" in
+	-x)	set -x;;
+	-*)	usage;;
+	*)	break;;
+	esac
+	shift
+done
+
+[ "$2" ] && usage
+
+echo '[ { "id":"acct" } ]' | ../tools/accenc.py /dev/stdin $PK >_db || exit
+../sim -q -d _db -C "db open" "crypto bench ${1:-10}"
@@ -0,0 +1,226 @@
+#!/bin/sh
+#
+# crypto.sh - Test cryptographic primitives against published test vectors
+#
+# This work is licensed under the terms of the MIT License.
+# A copy of the license can be found in the file LICENSE.MIT
+#
+
+
+run()
+{
+	local title=$1
+	local s="../sim -q -C"
+
+	shift
+	echo -n "$title: " 1>&2
+
+	for n in "$@"; do
+		s="$s '$n'"
+	done
+	if ! eval $s 2>&1 >_out; then
+		echo "FAILED" 1>&2
+		exit 1
+	else
+		if diff -u - _out >_diff; then
+			echo "PASSED" 1>&2
+			rm -f _diff
+		else
+			echo "FAILED" 1>&2
+			cat _diff 1>&2
+			exit 1
+		fi
+	fi
+}
+
+
+usage()
+{
+	echo "usage: $0 [-x]" 1>&2
+	exit 1
+}
+
+
+while [ "$1" ]; do
+	case "$1" in
+	-x)	set -x;;
+	-*)	usage;;
+	*)	break;;
+	esac
+	shift
+done
+
+[ "$1" ] && usage
+
+
+# --- X25519, RFC 7748 section 5.2 --------------------------------------------
+
+run x25519 \
+    "crypto x25519 a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4 e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c" \
+    "crypto x25519 4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493" <<EOF
+c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552
+95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957
+EOF
+
+run x25519-iterated \
+    "crypto x25519 0900000000000000000000000000000000000000000000000000000000000000 0900000000000000000000000000000000000000000000000000000000000000" \
+    "crypto x25519 0900000000000000000000000000000000000000000000000000000000000000 0900000000000000000000000000000000000000000000000000000000000000 1000" <<EOF
+422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079
+684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51
+EOF
+
+# --- Key exchange, RFC 7748 section 6.1 (also NaCl's tests/box.c) -----------
+
+#
+# The points of Alice and Bob are their public keys, i.e., their secret keys
+# times the base point 9.
+#
+
+run x25519-dh \
+    "crypto x25519 77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a 0900000000000000000000000000000000000000000000000000000000000000" \
+    "crypto x25519 5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb 0900000000000000000000000000000000000000000000000000000000000000" \
+    "crypto x25519 77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f" \
+    "crypto x25519 5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb 8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a" <<EOF
+8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a
+de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f
+4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742
+4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742
+EOF
+
+#
+# crypto_scalarmult_base uses a table of multiples of the base point, not the
+# ladder, so we check that it yields the same public keys.
+#
+
+run x25519-base \
+    "crypto base 77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a" \
+    "crypto base 5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb" \
+    "crypto base ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff" \
+    "crypto x25519 ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff 0900000000000000000000000000000000000000000000000000000000000000" <<EOF
+8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a
+de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f
+847c0d2c375234f365e660955187a3735a0f7613d1609d3a6a4d8c53aeaa5a22
+847c0d2c375234f365e660955187a3735a0f7613d1609d3a6a4d8c53aeaa5a22
+EOF
+
+# --- Poly1305, RFC 8439 section 2.5.2 and appendix A.3 (#5, #6, #7) ---------
+
+run poly1305 \
+    "crypto poly1305 85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b 43727970746f6772617068696320466f72756d2052657365617263682047726f7570" <<EOF
+a8061dc1305136c6c22b8baf0c0127a9
+EOF
+
+#
+# These make the accumulator reach, or exceed, p = 2^130 - 5, and check that the
+# final reduction handles it.
+#
+
+run poly1305-reduce \
+    "crypto poly1305 0200000000000000000000000000000000000000000000000000000000000000 ffffffffffffffffffffffffffffffff" \
+    "crypto poly1305 02000000000000000000000000000000ffffffffffffffffffffffffffffffff 02000000000000000000000000000000" \
+    "crypto poly1305 0100000000000000000000000000000000000000000000000000000000000000 fffffffffffffffffffffffffffffffff0ffffffffffffffffffffffffffffff11000000000000000000000000000000" <<EOF
+03000000000000000000000000000000
+03000000000000000000000000000000
+05000000000000000000000000000000
+EOF
+
+# --- XSalsa20-Poly1305, NaCl's tests/secretbox.c ----------------------------
+
+run secretbox \
+    "crypto secretbox 1b27556473e985d462cd51197a9a46c76009549eac6474f206c4ee0844f68389 69696ee955b62b73cd62bda875fc73d68219e0036b7a0b37 be075fc53c81f2d5cf141316ebeb0c7b5228c52a4c62cbd44b66849b64244ffce5ecbaaf33bd751a1ac728d45e6c61296cdc3c01233561f41db66cce314adb310e3be8250c46f06dceea3a7fa1348057e2f6556ad6b1318a024a838f21af1fde048977eb48f59ffd4924ca1c60902e52f0a089bc76897040e082f937763848645e0705" <<EOF
+f3ffc7703f9400e52a7dfb4b3d3305d98e993b9f48681273c29650ba32fc76ce
+48332ea7164d96a4476fb8c531a1186ac0dfc17c98dce87b4da7f011ec48c972
+71d2c20f9b928fe2270d6fb863d51738b48eeee314a7cc8ab932164548e526ae
+90224368517acfeabd6bb3732bc0e9da99832b61ca01b6de56244a9e88d5f9b3
+7973f622a43d14a6599b1f654cb45a74e355a5
+EOF
+
+#
+# A longer message also goes through the multi-block path of Salsa20 on the
+# host, and then through single blocks. The ciphertext is from libsodium.
+#
+
+m=`i=0; while [ $i -lt 600 ]; do printf %02x $((i & 255)); i=$((i + 1)); done`
+
+run secretbox-long \
+    "crypto secretbox 000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f 6465666768696a6b6c6d6e6f707172737475767778797a7b $m" <<EOF
+dd72a22b72bb3b7193efba92992f206a02b89bca3eb3c8eeb8f4299f3b89ad17
+2ebb2ab4f0b35d0cbe15588f1696d797884ed63b6b12bdc3dd3f3d492c3ef34a
+f1a19c2b26b30f683bd8693fe78fa05b03ca0e2e8c790ecdf1c655b90c8ea3dc
+04c6df54f3aa2d55cac2d37c24bbbb999aa88b188bbc5ca06b1215e0d031fb57
+085ee439a35e367e38f574d8986ca8433e818f9bb34b9b8ec5aaa1b351446eda
+f3ba648cb9b2e48b33903de9faa5576f21de898b797475c03a49498df5154c48
+4c1344ae4d5491adfdc29638f8e4a0ff70ac408e0b6bea13acb33eee82f19422
+a9e0a6a5048823c701814ff2bd562a4ff2517e5c53280bfa73f514f8ba10826f
+faa626f3f206e26da5402a6a0bad415d7da1501679f80e401ff6ecd5d87a3248
+687b400670c7b4b551ade60ae52461d57910368dd85fe19edecab59549980c94
+4a3a5eefe0bce6c0ed20058ebf080324defb207ce598bb0278b378ffd570a96c
+cfc2c647d63475697dae74a00bbbe3038c5737439c807f7a635ceca20c5d1473
+1c3455e45ec67816b52aa96166e0accbbc37e5785466312010406dbd43b67213
+be70e15b02bf39559c996c64b5a5dc0e4c91edfe92ce162d5c53f67be8aaa7e0
+3f0c02553dce12accceb23899d828039a75c1b3f7312ca4663b68ff3b95eb56f
+9b253da2fd8b8910f2c28dcabdf7c186caf1fa73ebd72bdc7a22e04a0955d610
+dcdaecdebb4905a1995ad99a806457edfb0a1e0386eab4c8197044bd383ab162
+bd2e1dccaf7360cce92b55654c48a9af7ae2c5168948dc14e01522f1db6b0886
+b066da99bf6fa0423b50bf99a6ab2e6a9b5fe659720d3dd19df36055eedefac4
+8229767d67736792
+EOF
+
+#
+# secretbox_seal and secretbox_open handle the first 32 bytes of the message
+# with the first block of the key stream, and the rest with the following
+# blocks. Try a message that ends in the first block, and one that just goes
+# beyond it.
+#
+
+run secretbox-short \
+    "crypto secretbox 000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f 6465666768696a6b6c6d6e6f707172737475767778797a7b c8c9cacbcc" <<EOF
+586e9aa552b5aa58ed44881cb33566d8ca705302f6
+EOF
+
+run secretbox-33 \
+    "crypto secretbox 000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f 6465666768696a6b6c6d6e6f707172737475767778797a7b 000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20" <<EOF
+1d1b4fa07aa2c5234c63cf6e1842f76702b89bca3eb3c8eeb8f4299f3b89ad17
+2ebb2ab4f0b35d0cbe15588f1696d79788
+EOF
+
+#
+# SHA1 and SHA256, FIPS 180-2, appendix A and B. The 56-byte message leaves no
+# room for the length in its last block, so padding adds a block. do_sha also
+# compares the batch functions and, if the CPU has them, the SHA instructions.
+#
+
+run sha1-abc "crypto sha1 616263" <<EOF
+a9993e364706816aba3e25717850c26c9cd0d89d
+EOF
+
+run sha1-56 "crypto sha1 6162636462636465636465666465666765666768666768696768696a68696a6b696a6b6c6a6b6c6d6b6c6d6e6c6d6e6f6d6e6f706e6f7071" <<EOF
+84983e441c3bd26ebaae4aa1f95129e5e54670f1
+EOF
+
+run sha256-abc "crypto sha256 616263" <<EOF
+ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad
+EOF
+
+run sha256-56 "crypto sha256 6162636462636465636465666465666765666768666768696768696a68696a6b696a6b6c6a6b6c6d6b6c6d6e6c6d6e6f6d6e6f706e6f7071" <<EOF
+248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1
+EOF
+
+#
+# HOTP, RFC 4226, appendix D
+#
+
+run hotp "crypto hotp 3132333435363738393031323334353637383930 0 10" <<EOF
+755224
+287082
+359152
+969429
+338314
+254676
+287922
+162583
+399871
+520489
+EOF
+
+rm -f _out
@@ -0,0 +1,80 @@
+#
+# db-lib.sh - Common functions of the database tests (sourced)
+#
+# This work is licensed under the terms of the MIT License.
+# A copy of the license can be found in the file LICENSE.MIT
+#
+
+#
+# run [-D] TITLE COMMAND ... <<EOF
+# runs the sim with the database in _db, and compares its output with stdin.
+#
+# json <<EOF
+# makes _db from the accounts in JSON format, encrypted with PK.
+#
+
+
+PK=AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA====
+
+
+run()
+{
+	local debug=
+
+	if [ "$1" = -D ]; then
+		debug=-D
+		shift
+	fi
+
+	local title=$1
+	local s="../sim $debug -q -d "$dir/_db" -C"
+
+	shift
+	echo -n "$title: " 1>&2
+
+	for n in "$@"; do
+		s="$s '$n'"
+	done
+	if ! eval $s 2>&1 >_out; then
+		echo "FAILED" 1>&2
+		exit 1
+	else
+		if diff -u - _out >_diff; then
+			echo "PASSED" 1>&2
+			rm -f _diff
+		else
+			echo "FAILED" 1>&2
+			cat _diff 1>&2
+			exit 1
+		fi
+	fi
+}
+
+
+json()
+{
+	"$top/tools/accenc.py" /dev/stdin $PK >"$dir/_db" || exit
+}
+
+
+usage()
+{
+	echo "usage: $0 [-x]" 1>&2
+	exit 1
+}
+
+
+self=`which "$0"`
+dir=`dirname "$self"`
+top=$dir/..
+
+while [ "$1" ]; do
+	case "$1" in
+	-x)	set -x;;
+	-*)	usage;;
+	*)	break;;
+	esac
+	shift
+done
+
+[ "$1" ] && usage
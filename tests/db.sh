@@ -8,46 +8,15 @@
 #
 
 
-PK=AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA====
+. `dirname "$0"`/db-lib.sh
 
-
-run()
-{
-	local debug=
-
-	if [ "$1" = -D ]; then
-		debug=-D
-		shift
-	fi
-
-	local title=$1
-	local s="../sim $debug -q -d "$dir/_db" -C"
-
-	shift
-	echo -n "$title: " 1>&2
-
-	for n in "$@"; do
-		s="$s '$n'"
-	done
-	if ! eval $s 2>&1 >_out; then
-		echo "FAILED" 1>&2
-		exit 1
-	else
-		if diff -u - _out >_diff; then
-			echo "PASSED" 1>&2
-			rm -f _diff
-		else
-			echo "FAILED" 1>&2
-			cat _diff 1>&2
-			exit 1
-		fi
-	fi
-}
+PUB=F7SX3I2HZVREGFJI3KWF7OZJA4YP75UEV7CM7QXNSCMV6WGLHN2A====	# from PK
+OTHER=AEAQCAIBAEAQCAIBAEAQCAIBAEAQCAIBAEAQCAIBAEAQCAIBAEAQ====
 
 
-json()
+json_other()
 {
-	"$top/tools/accenc.py" /dev/stdin $PK >"$dir/_db" || exit
+	"$top/tools/accenc.py" /dev/stdin $OTHER "$@" >"$dir/_db" || exit
 }
 
 
@@ -58,34 +27,11 @@ empty()
 }
 
 
-usage()
-{
-	echo "usage: $0 [-x]" 1>&2
-	exit 1
-}
-
-
-self=`which "$0"`
-dir=`dirname "$self"`
-top=$dir/..
-
-while [ "$1" ]; do
-	case "$1" in
-	-x)	set -x;;
-	-*)	usage;;
-	*)	break;;
-	esac
-	shift
-done
-
-[ "$1" ] && usage
-
-
 # --- Erased database ---------------------------------------------------------
 
 empty erased "db open" "db stats" "db blocks" <<EOF
 total 2048 invalid 0 data 0
-erased 2039 deleted 0 empty 0
+erased 2031 deleted 0 empty 0
 D8
 EOF
 
@@ -94,7 +40,7 @@ EOF
 empty new "db open" "db new blah" "db stats" "db blocks" <<EOF
 9
 total 2048 invalid 0 data 1
-erased 2038 deleted 0 empty 0
+erased 2030 deleted 0 empty 0
 D8 D9
 EOF
 
@@ -104,7 +50,7 @@ empty new-delete "db open" "db new blah" "db delete blah" "db stats" \
     "db blocks" <<EOF
 9
 total 2048 invalid 0 data 0
-erased 2038 deleted 1 empty 0
+erased 2030 deleted 1 empty 0
 D8 X9
 EOF
 
@@ -115,10 +61,23 @@ empty new-change "db open" "db new blah" "db change blah" "db stats" \
 9
 10
 total 2048 invalid 0 data 1
-erased 2037 deleted 1 empty 0
+erased 2029 deleted 1 empty 0
 D8 X9 D10
 EOF
 
+# --- Rename and delete entries ----------------------------------------------
+
+empty new-rename "db open" "db new foo" "db new bar" "db rename foo baz" \
+    "db delete bar" "db change baz" "db open" "db change baz" "db stats" <<EOF
+9
+10
+11
+13
+14
+total 2048 invalid 0 data 1
+erased 2025 deleted 5 empty 0
+EOF
+
 # --- One existing entry ------------------------------------------------------
 
 json <<EOF
@@ -127,7 +86,7 @@ EOF
 
 run existing "db open" "db stats" "db blocks" <<EOF
 total 2048 invalid 0 data 1
-erased 2038 deleted 0 empty 0
+erased 2030 deleted 0 empty 0
 D8 D9
 EOF
 
@@ -139,7 +98,7 @@ EOF
 
 run existing-delete "db open" "db delete id" "db stats" "db blocks" <<EOF
 total 2048 invalid 0 data 0
-erased 2038 deleted 1 empty 0
+erased 2030 deleted 1 empty 0
 D8 X9
 EOF
 
@@ -152,7 +111,7 @@ EOF
 run existing-change "db open" "db change id" "db stats" "db blocks" <<EOF
 10
 total 2048 invalid 0 data 1
-erased 2037 deleted 1 empty 0
+erased 2029 deleted 1 empty 0
 D8 X9 D10
 EOF
 
@@ -165,6 +124,424 @@ EOF
 run existing-remove "db open" "db remove id" "db stats" "db blocks" <<EOF
 10
 total 2048 invalid 0 data 1
-erased 2037 deleted 1 empty 0
+erased 2029 deleted 1 empty 0
 D8 X9 D10
 EOF
+
+# --- Shared secrets: our own blocks ------------------------------------------
+
+json <<EOF
+[ { "id":"a" }, { "id":"b" }, { "id":"c" } ]
+EOF
+
+run shared-own "db open" "db crypt" "db stats" <<EOF
+shared hit 4 miss 0 trials 4
+total 2048 invalid 0 data 3
+erased 2028 deleted 0 empty 0
+EOF
+
+# --- Shared secrets: blocks from another writer ------------------------------
+
+json_other $PUB <<EOF
+[ { "id":"a" }, { "id":"b" }, { "id":"c" } ]
+EOF
+
+run shared-other "db open" "db crypt" "db stats" <<EOF
+shared hit 3 miss 1 trials 4
+total 2048 invalid 0 data 3
+erased 2028 deleted 0 empty 0
+EOF
+
+# --- Layout hint: we are the last of three readers ---------------------------
+
+#
+# Without the hint, each block would need 1 + 2 + 3 attempts. (Blocks decrypted
+# in parallel may not see the hint yet, so we use only one thread.)
+#
+
+json_other $OTHER $OTHER $PUB <<EOF
+[ { "id":"a" }, { "id":"b" }, { "id":"c" } ]
+EOF
+
+SIM_THREADS=1 run layout-hint "db open" "db crypt" "db stats" <<EOF
+shared hit 3 miss 1 trials 9
+total 2048 invalid 0 data 3
+erased 2028 deleted 0 empty 0
+EOF
+
+# --- Decrypting in parallel -------------------------------------------------
+
+#
+# With several threads, we get the same entries, in the same order, as with one.
+#
+
+json <<EOF
+[ { "id":"a", "user":"u" }, { "id":"b", "prev":"c" }, { "id":"c", "pw":"p" },
+  { "id":"d" }, { "id":"e", "prev":"a" }, { "id":"f" }, { "id":"g" } ]
+EOF
+
+SIM_THREADS=4 run threads "db open" "db change b" "db open" "db stats" \
+    "db dump" <<EOF
+16
+total 2048 invalid 0 data 7
+erased 2023 deleted 1 empty 0
+a -
+c -
+d -
+e a
+f -
+g -
+b c
+EOF
+
+# --- Summary: first open scans everything, later opens only live blocks ------
+
+json <<EOF
+[ { "id":"a" } ]
+EOF
+
+run summary-scan "db open" "db summary" <<EOF
+summary 2040 log 0 scanned 2032
+EOF
+
+run summary-log "db open" "db new b" "db summary" <<EOF
+10
+summary 2040 log 8 scanned 2
+EOF
+
+run summary-use "db open" "db summary" "db stats" "db blocks" <<EOF
+summary 2040 log 8 scanned 10
+total 2048 invalid 0 data 2
+erased 2029 deleted 0 empty 0
+D8 D9 D10
+EOF
+
+# --- Flash timing: erase the summary sector, then program blocks -------------
+
+#
+# Opening writes the first summary (one erase and four pages). "db new" then
+# writes the entry and logs the allocation (four pages each).
+#
+
+json <<EOF
+[ { "id":"a" } ]
+EOF
+
+export SIM_FLASH_TIMING=0,400,45000
+run flash-timing "db open" "db flash" "db new b" "db flash" <<EOF
+flash 46600 us wait 46600 us
+10
+flash 49800 us wait 49800 us
+EOF
+unset SIM_FLASH_TIMING
+
+# --- I/O budget: changing a field --------------------------------------------
+
+#
+# Changing a field writes the new block, logs the allocation in the summary,
+# and deletes the old block. Nothing is read or erased. The log also covers the
+# blocks after the new one, so the next change doesn't have to log again.
+#
+
+json <<EOF
+[ { "id":"a" }, { "id":"b" } ]
+EOF
+
+run io-change "db open" "db iostats reset" "db change a" "db iostats" \
+    "db iostats reset" "db change a" "db iostats" <<EOF
+11
+read 0 bytes 0
+program 3 bytes 3072
+erase 0 bytes 0 max 0
+12
+read 0 bytes 0
+program 2 bytes 2048
+erase 0 bytes 0 max 0
+EOF
+
+# --- Moving entries writes each changed entry once --------------------------
+
+#
+# The last move puts "d" at the top. "a" first loses its "prev" field, because
+# "d" has none, and then gets "d" again. All four entries share one block, and
+# we only write it once.
+#
+
+empty io-move "db open" "db new a" "db new b" "db new c" "db new d" \
+    "db move a" "db move c" "db iostats reset" "db move d b" "db iostats" \
+    "db dump" <<EOF
+9
+10
+11
+12
+read 0 bytes 0
+program 2 bytes 2048
+erase 0 bytes 0 max 0
+d -
+a d
+c a
+b d
+EOF
+
+# --- Packing ----------------------------------------------------------------
+
+#
+# accenc.py writes one entry per block. "db pack" moves them into one block.
+# The next change only rewrites that block.
+#
+
+json <<EOF
+[ { "id":"a", "user":"u" }, { "id":"b", "prev":"c" }, { "id":"c", "pw":"p" } ]
+EOF
+
+run pack "db open" "db pack" "db blocks" "db open" "db stats" "db dump" \
+    "db change a" "db blocks" <<EOF
+1
+D8 X9 X10 X11 D12
+total 2048 invalid 0 data 1
+erased 2027 deleted 3 empty 0
+a -
+c -
+b c
+13
+D8 X9 X10 X11 X12 D13
+EOF
+
+#
+# "x" and "y" fill a block exactly. When "x" grows, it moves to a block of its
+# own, and "y" to another one.
+#
+
+x=`printf "%0250u" 0 | tr 0 x`
+y=`printf "%0144u" 0 | tr 0 y`
+
+json <<EOF
+[ { "id":"x", "comment":"$x", "pw":"$x" },
+  { "id":"y", "comment":"$x", "pw":"$y" } ]
+EOF
+
+run split "db open" "db pack" "db change x" "db blocks" "db open" "db stats" \
+    "db dump" <<EOF
+1
+12
+D8 X9 X10 X11 D12 D13
+total 2048 invalid 0 data 2
+erased 2026 deleted 3 empty 0
+x -
+y -
+EOF
+
+#
+# "aaa" only exists in memory, and has no block. A new entry must not take it
+# along, or the record of "aaa", which has no fields, would end the block
+# before "bar".
+#
+
+empty unstored "db open" "db add aaa" "db new bar" "db open" "db stats" \
+    "db dump" <<EOF
+9
+total 2048 invalid 0 data 1
+erased 2030 deleted 0 empty 0
+bar -
+EOF
+
+#
+# "a" is a dummy without fields, which "db pack" must leave out. Otherwise its
+# empty record would end the block before "b".
+#
+
+json <<EOF
+[ { "id":"b" } ]
+EOF
+
+run pack-dummy "db open" "db add a" "db pack" "db open" "db stats" "db dump" \
+    <<EOF
+1
+total 2048 invalid 0 data 1
+erased 2029 deleted 1 empty 0
+b -
+EOF
+
+#
+# With one reader, a packed block holds 916 bytes of records, and a bt_data
+# block 916 bytes of fields. The record of "z" takes 917 bytes, so "z" stays in
+# its bt_data block when packing.
+#
+
+z=`printf "%0250u" 0 | tr 0 z`
+z2=`printf "%0152u" 0 | tr 0 z`
+
+json <<EOF
+[ { "id":"a", "user":"u" },
+  { "id":"z", "comment":"$z", "pw":"$z", "email":"$z", "pw2":"$z2" } ]
+EOF
+
+run pack-large "db open" "db pack" "db blocks" "db open" "db stats" "db dump" \
+    "db change a" <<EOF
+1
+D8 X9 D10 D11
+total 2048 invalid 0 data 2
+erased 2028 deleted 1 empty 0
+a -
+z -
+12
+EOF
+
+#
+# Adding a user field makes the record of "x" too large for a packed block, so
+# "x" moves to a bt_data block. "y" stays where it is.
+#
+
+x2=`printf "%0147u" 0 | tr 0 x`
+
+json <<EOF
+[ { "id":"x", "comment":"$x", "pw":"$x", "email":"$x", "pw2":"$x2" },
+  { "id":"y" } ]
+EOF
+
+run grow-large "db open" "db change x" "db blocks" "db open" "db stats" \
+    "db dump" <<EOF
+11
+D8 X9 D10 D11
+total 2048 invalid 0 data 2
+erased 2028 deleted 1 empty 0
+x -
+y -
+EOF
+
+# --- Memory used by entries -------------------------------------------------
+
+#
+# "a" has five objects (entry, name, and three fields), "b" four. The new user
+# field fits where the old one was. The longer name needs a new object for the
+# name, and one for the data of the "id" field. (Sizes are for 64-bit hosts.)
+#
+
+json <<EOF
+[ { "id":"a", "user":"alice", "pw":"secret" }, { "id":"b", "prev":"a" } ]
+EOF
+
+run mem "db open" "db mem" "db change a" "db rename b bobobobobobob" "db mem" \
+    "db delete a" "db mem" <<EOF
+chunks 1 size 4096 objects 9
+in-use 272 high 272 free 0
+11
+12
+chunks 1 size 4096 objects 10
+in-use 296 high 296 free 8
+chunks 1 size 4096 objects 5
+in-use 144 high 296 free 160
+EOF
+
+# --- Idle-time erasing -------------------------------------------------------
+
+#
+# After using up the erased blocks, allocating has to erase (foreground). Once
+# idle, we erase ahead (background), so the next writes don't have to wait.
+# (Most HOTP counter increments only go to the counter log, so it takes many of
+# them to use up the erased blocks.)
+#
+
+json <<EOF
+[ { "id":"a", "hotp_secret":"JBSWY3DPEHPK3PXP", "hotp_counter":0 } ]
+EOF
+
+run gc "db open" "db hotp a 20000" "db gc" "tick 100" "db gc" \
+    "db hotp a 150" "db gc" "db gc 4" "tick 100" "db gc" <<EOF
+20000
+gc erased 3 foreground 49 background 0
+gc erased 11 foreground 49 background 2
+20150
+gc erased 3 foreground 51 background 2
+gc erased 19 foreground 51 background 6
+EOF
+
+# --- HOTP counter log --------------------------------------------------------
+
+#
+# A counter increment programs one slot of the log, after reading the log
+# block. The log has 18 slots. When it is full, we write the entries with logged
+# counters (here, "a" and "b" end up in one block), delete the log, and start a
+# new one. After reopening, the counters are the last ones logged.
+#
+
+json <<EOF
+[ { "id":"a", "hotp_secret":"JBSWY3DPEHPK3PXP", "hotp_counter":0 },
+  { "id":"b", "hotp_secret":"JBSWY3DPEHPK3PXP", "hotp_counter":5 } ]
+EOF
+
+run hotp-log "db open" "db hotp a 1" "db iostats reset" "db hotp a 1" \
+    "db iostats" "db hotp b 3" "db iostats reset" "db hotp a 14" \
+    "db iostats" "db hotp a 1" "db iostats" "db stats" "db open" \
+    "db hotp a 0" "db hotp b 0" "db stats" <<EOF
+1
+2
+read 1 bytes 1024
+program 1 bytes 1024
+erase 0 bytes 0 max 0
+8
+16
+read 15 bytes 15360
+program 21 bytes 21504
+erase 0 bytes 0 max 0
+17
+read 16 bytes 16384
+program 22 bytes 22528
+erase 0 bytes 0 max 0
+total 2048 invalid 0 data 1
+erased 2025 deleted 4 empty 0
+17
+8
+total 2048 invalid 0 data 1
+erased 2025 deleted 4 empty 0
+EOF
+
+# --- Opening in steps -------------------------------------------------------
+
+#
+# We open the database one block at a time, until we have found an entry. Block
+# 8 holds the settings, so this takes two steps. Until the database is
+# completely open, the entries are those found so far, and all changes fail.
+#
+
+json <<EOF
+[ { "id":"a", "user":"u" }, { "id":"b", "prev":"c" }, { "id":"c", "pw":"p" } ]
+EOF
+
+run open-steps "db open" "db open 1" "db dump" "db new x" "db change a" \
+    "db step 1" "db dump" "db step" "db dump" "db new x" <<EOF
+first steps 2 scanned 2 flash 0 us
+a -
+failed
+failed
+a -
+b c
+total steps 5 scanned 4 flash 0 us
+a -
+c -
+b c
+12
+EOF
+
+
+#
+# The order of the entries must not depend on how we split opening into steps.
+# Sorting "a" after "c" during the scan, and then inserting "d" alphabetically,
+# would yield c, a, d.
+#
+
+json <<EOF
+[ { "id":"a", "prev":"c" }, { "id":"c" }, { "id":"d" } ]
+EOF
+
+run open-order "db open 1" "db step 1" "db step" "db dump" "db open" \
+    "db dump" <<EOF
+first steps 2 scanned 2 flash 0 us
+total steps 2032 scanned 2032 flash 0 us
+c -
+d -
+a c
+c -
+d -
+a c
+EOF
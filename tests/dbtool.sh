@@ -0,0 +1,124 @@
+#!/bin/sh
+#
+# dbtool.sh - Test building, dumping, and verifying images with tools/dbtool
+#
+# This work is licensed under the terms of the MIT License.
+# A copy of the license can be found in the file LICENSE.MIT
+#
+
+
+PK=AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA====
+OTHER=AEAQCAIBAEAQCAIBAEAQCAIBAEAQCAIBAEAQCAIBAEAQCAIBAEAQ====
+
+
+run()
+{
+	local title=$1
+
+	shift
+	echo -n "$title: " 1>&2
+	if ! eval "$@" 2>&1 >_out; then
+		echo "FAILED" 1>&2
+		exit 1
+	else
+		if diff -u - _out >_diff; then
+			echo "PASSED" 1>&2
+			rm -f _diff
+		else
+			echo "FAILED" 1>&2
+			cat _diff 1>&2
+			exit 1
+		fi
+	fi
+}
+
+
+dbtool()
+{
+	"$top/tools/dbtool" "$@"
+}
+
+
+sim()
+{
+	"$top/sim" -q -d "$dir/_db" -C "$@"
+}
+
+
+usage()
+{
+	echo "usage: $0 [-x]" 1>&2
+	exit 1
+}
+
+
+self=`which "$0"`
+dir=`dirname "$self"`
+top=$dir/..
+
+while [ "$1" ]; do
+	case "$1" in
+	-x)	set -x;;
+	-*)	usage;;
+	*)	break;;
+	esac
+	shift
+done
+
+[ "$1" ] && usage
+
+
+# --- Build from JSON ---------------------------------------------------------
+
+#
+# The firmware sees the same entries as in an image made by accenc.py. "dump"
+# prints them in the JSON format we read, in the order of the database.
+#
+
+cat <<EOF >_json
+# accounts
+[
+  { "id":"b", "user":"bob", "pw":"x\"y" },
+  { "id":"a", "prev":"b", "email":"a@b", "totp_secret":"JBSWY3DPEHPK3PXP" },
+  # another comment
+  { "id":"c", "hotp_secret":"JBSWY3DPEHPK3PXP", "hotp_counter":42 }
+]
+EOF
+
+"$top/tools/accenc.py" _json $PK >"$dir/_db" || exit
+sim "db open" "db dump" >_ref || exit
+dbtool build "$dir/_db" _json || exit
+
+run build 'sim "db open" "db dump" | diff _ref -' <<EOF
+EOF
+
+run dump 'dbtool dump "$dir/_db"' <<EOF
+[
+{ "id":"b", "user":"bob", "pw":"x\"y" },
+{ "id":"c", "hotp_secret":"JBSWY3DPEHPK3PXP", "hotp_counter":42 },
+{ "id":"a", "prev":"b", "email":"a@b", "totp_secret":"JBSWY3DPEHPK3PXP" }
+]
+EOF
+
+run verify 'dbtool verify "$dir/_db"' <<EOF
+3 entries, 2048 blocks: 1 data, 1 special, 2030 erased, 0 deleted, 0 empty, 0 invalid, 0 error
+EOF
+
+# --- Wrong key ---------------------------------------------------------------
+
+run verify-other 'dbtool verify "$dir/_db" $OTHER || echo failed' <<EOF
+0 entries, 2048 blocks: 0 data, 0 special, 2037 erased, 0 deleted, 0 empty, 3 invalid, 0 error
+failed
+EOF
+
+# --- Synthetic accounts ------------------------------------------------------
+
+dbtool generate "$dir/_db" 1000 || exit
+
+run generate 'sim "db open" "db stats" && dbtool dump "$dir/_db" | sed -n 2p' <<EOF
+total 2048 invalid 0 data 59
+erased 1972 deleted 0 empty 0
+{ "id":"acct000000", "user":"user000000@example.com", "pw":"pw-00000000" },
+EOF
+
+rm -f _json _ref _out
@@ -147,3 +147,19 @@ b a
 c b
 EOF
 
+
+# --- Incremental sorting (order before and after a full sort) ----------------
+
+run "incremental" "add a" "add b a" "add c b" "add d" "add e c" "sort" \
+    "move b" "move d a" "dump" <<EOF
+d -
+a d
+c a
+e c
+b e
+d -
+a d
+c a
+e c
+b e
+EOF
@@ -0,0 +1,99 @@
+#!/bin/bash
+#
+# pack-bench.sh - Compare databases with one entry per block to packed ones
+#
+# This work is licensed under the terms of the MIT License.
+# A copy of the license can be found in the file LICENSE.MIT
+#
+
+#
+# For each size, we generate a database with one entry per block, and one with
+# packed blocks, and open each of them twice. The first db_open has to read the
+# whole storage and writes the summary. We measure the second one, which only
+# reads blocks that contain data.
+#
+# We report the data blocks, the simulated Flash time (for a W25Q128), the
+# blocks decrypted, and the CPU time (in ms) of the simulator run. Finally, we
+# check that "db pack" on the unpacked database yields as many blocks as
+# packing them with accenc.py.
+#
+
+PK=AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA====
+
+
+usage()
+{
+	echo "usage: $0 [-x] [entries ...]" 1>&2
+	exit 1
+}
+
+
+accounts()
+{
+	local n=$1
+	local i sep=
+
+	echo "["
+	for ((i = 0; i < n; i++)); do
+		printf '%s{ "id":"acct%04u", "user":"user%04u@example.com", ' \
+		    "$sep" $i $i
+		printf '"pw":"pw-%08u" }\n' $((i * 7919))
+		sep=,
+	done
+	echo "]"
+}
+
+
+#
+# run opens the database "_db" twice, and prints data blocks, Flash time,
+# decrypted blocks, and CPU time of the second db_open.
+#
+
+run()
+{
+	local TIMEFORMAT=%3U
+	local t
+
+	../sim -q -d _db -C "db open" || exit
+	t=`{ time ../sim -q -F w25q128 -d _db -C "db open" "db stats" \
+	    "db flash" "db crypt" >_out; } 2>&1 | tr -d .`
+	awk -v t=$t '
+/^total/	{ data = $6 }
+/^flash/	{ flash = $2 }
+/^shared/	{ crypt = $7 }
+END		{ printf("%5u blocks %6u us Flash %5u decrypted %5u ms CPU\n",
+		    data, flash, crypt, t) }' _out
+}
+
+
+while [ "$1" ]; do
+	case "$1" in
+	-x)	set -x;;
+	-*)	usage;;
+	*)	break;;
+	esac
+	shift
+done
+
+[ "$1" ] || set 500
+
+for n in "$@"; do
+	accounts $n >_json
+
+	../tools/accenc.py _json $PK >_db || exit
+	echo -n "$n entries, one per block: "
+	run
+
+	blocks=`../sim -q -d _db -C "db open" "db pack"`
+
+	../tools/accenc.py -p _json $PK >_db || exit
+	echo -n "$n entries, packed:        "
+	run
+
+	expect=`awk '/^total/ { print $6 }' _out`
+	if [ "$blocks" != "$expect" ]; then
+		echo "$n: db pack wrote $blocks blocks, expected $expect" 1>&2
+		exit 1
+	fi
+done
+rm -f _json _out
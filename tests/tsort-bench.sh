@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# tsort-bench.sh - Measure how topological sorting scales with the database
+#
+# This work is licensed under the terms of the MIT License.
+# A copy of the license can be found in the file LICENSE.MIT
+#
+
+#
+# Each entry names the one after it in alphabetical order as its predecessor,
+# so the sorted list is the reverse of the initial one. This is the worst case
+# for a sort that makes one pass over the list per emitted entry.
+#
+
+SORTS=100
+
+
+usage()
+{
+	echo "usage: $0 [-x] [entries ...]" 1>&2
+	exit 1
+}
+
+
+#
+# run prints the CPU time (in ms) the simulator needs to set up "n" entries and
+# to sort them "sorts" times. It sets "first" to the first entry of the result.
+#
+
+run()
+{
+	local n=$1
+	local sorts=$2
+	local args=("db dummy")
+	local name prev i
+
+	for ((i = 0; i < n; i++)); do
+		printf -v name e%06u $i
+		printf -v prev e%06u $((i + 1))
+		args+=("db add $name $prev")
+	done
+	for ((i = 0; i < sorts; i++)); do
+		args+=("db sort")
+	done
+	args+=("db dump")
+
+	local TIMEFORMAT=%3U
+	{ time ../sim -q -C "${args[@]}" >_out; } 2>&1 | tr -d .
+	first=`head -1 _out`
+	rm -f _out
+}
+
+
+while [ "$1" ]; do
+	case "$1" in
+	-x)	set -x;;
+	-*)	usage;;
+	*)	break;;
+	esac
+	shift
+done
+
+[ "$1" ] || set 1000 10000
+
+for n in "$@"; do
+	t0=`run $n 0`
+	t1=`run $n $SORTS`
+	run $n 1 >/dev/null
+	printf -v expect "e%06u e%06u" $((n - 1)) $n
+	if [ "$first" != "$expect" ]; then
+		echo "$n: wrong order ($first)" 1>&2
+		exit 1
+	fi
+	echo "$n entries: $(( (10#$t1 - 10#$t0) * 1000 / SORTS )) us per sort"
+done
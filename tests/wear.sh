@@ -0,0 +1,32 @@
+
+#!/bin/sh
+#
+# wear.sh - Test wear leveling
+#
+# This work is licensed under the terms of the MIT License.
+# A copy of the license can be found in the file LICENSE.MIT
+#
+
+
+. `dirname "$0"`/db-lib.sh
+
+
+# --- HOTP: 100k increments -------------------------------------------------
+
+#
+# Most increments only add to the counter log. When the log is full, we write
+# the entry to a new block, and replace the log. With 508 erase blocks in the
+# data area, of which one holds the two entries and the settings, the erases
+# should be spread evenly over the other 507.
+#
+
+json <<EOF
+[ { "id":"a", "hotp_secret":"JBSWY3DPEHPK3PXP", "hotp_counter":0 },
+  { "id":"b" } ]
+EOF
+
+run hotp-100k "db open" "db hotp a 100000" "db wear" <<EOF
+100000
+sectors 508 erases 2271 min 0 max 5
+0:1 4:264 5:243
+EOF
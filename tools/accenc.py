@@ -20,6 +20,8 @@ PAYLOAD_SIZE = 956
 HASH_SIZE = 20
 HASH_PAD = 12
 PAD_BYTES = 32
+PUBLIC_KEY_SIZE = 32
+HEADER_SIZE = 4
 
 STORAGE_BLOCKS = 2048	# total number of blocks, including pad block
 PAD_BLOCKS = 8		# blocks reserved for pads
@@ -154,8 +156,13 @@ def write_new(data, writer, readers):
 	sys.stdout.buffer.write(blob)
 
 
-if len(sys.argv) < 2:
-	print("usage:", sys.argv[0], "db.json [writer [reader ...]]",
+packed = False
+if len(sys.argv) > 1 and sys.argv[1] == "-p":
+	packed = True
+	del sys.argv[1]
+
+if len(sys.argv) < 2 or (packed and len(sys.argv) < 3):
+	print("usage:", sys.argv[0], "[-p] db.json [writer [reader ...]]",
 	    file = sys.stderr)
 	sys.exit(1)
 
@@ -173,8 +180,8 @@ else:
 	if len(sys.argv) == 3:
 		readers = [ writer.public_key ]
 	else:
-		readers = map(lambda x: PublicKey(base64.b32decode(x)),
-		    sys.argv[3:])
+		readers = list(map(lambda x: PublicKey(base64.b32decode(x)),
+		    sys.argv[3:]))
 
 #
 # Note: the pads shouldn't normally have to leave the device, and the device
@@ -201,9 +208,21 @@ sys.stdout.buffer.write(b'\xff' * (RESERVED_BLOCKS - 1) * BLOCK_SIZE)
 if writer is None:
 	settings = 0
 else:
-	write_new(struct.pack("<BBH", 5, 0, 0), writer, [ writer.public_key ])
+	write_new(struct.pack("<BBH", 5, 0, 0), writer, readers)
 	settings = 1
 
+#
+# With -p, we pack as many entries into a block as fit, each preceded by the
+# length of its fields and its sequence number. See "Packed blocks" in
+# fw/db/db.c
+#
+
+if packed:
+	capacity = BLOCK_SIZE - PUBLIC_KEY_SIZE - Box.NONCE_SIZE - \
+	    len(readers) * SecretBox.KEY_SIZE - SecretBox.MACBYTES - HEADER_SIZE
+
+blocks = 0
+pack = b''
 for e in db:
 	b = b''
 	i = 1
@@ -213,11 +232,23 @@ for e in db:
 		i += 1
 	if writer is None:
 		write_old(b)
+		blocks += 1
+	elif packed:
+		b = struct.pack("<HH", len(b), 0) + b
+		if len(pack) + len(b) > capacity:
+			write_new(struct.pack("<BBH", 7, 0, 0) + pack, writer,
+			    readers)
+			blocks += 1
+			pack = b''
+		pack += b
 	else:
 		# empty settings record
-		write_new(struct.pack("<BBH", 4, 0, 0) + b,
-		    writer, [ writer.public_key ])
+		write_new(struct.pack("<BBH", 4, 0, 0) + b, writer, readers)
+		blocks += 1
+if pack:
+	write_new(struct.pack("<BBH", 7, 0, 0) + pack, writer, readers)
+	blocks += 1
 
 sys.stdout.buffer.write(
-    (b'\xff' * (STORAGE_BLOCKS - RESERVED_BLOCKS - len(db) - settings) *
+    (b'\xff' * (STORAGE_BLOCKS - RESERVED_BLOCKS - blocks - settings) *
     BLOCK_SIZE))
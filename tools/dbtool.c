@@ -0,0 +1,773 @@
+/*
+ * dbtool.c - Build, dump, and verify database images
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file LICENSE.MIT
+ */
+
+/*
+ * dbtool uses the database code of the firmware (db/), on top of the storage
+ * file of the simulator. The images it writes are therefore exactly what the
+ * firmware would write, and it reads images the way the firmware does. Unlike
+ * accenc.py, it does not need to know the block format.
+ *
+ * Entries are built in memory, in the order of the input, and then written with
+ * db_pack. Images can be larger than the 2048 blocks of the device (-b), for
+ * databases that wouldn't fit there.
+ *
+ * Like accenc.py, we use an all-zero device secret and the PIN 0xffff1234, and
+ * the pad yields the writer's key as master secret. The writer is always also
+ * a reader (see dbcrypt_init).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <assert.h>
+
+#include "hal.h"
+#include "debug.h"
+#include "base32.h"
+#include "storage.h"
+#include "dbcrypt.h"
+#include "block.h"
+#include "secrets.h"
+#include "settings.h"
+#include "db.h"
+
+
+#define	PIN		0xffff1234
+#define	DEFAULT_KEY	\
+	"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA===="
+
+
+static bool verbose = 0;
+static bool timing = 0;
+
+
+/* --- HAL ----------------------------------------------------------------- */
+
+
+uint64_t time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+void vdebug(const char *fmt, va_list ap)
+{
+	if (verbose)
+		vfprintf(stderr, fmt, ap);
+}
+
+
+void t0(void)
+{
+}
+
+
+double t1(const char *fmt, ...)
+{
+	return 0;
+}
+
+
+/* --- Phases -------------------------------------------------------------- */
+
+
+static uint64_t phase_t0;
+
+
+static void phase_begin(void)
+{
+	phase_t0 = time_us();
+}
+
+
+static void phase_end(const char *name)
+{
+	uint64_t t = time_us();
+
+	if (timing)
+		fprintf(stderr, "%-8s %8.1f ms\n", name,
+		    (t - phase_t0) / 1000.0);
+	phase_t0 = t;
+}
+
+
+/* --- Field names --------------------------------------------------------- */
+
+
+/* in the order of the fields in accenc.py */
+
+static const struct field {
+	const char	*name;
+	enum field_type	type;
+} fields[] = {
+	{ "id",			ft_id },
+	{ "prev",		ft_prev },
+	{ "user",		ft_user },
+	{ "email",		ft_email },
+	{ "pw",			ft_pw },
+	{ "hotp_secret",	ft_hotp_secret },
+	{ "hotp_counter",	ft_hotp_counter },
+	{ "totp_secret",	ft_totp_secret },
+	{ "comment",		ft_comment },
+	{ "pw2",		ft_pw2 },
+};
+
+#define	N_FIELDS	(sizeof(fields) / sizeof(*fields))
+
+
+static const struct field *field_by_name(const char *name)
+{
+	const struct field *f;
+
+	for (f = fields; f != fields + N_FIELDS; f++)
+		if (!strcmp(f->name, name))
+			return f;
+	return NULL;
+}
+
+
+static const struct field *field_by_type(enum field_type type)
+{
+	const struct field *f;
+
+	for (f = fields; f != fields + N_FIELDS; f++)
+		if (f->type == type)
+			return f;
+	return NULL;
+}
+
+
+/* --- Keys ---------------------------------------------------------------- */
+
+
+static void decode_key(uint8_t *key, const char *s)
+{
+	if (base32_decode_size(s) != MASTER_SECRET_BYTES ||
+	    base32_decode(key, MASTER_SECRET_BYTES, s) != MASTER_SECRET_BYTES) {
+		fprintf(stderr, "invalid key \"%s\"\n", s);
+		exit(1);
+	}
+}
+
+
+static struct dbcrypt *setup_crypto(const char *writer, char *const *readers,
+    unsigned n_readers)
+{
+	struct dbcrypt *c;
+	unsigned i;
+
+	if (n_readers >= DB_MAX_READERS) {
+		fprintf(stderr, "too many readers (max %u)\n",
+		    DB_MAX_READERS - 1);
+		exit(1);
+	}
+	secrets_init();
+	decode_key(master_secret, writer);
+	c = dbcrypt_init(master_secret, sizeof(master_secret));
+	for (i = 0; i != n_readers; i++) {
+		uint8_t pk[MASTER_SECRET_BYTES];
+
+		decode_key(pk, readers[i]);
+		dbcrypt_add_reader(c, pk, sizeof(pk));
+	}
+	return c;
+}
+
+
+/* --- JSON input ---------------------------------------------------------- */
+
+
+/*
+ * We only accept what accenc.py needs: an array of objects, each with string or
+ * integer values. As in accenc.py, lines beginning with # are comments.
+ */
+
+struct json {
+	const char	*name;
+	const char	*s;
+	unsigned	line;
+};
+
+
+static void __attribute__((noreturn)) json_error(const struct json *j,
+    const char *what)
+{
+	fprintf(stderr, "%s:%u: %s\n", j->name, j->line, what);
+	exit(1);
+}
+
+
+static void json_space(struct json *j)
+{
+	while (1) {
+		if (*j->s == '\n') {
+			j->line++;
+			j->s++;
+			while (*j->s == ' ' || *j->s == '\t')
+				j->s++;
+			if (*j->s == '#')
+				while (*j->s && *j->s != '\n')
+					j->s++;
+		} else if (isspace((unsigned char) *j->s)) {
+			j->s++;
+		} else {
+			break;
+		}
+	}
+}
+
+
+static bool json_char(struct json *j, char c)
+{
+	json_space(j);
+	if (*j->s != c)
+		return 0;
+	j->s++;
+	return 1;
+}
+
+
+static void json_expect(struct json *j, char c)
+{
+	char msg[] = "expected 'x'";
+
+	if (json_char(j, c))
+		return;
+	msg[10] = c;
+	json_error(j, msg);
+}
+
+
+/* json_value returns a string, or a number as a string */
+
+static char *json_value(struct json *j, char *buf, unsigned size)
+{
+	char *p = buf;
+
+	json_space(j);
+	if (isdigit((unsigned char) *j->s)) {
+		while (isdigit((unsigned char) *j->s)) {
+			if (p == buf + size - 1)
+				json_error(j, "number too long");
+			*p++ = *j->s++;
+		}
+		*p = 0;
+		return buf;
+	}
+	json_expect(j, '"');
+	while (*j->s != '"') {
+		char c = *j->s++;
+
+		switch (c) {
+		case 0:
+		case '\n':
+			json_error(j, "unterminated string");
+		case '\\':
+			c = *j->s++;
+			switch (c) {
+			case 'n':
+				c = '\n';
+				break;
+			case 't':
+				c = '\t';
+				break;
+			case '"':
+			case '\\':
+			case '/':
+				break;
+			default:
+				json_error(j, "unsupported escape sequence");
+			}
+			break;
+		default:
+			break;
+		}
+		if (p == buf + size - 1)
+			json_error(j, "string too long");
+		*p++ = c;
+	}
+	j->s++;
+	*p = 0;
+	return buf;
+}
+
+
+static void json_field(struct json *j, struct db_entry *de,
+    const struct field *f, const char *v)
+{
+	uint8_t buf[MAX_STRING_LEN];
+	ssize_t len;
+
+	switch (f->type) {
+	case ft_hotp_secret:
+	case ft_totp_secret:
+		len = base32_decode_size(v);
+		if (len < 0 || len > MAX_SECRET_LEN ||
+		    base32_decode(buf, sizeof(buf), v) != len)
+			json_error(j, "invalid secret");
+		break;
+	case ft_hotp_counter: {
+		uint64_t n = strtoull(v, NULL, 10);
+		unsigned i;
+
+		for (i = 0; i != 8; i++)
+			buf[i] = n >> 8 * i;
+		len = 8;
+		break;
+	}
+	default:
+		len = strlen(v);
+		if (len > (f->type == ft_id || f->type == ft_prev ?
+		    MAX_NAME_LEN : MAX_STRING_LEN))
+			json_error(j, "string too long");
+		memcpy(buf, v, len);
+		break;
+	}
+	if (!db_change_field(de, f->type, buf, len))
+		json_error(j, "db_change_field failed");
+}
+
+
+static struct db_entry *json_entry(struct json *j, struct db *db,
+    struct db_entry *last)
+{
+	char values[N_FIELDS][MAX_STRING_LEN * 2 + 1];
+	bool have[N_FIELDS] = { 0, };
+	struct db_entry *de;
+	unsigned i;
+
+	json_expect(j, '{');
+	if (!json_char(j, '}'))
+		do {
+			char name[20];
+			const struct field *f;
+
+			json_value(j, name, sizeof(name));
+			f = field_by_name(name);
+			if (!f)
+				json_error(j, "unknown field");
+			i = f - fields;
+			if (have[i])
+				json_error(j, "duplicate field");
+			json_expect(j, ':');
+			json_value(j, values[i], sizeof(values[i]));
+			have[i] = 1;
+		} while (json_char(j, ','));
+	json_expect(j, '}');
+
+	if (!have[0])
+		json_error(j, "entry has no id");
+	if (strlen(values[0]) > MAX_NAME_LEN)
+		json_error(j, "id too long");
+	if (db_find_entry(db, values[0], strlen(values[0])))
+		json_error(j, "duplicate id");
+	de = db_load_entry(db, last, values[0]);
+	for (i = 1; i != N_FIELDS; i++)
+		if (have[i])
+			json_field(j, de, fields + i, values[i]);
+	return de;
+}
+
+
+static unsigned load_json(struct db *db, const char *name)
+{
+	struct json j = {
+		.name	= name,
+		.line	= 1,
+	};
+	struct db_entry *last = NULL;
+	unsigned n = 0;
+	size_t size = 0, got;
+	char *buf = NULL;
+	FILE *file;
+
+	file = fopen(name, "r");
+	if (!file) {
+		perror(name);
+		exit(1);
+	}
+	do {
+		buf = realloc(buf, size + 65536 + 1);
+		if (!buf) {
+			perror("realloc");
+			exit(1);
+		}
+		got = fread(buf + size, 1, 65536, file);
+		size += got;
+	} while (got);
+	if (ferror(file)) {
+		perror(name);
+		exit(1);
+	}
+	fclose(file);
+	buf[size] = 0;
+
+	/* make a comment on the first line look like one on any other line */
+	j.s = buf;
+	if (*j.s == '#')
+		while (*j.s && *j.s != '\n')
+			j.s++;
+
+	json_expect(&j, '[');
+	if (!json_char(&j, ']')) {
+		do {
+			last = json_entry(&j, db, last);
+			n++;
+		} while (json_char(&j, ','));
+		json_expect(&j, ']');
+	}
+	json_space(&j);
+	if (*j.s)
+		json_error(&j, "trailing garbage");
+	free(buf);
+	return n;
+}
+
+
+/* --- Synthetic accounts -------------------------------------------------- */
+
+
+/* the same accounts as tests/pack-bench.sh, with longer numbers */
+
+static void generate(struct db *db, unsigned n)
+{
+	struct db_entry *de = NULL;
+	char buf[MAX_STRING_LEN + 1];
+	unsigned i;
+	int len;
+
+	for (i = 0; i != n; i++) {
+		sprintf(buf, "acct%06u", i);
+		de = db_load_entry(db, de, buf);
+		len = sprintf(buf, "user%06u@example.com", i);
+		db_change_field(de, ft_user, buf, len);
+		len = sprintf(buf, "pw-%08u", i * 7919);
+		db_change_field(de, ft_pw, buf, len);
+	}
+}
+
+
+/* --- JSON output --------------------------------------------------------- */
+
+
+static void dump_string(const uint8_t *s, unsigned len)
+{
+	const uint8_t *end = s + len;
+
+	putchar('"');
+	for (; s != end; s++)
+		switch (*s) {
+		case '"':
+		case '\\':
+			printf("\\%c", *s);
+			break;
+		case '\n':
+			printf("\\n");
+			break;
+		case '\t':
+			printf("\\t");
+			break;
+		default:
+			if (*s < 32 || *s > 126)
+				printf("\\u%04x", *s);
+			else
+				putchar(*s);
+		}
+	putchar('"');
+}
+
+
+static void dump_field(const struct db_field *f)
+{
+	const uint8_t *data = f->data;
+
+	switch (f->type) {
+	case ft_hotp_secret:
+	case ft_totp_secret: {
+		char buf[base32_encode_size(MAX_SECRET_LEN)];
+
+		base32_encode(buf, sizeof(buf), data, f->len);
+		printf("\"%s\"", buf);
+		break;
+	}
+	case ft_hotp_counter: {
+		uint64_t n = 0;
+		unsigned i;
+
+		for (i = 0; i != f->len && i != 8; i++)
+			n |= (uint64_t) data[i] << 8 * i;
+		printf("%llu", (unsigned long long) n);
+		break;
+	}
+	default:
+		dump_string(data, f->len);
+		break;
+	}
+}
+
+
+static void dump_json(const struct db *db)
+{
+	const struct db_entry *de;
+	const char *sep = "";
+
+	printf("[\n");
+	for (de = db->entries; de; de = de->next) {
+		const char *fsep = "";
+		const struct field *ff;
+
+		printf("%s{ ", sep);
+		for (ff = fields; ff != fields + N_FIELDS; ff++) {
+			const struct db_field *f = db_field_find(de, ff->type);
+
+			if (!f)
+				continue;
+			printf("%s\"%s\":", fsep, ff->name);
+			dump_field(f);
+			fsep = ", ";
+		}
+		printf(" }");
+		sep = ",\n";
+	}
+	printf("\n]\n");
+}
+
+
+static bool check_fields(const struct db *db)
+{
+	const struct db_entry *de;
+	const struct db_field *f;
+	bool ok = 1;
+
+	for (de = db->entries; de; de = de->next)
+		for (f = de->fields; f; f = f->next)
+			if (!field_by_type(f->type)) {
+				fprintf(stderr, "%s: unknown field type %u\n",
+				    de->name, f->type);
+				ok = 0;
+			}
+	return ok;
+}
+
+
+/* --- Images -------------------------------------------------------------- */
+
+
+static void create_image(const char *name, unsigned blocks)
+{
+	FILE *file;
+
+	if (blocks < PAD_BLOCKS * 2) {
+		fprintf(stderr, "image needs at least %u blocks\n",
+		    PAD_BLOCKS * 2);
+		exit(1);
+	}
+	file = fopen(name, "w");
+	if (!file) {
+		perror(name);
+		exit(1);
+	}
+	if (ftruncate(fileno(file), (off_t) blocks * STORAGE_BLOCK_SIZE) < 0) {
+		perror(name);
+		exit(1);
+	}
+	fclose(file);
+	storage_file = name;
+	if (!storage_erase_blocks(0, storage_blocks()))
+		exit(1);
+}
+
+
+static void open_image(const char *name, const struct dbcrypt *c)
+{
+	storage_file = name;
+	if (!db_open(&main_db, c)) {
+		fprintf(stderr, "%s: db_open failed\n", name);
+		exit(1);
+	}
+}
+
+
+static void build(const char *image, unsigned blocks, const char *json,
+    unsigned n, char *const *keys, unsigned n_keys)
+{
+	const struct dbcrypt *c;
+	int written;
+
+	phase_begin();
+	create_image(image, blocks);
+	phase_end("erase");
+
+	c = setup_crypto(n_keys ? keys[0] : DEFAULT_KEY, keys + 1,
+	    n_keys ? n_keys - 1 : 0);
+	if (!secrets_store(PIN)) {
+		fprintf(stderr, "%s: could not write pad\n", image);
+		exit(1);
+	}
+	phase_end("pad");
+
+	/* the image is erased, so db_open only writes the summary */
+	open_image(image, c);
+	if (!settings_update()) {
+		fprintf(stderr, "%s: could not write settings\n", image);
+		exit(1);
+	}
+	phase_end("open");
+
+	db_begin(&main_db);
+	if (json)
+		n = load_json(&main_db, json);
+	else
+		generate(&main_db, n);
+	db_commit(&main_db);
+	phase_end("entries");
+
+	written = db_pack(&main_db);
+	if (written < 0) {
+		fprintf(stderr,
+		    "%s: out of space after %u blocks (%u entries)\n",
+		    image, main_db.stats.data, n);
+		exit(1);
+	}
+	phase_end("encrypt");
+
+	db_close(&main_db);
+	storage_flush();
+	phase_end("write");
+
+	if (verbose)
+		fprintf(stderr, "%u entries in %d blocks\n", n, written);
+}
+
+
+static void inspect(const char *image, const char *key, bool dump)
+{
+	const struct dbcrypt *c;
+	struct db_stats s;
+	unsigned n = 0;
+	const struct db_entry *de;
+	bool ok;
+
+	/* db_open may write a summary, but we leave the image unchanged */
+	storage_durability = sd_never;
+
+	phase_begin();
+	c = setup_crypto(key ? key : DEFAULT_KEY, NULL, 0);
+	phase_end("keys");
+
+	open_image(image, c);
+	phase_end("open");
+
+	ok = check_fields(&main_db);
+	if (dump) {
+		dump_json(&main_db);
+	} else {
+		for (de = main_db.entries; de; de = de->next)
+			n++;
+		db_stats(&main_db, &s);
+		printf("%u entries, %u blocks: %u data, %u special, "
+		    "%u erased, %u deleted, %u empty, %u invalid, %u error\n",
+		    n, s.total, s.data, s.special, s.erased, s.deleted,
+		    s.empty, s.invalid, s.error);
+		ok = ok && !s.invalid && !s.error;
+	}
+	db_close(&main_db);
+	if (!ok)
+		exit(1);
+}
+
+
+/* --- Command-line processing --------------------------------------------- */
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"usage: %s [-b blocks] [-j threads] [-t] [-v] command [args ...]\n\n"
+"  -b blocks   size of new images (default: %u blocks of %u bytes)\n"
+"  -j threads  decrypt with that many threads (default: 1)\n"
+"  -t          print the time each phase took on standard error\n"
+"  -v          verbose operation, including firmware debug output\n"
+"\n"
+"Commands:\n"
+"  build image json-file [writer [reader ...]]\n"
+"  generate image entries [writer [reader ...]]\n"
+"  dump image [writer]\n"
+"  verify image [writer]\n"
+"\n"
+"Keys are in base32, and the writer defaults to the all-zero key. \"build\"\n"
+"reads the JSON format of accenc.py, which is also what \"dump\" prints.\n"
+"\"verify\" fails if there are invalid blocks, e.g., from other writers.\n"
+    , name, 2048, STORAGE_BLOCK_SIZE);
+	exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned blocks = 2048;
+	const char *cmd;
+	char *end;
+	int c, args;
+
+	block_threads = 1;
+	while ((c = getopt(argc, argv, "b:j:tv")) != EOF)
+		switch (c) {
+		case 'b':
+			blocks = strtoul(optarg, &end, 0);
+			if (*end)
+				usage(*argv);
+			break;
+		case 'j':
+			block_threads = strtoul(optarg, &end, 0);
+			if (*end)
+				usage(*argv);
+			break;
+		case 't':
+			timing = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(*argv);
+		}
+
+	args = argc - optind;
+	if (args < 2)
+		usage(*argv);
+	cmd = argv[optind];
+	storage_durability = sd_exit;
+	db_init();
+
+	if (!strcmp(cmd, "build") && args >= 3) {
+		build(argv[optind + 1], blocks, argv[optind + 2], 0,
+		    argv + optind + 3, args - 3);
+	} else if (!strcmp(cmd, "generate") && args >= 3) {
+		unsigned n = strtoul(argv[optind + 2], &end, 0);
+
+		if (*end)
+			usage(*argv);
+		build(argv[optind + 1], blocks, NULL, n,
+		    argv + optind + 3, args - 3);
+	} else if (!strcmp(cmd, "dump") && args <= 3) {
+		inspect(argv[optind + 1], argv[optind + 2], 1);
+	} else if (!strcmp(cmd, "verify") && args <= 3) {
+		inspect(argv[optind + 1], argv[optind + 2], 0);
+	} else {
+		usage(*argv);
+	}
+	return 0;
+}
@@ -236,7 +236,7 @@ static bool demo_entry(char *const *args, unsigned n_args)
 }
 
 
-/* SHA1, hardware accelerator or gcrypt */
+/* SHA1, hardware accelerator or software */
 
 static bool demo_sha1(char *const *args, unsigned n_args)
 {
@@ -259,7 +259,7 @@ static bool demo_sha1(char *const *args, unsigned n_args)
 }
 
 
-/* SHA256, hardware accelerator or gcrypt */
+/* SHA256, hardware accelerator or software */
 
 static bool demo_sha256(char *const *args, unsigned n_args)
 {
@@ -237,23 +237,17 @@ static void changed_account_name(struct ui_account_ctx *c)
 }
 
 
-static bool name_is_different(void *user, struct db_entry *de)
-{
-	struct ui_account_ctx *c = user;
-
-	return de == c->selected_account || strcmp(de->name, c->buf);
-}
-
-
 static int validate_name_change(void *user, const char *s)
 {
 	struct ui_account_ctx *c = user;
+	const struct db_entry *de;
 
 	/*
 	 * We don't use "s" but instead c->buf. Not very pretty, but it keeps
 	 * things simple.
 	 */
-	return db_iterate(&main_db, name_is_different, c);
+	de = db_find_entry(&main_db, c->buf, strlen(c->buf));
+	return !de || de == c->selected_account;
 }
 
 
@@ -365,10 +359,10 @@ static void confirm_field_deletion(void *user, bool confirm)
 	if (f->type == ft_pw)
 		f2 = db_field_find(de, ft_pw2);
 	if (f2) {
-		db_entry_defer_update(de, 1);
+		db_begin(&main_db);
 		db_change_field(de, ft_pw, f2->data, f2->len);
 		db_delete_field(de, f2);
-		db_entry_defer_update(de, 0);
+		db_commit(&main_db);
 		// @@@ handle errors
 	} else {
 		db_delete_field(de, f);
@@ -56,17 +56,9 @@ static void new_account_name(struct ui_accounts_ctx *c)
 }
 
 
-static bool name_is_different(void *user, struct db_entry *de)
-{
-	const char *s = user;
-
-	return strcmp(de->name, s);
-}
-
-
 static int validate_new_account(void *user, const char *s)
 {
-	return db_iterate(&main_db, name_is_different, (void *) s);
+	return !db_find_entry(&main_db, s, strlen(s));
 }
 
 
@@ -104,6 +96,8 @@ static void ui_accounts_tap(void *ctx, unsigned x, unsigned y)
 	struct ui_accounts_ctx *c = ctx;
 	const struct wi_list_entry *entry;
 
+	if (db_opening(&main_db))
+		return;
 	if (list_is_empty(&c->list)) {
 		if (button_in(GFX_WIDTH / 2, (GFX_HEIGHT + LIST_Y0) / 2, x, y))
 			make_new_account(c, ui_call);
@@ -206,6 +200,8 @@ static void ui_accounts_long(void *ctx, unsigned x, unsigned y)
 {
 	struct ui_accounts_ctx *c = ctx;
 
+	if (db_opening(&main_db))
+		return;
 	if (y < LIST_Y0) {
 		long_top(ctx, x, y);
 		return;
@@ -285,7 +281,7 @@ static void ui_accounts_open(void *ctx, void *params)
 	db_iterate(&main_db, add_account, c);
 	wi_list_end(&c->list);
 
-	if (list_is_empty(&c->list))
+	if (list_is_empty(&c->list) && !db_opening(&main_db))
 		button_draw_add(GFX_WIDTH / 2, (GFX_HEIGHT + LIST_Y0) / 2);
 
 	set_idle(IDLE_ACCOUNTS_S);
@@ -316,12 +312,37 @@ static void ui_accounts_resume(void *ctx)
 }
 
 
+/* --- Opening the database ----------------------------------------------- */
+
+
+/*
+ * accept_pin only opens the database until it has found something, and we
+ * continue here, showing the accounts as we find them. We don't scan while the
+ * list is being scrolled, since that would make it jump.
+ */
+
+static void ui_accounts_tick(void *ctx)
+{
+	struct ui_accounts_ctx *c = ctx;
+	unsigned generation = main_db.generation;
+
+	if (!db_opening(&main_db) || c->list.scrolling)
+		return;
+	if (db_open_step(&main_db, DB_OPEN_STEP) ||
+	    main_db.generation != generation) {
+		ui_accounts_close(ctx);
+		ui_accounts_open(ctx, NULL);
+	}
+}
+
+
 /* --- Interface ----------------------------------------------------------- */
 
 
 static const struct ui_events ui_accounts_events = {
 	.touch_tap	= ui_accounts_tap,
 	.touch_long	= ui_accounts_long,
+	.tick		= ui_accounts_tick,
 	.lists		= lists,
 	.n_lists	= 1,
 };
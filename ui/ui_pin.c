@@ -75,10 +75,19 @@ static bool accept_pin(uint32_t pin)
 		return 0;
 	}
 	c = dbcrypt_init(master_secret, sizeof(master_secret));
-	if (!db_open_progress(&main_db, c, open_progress, &progress)) {
-		dbcrypt_free(c);
-		return 0;
-	}
+
+	/*
+	 * We only open the database until we have found anything that shows
+	 * that the PIN is right. ui_accounts then opens the rest.
+	 */
+	db_open_begin(&main_db, c);
+	do {
+		db_stats(&main_db, &s);
+		if (s.data || s.special || s.empty)
+			break;
+		open_progress(&progress, db_open_position(&main_db),
+		    main_db.summary_base);
+	} while (!db_open_step(&main_db, DB_OPEN_STEP));
 	/* @@@ need to dbcrypt_free also when we turn off */
 	db_stats(&main_db, &s);
 
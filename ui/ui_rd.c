@@ -14,6 +14,9 @@
 #include "gfx.h"
 #include "shape.h"
 #include "text.h"
+#include "fmt.h"
+#include "storage.h"
+#include "db.h"
 #include "settings.h"
 #include "wi_list.h"
 #include "ui_overlay.h"
@@ -24,6 +27,8 @@
 
 enum rd_item_type {
 	rit_bool,
+	rit_io,		/* storage I/O since startup, read-only */
+	rit_mem,	/* memory used by database entries, read-only */
 };
 
 struct rd_item {
@@ -72,6 +77,9 @@ static void render_rd(const struct wi_list *l,
 		    bb->y + bb->h / 2, bb->h / 2, 2, *item->u.bool_var,
 		    LIST_FG, odd ? ODD_BG : EVEN_BG);
 		break;
+	case rit_io:
+	case rit_mem:
+		break;
 	default:
 		ABORT();
 	}
@@ -98,6 +106,9 @@ static void ui_rd_tap(void *ctx, unsigned x, unsigned y)
 		wi_list_render_entry(&c->list, entry);
 		settings_update(); // @@@ check for errors
 		break;
+	case rit_io:
+	case rit_mem:
+		return;
 	default:
 		ABORT();
 	}
@@ -151,9 +162,17 @@ static void ui_rd_open(void *ctx, void *params)
 		    { .bool_var = &settings.crosshair }},
 		{ "Strict RMT",	rit_bool,
 		    { .bool_var = &settings.strict_rmt}},
+		{ "Storage I/O", rit_io, { NULL }},
+		{ "DB memory",	rit_mem, { NULL }},
 	};
 	struct ui_rd_ctx *c = ctx;
 	const struct rd_item *item;
+	struct storage_io_stats s;
+	struct arena_stats m;
+	/* format has no bound, so we size for the longest possible values */
+	char tmp[sizeof("R 4294967295 P 4294967295 E 4294967295 (4294967295)")];
+	char mem[sizeof("4294967295/4294967295 F 4294967295%")];
+	char *p = tmp;
 
 	lists[0] = &c->list;
 
@@ -162,8 +181,19 @@ static void ui_rd_open(void *ctx, void *params)
 	    GFX_CENTER, GFX_CENTER, GFX_WHITE);
 
 	wi_list_begin(&c->list, &style);
+	db_io_stats(&s);
+	format(add_char, &p, "R %u P %u E %u (%u)",
+	    s.reads, s.programs, s.erases, s.max_sector_erases);
+	db_mem_stats(&main_db, &m);
+	p = mem;
+	/* fragmentation: freed objects waiting for reuse */
+	format(add_char, &p, "%u/%u F %u%%", (unsigned) m.in_use,
+	    (unsigned) m.high_water,
+	    m.free ? (unsigned) (m.free * 100 / (m.in_use + m.free)) : 0);
 	for (item = items; item != items + ARRAY_ENTRIES(items); item++)
-		wi_list_add(&c->list, item->label, NULL, (void *) item);
+		wi_list_add(&c->list, item->label,
+		    item->type == rit_io ? tmp :
+		    item->type == rit_mem ? mem : NULL, (void *) item);
 	wi_list_end(&c->list);
 }
 